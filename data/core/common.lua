@@ -151,25 +151,11 @@ function common.splice(t, at, remove, insert)
 end
 
 
-local function compare_score(a, b)
-  if a.score == b.score then
-    return a.text < b.text
-  end
-  return a.score > b.score
-end
-
-local function fuzzy_match_items(items, needle, files)
+local function fuzzy_match_items(items, needle, files, limit)
   local res = {}
   needle = (PLATFORM == "Windows" and files) and needle:gsub('/', PATHSEP) or needle
-  for _, item in ipairs(items) do
-    local score = system.fuzzy_match(tostring(item), needle, files)
-    if score then
-      table.insert(res, { text = item, score = score })
-    end
-  end
-  table.sort(res, compare_score)
-  for i, item in ipairs(res) do
-    res[i] = item.text
+  for i, idx in ipairs(system.fuzzy_match_list(items, needle, files, limit)) do
+    res[i] = items[idx]
   end
   return res
 end
@@ -179,15 +165,15 @@ end
 ---
 ---If the haystack is a string, a score ranging from 0 to 1 is returned. </br>
 ---If the haystack is a table, a table containing the haystack sorted in ascending
----order of similarity is returned.
+---order of similarity is returned, only with the best `limit` items if given.
 ---@param haystack string
 ---@param needle string
 ---@param files? boolean If true, the matching process will be performed in reverse to better match paths.
 ---@return number
----@overload fun(haystack: string[], needle: string, files?: boolean): string[]
-function common.fuzzy_match(haystack, needle, files)
+---@overload fun(haystack: string[], needle: string, files?: boolean, limit?: integer): string[]
+function common.fuzzy_match(haystack, needle, files, limit)
   if type(haystack) == "table" then
-    return fuzzy_match_items(haystack, needle, files)
+    return fuzzy_match_items(haystack, needle, files, limit)
   end
   return system.fuzzy_match(haystack, needle, files)
 end
@@ -10,6 +10,14 @@ local config = {}
 ---@type number
 config.fps = 60
 
+---The number of threads used to redraw large areas of the window,
+---like after resizing it or changing the color scheme.
+---Using more than 1 thread can help on high resolution displays.
+---
+---Defaults to 1.
+---@type integer
+config.render_threads = 1
+
 ---Maximum number of log items that will be stored.
 ---When the number of log items exceed this value, old items will be discarded.
 ---
@@ -78,6 +86,21 @@ config.ignore_files = {
   "^desktop%.ini$", "^%.DS_Store$", "^%.directory$",
 }
 
+---The time in seconds that changes to watched directories are gathered for,
+---before the editor handles them. Bursts of changes, like the files written
+---by a build, are then handled together.
+---
+---Defaults to 0.05.
+---@type number
+config.dirmonitor_debounce = 0.05
+
+---Tokenizes documents in a background thread, rather than in small steps
+---between frames.
+---
+---Defaults to false.
+---@type boolean
+config.threaded_highlighting = false
+
 ---Lua pattern used to find symbols when advanced syntax highlighting
 ---is not available.
 ---This pattern is also used for navigation, e.g. move to next word.
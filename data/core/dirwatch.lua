@@ -28,7 +28,7 @@ function dirwatch.new()
     scanned = {},
     watched = {},
     reverse_watched = {},
-    monitor = dirmonitor.new(),
+    monitor = dirmonitor.new(config.dirmonitor_debounce),
     single_watch_top = nil,
     single_watch_count = 0
   }
@@ -114,36 +114,63 @@ function dirwatch:unwatch(directory)
   end
 end
 
+---A change to an entry of a watched directory.
+---@class core.dirwatch.change
+---@field name string
+---@field change "created"|"deleted"|"modified"|"moved_from"|"moved_to"
+
 ---Checks each watched paths for changes.
 ---This function must be called in a coroutine, e.g. inside a thread created with `core.add_thread()`.
----@param change_callback fun(path: string)
+---
+---The callback is called once for each path that changed. When the backend
+---reports the entries that changed, like inotify does, they're passed in the
+---order they happened, so that caches can be updated in place. Otherwise the
+---whole path has to be checked again.
+---@param change_callback fun(path: string, changes?: core.dirwatch.change[])
 ---@param scan_time? number Maximum amount of time, in seconds, before the function yields execution.
 ---@param wait_time? number The duration to yield execution (in seconds).
 ---@return boolean # If true, a path had changed.
 function dirwatch:check(change_callback, scan_time, wait_time)
   local had_change = false
   local last_error
-  self.monitor:check(function(id)
+  local paths, changes = {}, {}
+  local function add_change(path, name, change)
+    if changes[path] == nil then table.insert(paths, path) end
+    if name and change and changes[path] ~= false then
+      changes[path] = changes[path] or {}
+      table.insert(changes[path], { name = name, change = change })
+    else
+      changes[path] = false
+    end
+  end
+  self.monitor:check(function(id, name, change)
     had_change = true
-    if self.monitor:mode() == "single" then
+    if change == "overflow" then
+      -- changes were lost, everything has to be checked again
+      for path in pairs(self.watched) do add_change(path) end
+    elseif self.monitor:mode() == "single" then
       local path = common.dirname(id)
       if not string.match(id, "^/") and not string.match(id, "^%a:[/\\]") then
         path = common.dirname(self.single_watch_top .. PATHSEP .. id)
       end
-      change_callback(path)
+      add_change(path, name, change)
     elseif self.reverse_watched[id] then
-      local path = self.reverse_watched[id]
-      change_callback(path)
+      add_change(self.reverse_watched[id], name, change)
+    end
+  end, function(err)
+    last_error = err
+  end)
+  if last_error ~= nil then error(last_error) end
+  for _, path in ipairs(paths) do
+    change_callback(path, changes[path] or nil)
+    if self.monitor:mode() == "multiple" then
       local info = system.get_file_info(path)
       if info and info.type == "file" then
         self:unwatch(path)
         self:watch(path)
       end
     end
-  end, function(err)
-    last_error = err
-  end)
-  if last_error ~= nil then error(last_error) end
+  end
   local start_time = system.get_time()
   for directory, old_modified in pairs(self.scanned) do
     if old_modified then
@@ -1,5 +1,4 @@
 local core = require "core"
-local common = require "core.common"
 local config = require "core.config"
 local tokenizer = require "core.tokenizer"
 local Object = require "core.object"
@@ -9,6 +8,10 @@ local Highlighter = Object:extend()
 
 function Highlighter:__tostring() return "Highlighter" end
 
+-- Highlighters by the id of their background job
+local jobs = setmetatable({}, { __mode = "v" })
+local last_job_id = 0
+
 function Highlighter:new(doc)
   self.doc = doc
   self.running = false
@@ -17,12 +20,16 @@ end
 
 -- init incremental syntax highlighting
 function Highlighter:start()
+  if config.threaded_highlighting and not self.job_failed then
+    return self:start_job()
+  end
   if self.running then return end
   self.running = true
   core.add_thread(function()
     while self.first_invalid_line <= self.max_wanted_line do
       local max = math.min(self.first_invalid_line + 40, self.max_wanted_line)
       local retokenized_from
+      local next_line
       for i = self.first_invalid_line, max do
         local state = (i > 1) and self.lines[i - 1].state
         local line = self.lines[i]
@@ -37,13 +44,18 @@ function Highlighter:start()
             self.first_invalid_line = i
             goto yield
           end
+          next_line = self:get_checkpoint(i)
+          if next_line then
+            max = i
+            break
+          end
         elseif retokenized_from then
           self:update_notify(retokenized_from, i - retokenized_from - 1)
           retokenized_from = nil
         end
       end
 
-      self.first_invalid_line = max + 1
+      self.first_invalid_line = next_line or max + 1
       ::yield::
       if retokenized_from then
         self:update_notify(retokenized_from, max - retokenized_from)
@@ -56,6 +68,69 @@ function Highlighter:start()
   end, self)
 end
 
+-- Lines are tokenized in a background thread from a snapshot of the doc, the
+-- job is replaced whenever the doc changes. Its results are merged when a
+-- "highlighted" event is received, see `Highlighter.on_highlighted`.
+function Highlighter:start_job()
+  if self.job then
+    self.job:extend(self.max_wanted_line)
+    return
+  end
+  local line = self.first_invalid_line
+  local state = (line > 1) and self.lines[line - 1].state
+  local job, err = tokenizer.highlight(self.doc.syntax, self.doc.lines, line, state,
+                                       self.max_wanted_line, last_job_id + 1)
+  if not job then
+    core.warn("Highlighting in the foreground: %s", err)
+    self.job_failed = true
+    return self:start()
+  end
+  last_job_id = last_job_id + 1
+  jobs[last_job_id] = self
+  self.job, self.job_id, self.job_state = job, last_job_id, state
+end
+
+function Highlighter:cancel_job()
+  if not self.job then return end
+  self.job:cancel()
+  jobs[self.job_id] = nil
+  self.job, self.job_id, self.job_state = nil, nil, nil
+end
+
+function Highlighter.on_highlighted(id)
+  local self = jobs[id]
+  if not self or self.job_id ~= id then return end
+  local first, results, err = self.job:poll()
+  if first and #results > 0 then
+    local last, next_line
+    for k, res in ipairs(results) do
+      last = first + k - 1
+      res.init_state = self.job_state
+      self.job_state = res.state
+      self.lines[last] = res
+      next_line = self:get_checkpoint(last)
+      if next_line then break end
+    end
+    self.first_invalid_line = math.max(self.first_invalid_line, next_line or last + 1)
+    self:update_notify(first, last - first)
+    core.redraw = true
+    if next_line then
+      -- the rest of the job would give the lines we already have
+      self:cancel_job()
+      if self.first_invalid_line <= self.max_wanted_line then
+        self:start()
+      end
+      return
+    end
+  end
+  if err then
+    -- let the foreground tokenizer report the error
+    self:cancel_job()
+    self.job_failed = true
+    self:start()
+  end
+end
+
 local function set_max_wanted_lines(self, amount)
   self.max_wanted_line = amount
   if self.first_invalid_line <= self.max_wanted_line then
@@ -70,30 +145,80 @@ function Highlighter:reset()
 end
 
 function Highlighter:soft_reset()
-  for i=1,#self.lines do
+  self:cancel_job()
+  for i in pairs(self.lines) do
     self.lines[i] = false
   end
   self.first_invalid_line = 1
   self.max_wanted_line = 0
+  self.changed_line = 0
+  self.checkpoint_line = nil
 end
 
 function Highlighter:invalidate(idx)
+  self:cancel_job()
   self.first_invalid_line = math.min(self.first_invalid_line, idx)
   set_max_wanted_lines(self, math.min(self.max_wanted_line, #self.doc.lines))
 end
 
+-- Lines that were valid before an edit stay valid if the state at their start
+-- is the same once the edited lines are retokenized. `checkpoint_line` is the
+-- end of the lines that were valid before the edits, and `changed_line` the
+-- last edited line before it; after that line, retokenizing stops at the first
+-- line whose end state is the init state of the next one. States are short
+-- strings, which Lua interns, so comparing them is a pointer compare.
+local function update_checkpoint(self, line, n)
+  local valid_end = self.first_invalid_line
+  if valid_end > line and valid_end > (self.checkpoint_line or 0) then
+    self.checkpoint_line = valid_end
+  end
+  if not self.checkpoint_line or self.checkpoint_line <= line then return end
+  -- lines after the edit moved by n
+  self.checkpoint_line = math.max(line + 1, self.checkpoint_line + n)
+  if self.changed_line > line then
+    self.changed_line = math.max(line, self.changed_line + n)
+  end
+  self.changed_line = math.max(self.changed_line, line + math.max(n, 0))
+end
+
+---Returns the line to continue highlighting from, if the lines after `idx`
+---are still valid with the state at the end of `idx`.
+---@param idx integer
+---@return integer?
+function Highlighter:get_checkpoint(idx)
+  local checkpoint = self.checkpoint_line
+  if not checkpoint or idx < self.changed_line or idx + 1 >= checkpoint then
+    return nil
+  end
+  local line, next_line = self.lines[idx], self.lines[idx + 1]
+  if next_line and next_line.init_state == line.state and not next_line.resume
+  and next_line.text == self.doc.lines[idx + 1] then
+    self.checkpoint_line = nil
+    self.changed_line = 0
+    return checkpoint
+  end
+end
+
+-- `self.lines` is sparse as lines are only tokenized when needed, so it's
+-- shifted using the line count of the doc, which has already been updated.
 function Highlighter:insert_notify(line, n)
+  update_checkpoint(self, line, n)
   self:invalidate(line)
-  local blanks = { }
-  for i = 1, n do
-    blanks[i] = false
+  local count = #self.doc.lines
+  table.move(self.lines, line, count - n, line + n)
+  for i = line, line + n - 1 do
+    self.lines[i] = nil
   end
-  common.splice(self.lines, line, 0, blanks)
 end
 
 function Highlighter:remove_notify(line, n)
+  update_checkpoint(self, line, -n)
   self:invalidate(line)
-  common.splice(self.lines, line, n)
+  local count = #self.doc.lines
+  table.move(self.lines, line + n, count + n, line)
+  for i = count + 1, count + n do
+    self.lines[i] = nil
+  end
 end
 
 function Highlighter:update_notify(line, n)
@@ -5,6 +5,7 @@ local core = require "core"
 local syntax = require "core.syntax"
 local config = require "core.config"
 local common = require "core.common"
+local buffer = require "buffer"
 
 ---@class core.doc : core.object
 local Doc = Object:extend()
@@ -35,7 +36,7 @@ function Doc:new(filename, abs_filename, new_file)
 end
 
 function Doc:reset()
-  self.lines = { "\n" }
+  self.lines = buffer.new({ "\n" })
   self.selections = { 1, 1, 1, 1 }
   self.last_selection = 1
   self.undo_stack = { idx = 1 }
@@ -67,23 +68,12 @@ function Doc:set_filename(filename, abs_filename)
 end
 
 function Doc:load(filename)
-  local fp = assert(io.open(filename, "rb"))
+  local lines, crlf = assert(buffer.load(filename))
   self:reset()
-  self.lines = {}
-  local i = 1
-  for line in fp:lines() do
-    if line:byte(-1) == 13 then
-      line = line:sub(1, -2)
-      self.crlf = true
-    end
-    table.insert(self.lines, line .. "\n")
-    self.highlighter.lines[i] = false
-    i = i + 1
-  end
-  if #self.lines == 0 then
-    table.insert(self.lines, "\n")
+  self.lines = lines
+  if crlf then
+    self.crlf = true
   end
-  fp:close()
   self:reset_syntax()
 end
 
@@ -359,12 +349,7 @@ function Doc:get_text(line1, col1, line2, col2, inclusive)
   if line1 == line2 then
     return self.lines[line1]:sub(col1, col2 - col2_offset)
   end
-  local lines = { self.lines[line1]:sub(col1) }
-  for i = line1 + 1, line2 - 1 do
-    table.insert(lines, self.lines[i])
-  end
-  table.insert(lines, self.lines[line2]:sub(1, col2 - col2_offset))
-  return table.concat(lines)
+  return self.lines:get_text(line1, col1, line2, col2 + 1 - col2_offset)
 end
 
 function Doc:get_char(line, col)
@@ -425,7 +410,7 @@ function Doc:raw_insert(line, col, text, undo_stack, time)
   lines[#lines] = lines[#lines] .. after
 
   -- splice lines into line array
-  common.splice(self.lines, line, 1, lines)
+  self.lines:splice(line, 1, lines)
 
   -- keep cursors where they should be
   for idx, cline1, ccol1, cline2, ccol2 in self:get_selections(true, true) do
@@ -460,7 +445,7 @@ function Doc:raw_remove(line1, col1, line2, col2, undo_stack, time)
   local col_removal = col2 - col1
 
   -- splice line into line array
-  common.splice(self.lines, line1, line_removal + 1, { before .. after })
+  self.lines:splice(line1, line_removal + 1, { before .. after })
 
   local merge = false
 
@@ -426,7 +426,7 @@ function DocView:update()
     local T, t0 = config.blink_period, core.blink_start
     local ta, tb = core.blink_timer, system.get_time()
     if ((tb - t0) % T < T / 2) ~= ((ta - t0) % T < T / 2) then
-      core.redraw = true
+      core.redraw_view(self)
     end
     core.blink_timer = tb
   end
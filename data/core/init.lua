@@ -14,6 +14,7 @@ local CommandView
 local NagView
 local DocView
 local Doc
+local Highlighter
 local Project
 
 local core = {}
@@ -69,6 +70,7 @@ function core.remove_project(project, force)
     if project == core.projects[i] or project == core.projects[i].path then
       local project = core.projects[i]
       table.remove(core.projects, i)
+      project:close()
       return project
     end
   end
@@ -275,6 +277,7 @@ function core.init()
   Project = require "core.project"
   DocView = require "core.docview"
   Doc = require "core.doc"
+  Highlighter = require "core.doc.highlighter"
 
   if PATHSEP == '\\' then
     USERDIR = common.normalize_volume(USERDIR)
@@ -324,6 +327,7 @@ function core.init()
   core.blink_timer = core.blink_start
   core.active_file_dialogs = {}
   core.redraw = true
+  core.redraw_views = {}
   core.visited_files = {}
   core.restart_request = false
   core.quit_request = false
@@ -719,6 +723,14 @@ function core.add_thread(f, weak_ref, ...)
 end
 
 
+---Requests a redraw of a single view. Unless something else also requested
+---a redraw, the other views replay what they drew in the previous frame.
+---@param view core.view
+function core.redraw_view(view)
+  core.redraw_views[view] = true
+end
+
+
 function core.push_clip_rect(x, y, w, h)
   local x2, y2, w2, h2 = table.unpack(core.clip_rect_stack[#core.clip_rect_stack])
   local r, b, r2, b2 = x+w, y+h, x2+w2, y2+h2
@@ -902,6 +914,12 @@ function core.on_event(type, ...)
       core.active_file_dialogs[id] = nil
       callback(status, result)
     end
+  elseif type == "highlighted" then
+    Highlighter.on_highlighted(...)
+  elseif type == "process" then
+    for _, thread in pairs(core.threads) do
+      if process.waiting[thread.cr] then thread.wake = 0 end
+    end
   elseif type == "focuslost" then
     core.root_view:on_focus_lost(...)
   elseif type == "quit" then
@@ -949,8 +967,10 @@ function core.step()
   -- update
   core.root_view.size.x, core.root_view.size.y = width, height
   core.root_view:update()
-  if not core.redraw then return false end
+  if not core.redraw and not next(core.redraw_views) then return false end
+  local redraw_views = not core.redraw and core.redraw_views
   core.redraw = false
+  core.redraw_views = {}
 
   -- close unreferenced docs
   for i = #core.docs, 1, -1 do
@@ -968,7 +988,15 @@ function core.step()
     core.window_title = current_title
   end
 
+  -- only some views asked to be redrawn, the others didn't change
+  if redraw_views then
+    for _, view in ipairs(core.root_view.root_node:get_children()) do
+      if not redraw_views[view] then view:mark_clean() end
+    end
+  end
+
   -- draw
+  renderer.set_render_threads(config.render_threads)
   renderer.begin_frame(core.window)
   core.clip_rect_stack[1] = { 0, 0, width, height }
   renderer.set_clip_rect(table.unpack(core.clip_rect_stack[1]))
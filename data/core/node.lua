@@ -619,7 +619,7 @@ function Node:draw()
     end
     local pos, size = self.active_view.position, self.active_view.size
     core.push_clip_rect(pos.x, pos.y, size.x, size.y)
-    self.active_view:draw()
+    self.active_view:draw_retained()
     core.pop_clip_rect()
   else
     local x, y, w, h = self:get_divider_rect()
@@ -1,6 +1,29 @@
 local config = require "core.config"
 local common = require "core.common"
 
+-- How long threads wait for the events of processes, at most
+local IO_WAIT = 1
+
+---Threads waiting for the output or the exit of processes, which `core`
+---wakes up on "process" events.
+---@type table<thread, boolean>
+process.waiting = setmetatable({}, { __mode = "k" })
+
+---Yields the current thread until a process has new output or exited. Without
+---events, the thread is woken up after `scan` seconds or the next frame.
+---@param scan? number The amount of seconds to wait, at most.
+---@param timeout? number The amount of seconds left before a timeout.
+local function wait_for_io(scan, timeout)
+  if not process.IO_EVENTS then
+    coroutine.yield(scan or (1 / config.fps))
+    return
+  end
+  local co = coroutine.running()
+  process.waiting[co] = true
+  coroutine.yield(scan or math.min(IO_WAIT, timeout or IO_WAIT))
+  process.waiting[co] = nil
+end
+
 
 ---An abstraction over the standard input and outputs of a process
 ---that allows you to read and write data easily.
@@ -27,7 +50,7 @@ end
 ---Options that can be passed to stream.read().
 ---@class process.stream.readoption
 ---@field public timeout number The number of seconds to wait before the function throws an error. Reads do not time out by default.
----@field public scan number The number of seconds to yield in a coroutine. Defaults to `1/config.fps`.
+---@field public scan number The number of seconds to yield in a coroutine. Defaults to `1/config.fps`, the coroutine is woken up as soon as there's new output when `process.IO_EVENTS` is true.
 
 ---Reads data from the stream.
 ---
@@ -78,10 +101,11 @@ function process.stream:read(bytes, options)
         if s then target = self.len - #chunk + s end
       end
     elseif coroutine.isyieldable() then
-      if options.timeout and system.get_time() - start > options.timeout then
+      local elapsed = system.get_time() - start
+      if options.timeout and elapsed > options.timeout then
         error("timeout expired")
       end
-      coroutine.yield(options.scan or (1 / config.fps))
+      wait_for_io(options.scan, options.timeout and options.timeout - elapsed)
     else
       break
     end
@@ -94,6 +118,98 @@ function process.stream:read(bytes, options)
 end
 
 
+---Reads with `process:read()` into the buffer of the stream until `find` locates
+---the data to return in it, for when the output isn't buffered natively.
+---@param find fun(str: string): integer?, integer? Returns the end of the data, and of what's consumed.
+local function read_buffered(self, find, options)
+  local start = system.get_time()
+  local ended = false
+  while true do
+    local str = table.concat(self.buf)
+    local data_end, consumed = find(str)
+    if not data_end and ended and #str > 0 then data_end, consumed = #str, #str end
+    if data_end then
+      self.len = #str - consumed
+      self.buf = self.len > 0 and { str:sub(consumed + 1) } or {}
+      return str:sub(1, data_end)
+    end
+    if ended then return nil end
+    self.buf = #str > 0 and { str } or {}
+    -- without native buffers, the output is complete once the process exited
+    local running = process.IO_EVENTS or self.process:running()
+    local chunk = self.process.process:read(self.fd, 65536)
+    if not chunk then return nil end
+    if #chunk > 0 then
+      table.insert(self.buf, chunk)
+      self.len = self.len + #chunk
+    elseif not running or (process.IO_EVENTS and select(2, self.process.process:read_exact(self.fd, 0))) then
+      ended = true
+    elseif coroutine.isyieldable() then
+      local elapsed = system.get_time() - start
+      if options.timeout and elapsed > options.timeout then
+        error("timeout expired")
+      end
+      wait_for_io(options.scan, options.timeout and options.timeout - elapsed)
+    else
+      return nil
+    end
+  end
+end
+
+---Reads with a method of the process that reads from its native buffer,
+---returning nil until the data was read, and whether the stream ended.
+local function read_native(self, method, arg, options)
+  local start = system.get_time()
+  while true do
+    local data, ended = self.process.process[method](self.process.process, self.fd, arg)
+    if data or ended or not coroutine.isyieldable() then return data end
+    local elapsed = system.get_time() - start
+    if options.timeout and elapsed > options.timeout then
+      error("timeout expired")
+    end
+    wait_for_io(options.scan, options.timeout and options.timeout - elapsed)
+  end
+end
+
+---Reads data from the stream until `delimiter`, which is consumed but not
+---returned, like the headers of a message ending with `"\r\n\r\n"`.
+---At the end of the stream, what's left is returned.
+---
+---Inside a coroutine, the function waits for the delimiter. Otherwise it
+---returns nil if the delimiter wasn't read yet.
+---@param delimiter string
+---@param options? process.stream.readoption Options for reading from the stream.
+---@return string|nil data
+function process.stream:read_until(delimiter, options)
+  options = options or {}
+  if process.IO_EVENTS and self.len == 0 then
+    return read_native(self, "read_until", delimiter, options)
+  end
+  return read_buffered(self, function(str)
+    local s, e = str:find(delimiter, 1, true)
+    if s then return s - 1, e end
+  end, options)
+end
+
+---Reads exactly `bytes` bytes from the stream, like the body of a message
+---with a known length. At the end of the stream, what's left is returned.
+---
+---Inside a coroutine, the function waits for all the bytes. Otherwise it
+---returns nil if they weren't all read yet.
+---@param bytes integer
+---@param options? process.stream.readoption Options for reading from the stream.
+---@return string|nil data
+function process.stream:read_exact(bytes, options)
+  options = options or {}
+  if process.IO_EVENTS and self.len == 0 then
+    return read_native(self, "read_exact", bytes, options)
+  end
+  return read_buffered(self, function(str)
+    if #str >= bytes then return bytes, bytes end
+  end, options)
+end
+
+
 ---Options that can be passed into stream.write().
 ---@class process.stream.writeoption
 ---@field public scan number The number of seconds to yield in a coroutine. Defaults to `1/config.fps`.
@@ -132,13 +248,13 @@ end
 ---the function yields to the main thread occassionally to avoid blocking the editor. <br>
 ---Otherwise, the function blocks the editor until the process exited or the timeout has expired.
 ---@param timeout? number The amount of seconds to wait. If omitted, the function will wait indefinitely.
----@param scan? number The amount of seconds to yield while scanning. If omittted, the scan rate will be the FPS.
+---@param scan? number The amount of seconds to yield while scanning. If omittted, the scan rate will be the FPS, or the exit is waited for when `process.IO_EVENTS` is true.
 ---@return integer|nil exit_code The exit code for this process, or nil if the wait timed out.
 function process:wait(timeout, scan)
   if not coroutine.isyieldable() then return self.process:wait(timeout) end
   local start = system.get_time()
   while self.process:running() and (system.get_time() - start < (timeout or math.huge)) do
-    coroutine.yield(scan or (1 / config.fps))
+    wait_for_io(scan, timeout and timeout - (system.get_time() - start))
   end
   return self.process:returncode()
 end
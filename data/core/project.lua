@@ -5,6 +5,7 @@ local Project = Object:extend()
 local core = require "core"
 local common = require "core.common"
 local config = require "core.config"
+local dirwatch = require "core.dirwatch"
 
 -- inspect config.ignore_files patterns and prepare ready to use entries.
 local function compile_ignore_files()
@@ -130,9 +131,114 @@ local function find_files_rec(project, path)
 end
 
 
+-- Keeps the index of a project current, until the project is closed. When the
+-- dirmonitor watches whole trees, the root of the project is watched and the
+-- directories that change are rescanned. Otherwise, watching each directory
+-- would take as many watches as there are directories, on top of the ones of
+-- the tree view, so the directories it watches are rescanned when they change
+-- (see Project:directory_changed) and the whole tree is only checked for
+-- modified directories from time to time. That check stats every directory,
+-- so it's spaced with the size of the tree, and further apart while it finds
+-- nothing.
+local MIN_CHECK_INTERVAL, MAX_CHECK_INTERVAL = 10, 1800
+
+local function watch_index(project, index)
+  local watch = dirwatch.new()
+  local single = watch.monitor:mode() == "single"
+  if single then watch:watch(project.path) end
+  project.index_watches_tree = single
+  local last_check, interval, last_scans = system.get_time(), nil, nil
+  local warned = false
+  while project.index == index do
+    local ready, n_files, scans, err = index:status()
+    if err and not warned then
+      core.warn("Error while indexing %s: %s", project.path, err)
+      warned = true
+    end
+    if single then
+      watch:check(function(dir)
+        if project.index == index then index:refresh(dir) end
+      end)
+    elseif ready then
+      local base = math.max(MIN_CHECK_INTERVAL, n_files / 1000)
+      interval = interval or base
+      if system.get_time() - last_check > interval then
+        -- nothing was rescanned since the last check
+        if scans == last_scans then
+          interval = math.min(interval * 2, math.max(MAX_CHECK_INTERVAL, base))
+        else
+          interval = base
+        end
+        last_scans = scans
+        index:refresh()
+        last_check = system.get_time()
+      end
+    end
+    coroutine.yield(ready and 0.05 or 0.1)
+  end
+  watch:unwatch(project.path)
+end
+
+
+---Returns the native index of the files of the project, which is built in
+---the background once and then updated as the directories change.
+---@return fileindex?
+function Project:get_index()
+  if self.index == nil then
+    local index, err = fileindex.new(self.path, self.compiled, config.file_size_limit * 1e6)
+    if not index then
+      core.warn("Unable to index %s: %s", self.path, err)
+    else
+      core.add_thread(watch_index, nil, self, index)
+    end
+    self.index = index or false
+  end
+  return self.index or nil
+end
+
+
+---Rescans a directory of the project that changed, for the watchers of
+---directories to keep the index current when it isn't watched as a whole.
+---@param path string
+function Project:directory_changed(path)
+  if self.index and not self.index_watches_tree then self.index:refresh(path) end
+end
+
+
+---Stops indexing the project and frees its index. The index is created again
+---if it's needed afterwards.
+function Project:close()
+  if self.index then self.index:close() end
+  self.index = nil
+end
+
+
+---Returns the entries of a directory of the project that aren't ignored, or
+---nil if the index doesn't have an up to date listing of it yet.
+---@param path string
+---@return table[]?
+function Project:list_dir(path)
+  local index = self:get_index()
+  return index and index:list(path)
+end
+
+
 function Project:files()
+  local index = self:get_index()
+  if not index or not index:status() then
+    return coroutine.wrap(function()
+      find_files_rec(self, self.path)
+    end)
+  end
   return coroutine.wrap(function()
-    find_files_rec(self, self.path)
+    local cursor = 1
+    repeat
+      local files
+      files, cursor = index:files(cursor, 1000)
+      for _, info in ipairs(files) do
+        coroutine.yield(self, info)
+      end
+    until not cursor
   end)
 end
 
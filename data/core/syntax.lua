@@ -3,6 +3,9 @@ local core   = require "core"
 
 local syntax = {}
 syntax.items = {}
+---Bumped when syntaxes are added or changed, for the tokenizer to compile
+---them again.
+syntax.version = 0
 
 syntax.plain_text_syntax = { name = "Plain Text", patterns = {}, symbols = {} }
 
@@ -74,6 +77,16 @@ function syntax.add(t)
   end
 
   table.insert(syntax.items, t)
+  syntax.version = syntax.version + 1
+end
+
+
+---Tells the tokenizer that the patterns or symbols of syntaxes that were
+---already added were edited in place, so that they're compiled again.
+---Appending patterns to a syntax is noticed without it, but not other edits,
+---like changing a pattern, its type, the symbols, or a subsyntax.
+function syntax.changed()
+  syntax.version = syntax.version + 1
 end
 
 
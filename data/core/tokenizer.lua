@@ -5,52 +5,6 @@ local config = require "core.config"
 local tokenizer = {}
 local bad_patterns = {}
 
-local function push_token(t, type, text)
-  if not text or #text == 0 then return end
-  type = type or "normal"
-  local prev_type = t[#t-1]
-  local prev_text = t[#t]
-  if prev_type and (prev_type == type or (prev_text:ufind("^%s*$") and type ~= "incomplete")) then
-    t[#t-1] = type
-    t[#t] = prev_text .. text
-  else
-    table.insert(t, type)
-    table.insert(t, text)
-  end
-end
-
-
-local function push_tokens(t, syn, pattern, full_text, find_results)
-  if #find_results > 2 then
-    -- We do some manipulation with find_results so that it's arranged
-    -- like this:
-    -- { start, end, i_1, i_2, i_3, …, i_last }
-    -- Each position spans characters from i_n to ((i_n+1) - 1), to form
-    -- consecutive spans of text.
-    --
-    -- Insert the start index at i_1 to make iterating easier
-    table.insert(find_results, 3, find_results[1])
-    -- Copy the ending index to the end of the table, so that an ending index
-    -- always follows a starting index after position 3 in the table.
-    table.insert(find_results, find_results[2] + 1)
-    -- Then, we just iterate over our modified table.
-    for i = 3, #find_results - 1 do
-      local start = find_results[i]
-      local fin = find_results[i + 1] - 1
-      local type = pattern.type[i - 2]
-        -- ↑ (i - 2) to convert from [3; n] to [1; n]
-      if fin >= start then
-        local text = full_text:usub(start, fin)
-        push_token(t, syn.symbols[text] or type, text)
-      end
-    end
-  else
-    local start, fin = find_results[1], find_results[2]
-    local text = full_text:usub(start, fin)
-    push_token(t, syn.symbols[text] or pattern.type, text)
-  end
-end
-
 -- State is a string of bytes, where the count of bytes represents the depth
 -- of the subsyntax we are currently in. Each individual byte represents the
 -- index of the pattern for the current subsyntax in relation to its parent
@@ -128,12 +82,55 @@ local function report_bad_pattern(log_fn, syntax, pattern_idx, msg, ...)
             syntax.name or "unnamed", ...)
 end
 
+local bad_pattern_messages = {
+  empty = "Pattern successfully matched, but nothing was captured.",
+  type_table = "Token type is a table, but a string was expected.",
+  not_enough_types = "Not enough token types: got %d needed %d.",
+  too_many_types = "Too many token types: got %d needed %d.",
+}
+
+local function report_lexer_bad_pattern(syntax, pattern_idx, kind, n_types, n_results)
+  local log_fn = kind == "not_enough_types" and core.error or core.warn
+  report_bad_pattern(log_fn, syntax, pattern_idx, bad_pattern_messages[kind], n_types, n_results)
+  if kind == "type_table" then
+    local p = syntax.patterns[pattern_idx]
+    p.type = p.type[1]
+  end
+end
+
+-- Syntaxes are compiled to a native lexer with their subsyntaxes the first
+-- time they're used, and again once syntax.version changes, or when the
+-- patterns of the syntax were replaced or appended to.
+-- Background jobs get lexers of their own, as a lexer can only be used by
+-- one thread.
+local lexers = setmetatable({}, { __mode = "k" })
+local job_lexers = setmetatable({}, { __mode = "k" })
+local lexers_version = syntax.version
+
+local function get_lexer(incoming_syntax, for_jobs)
+  if syntax.version ~= lexers_version then
+    lexers = setmetatable({}, { __mode = "k" })
+    job_lexers = setmetatable({}, { __mode = "k" })
+    lexers_version = syntax.version
+  end
+  local cache = for_jobs and job_lexers or lexers
+  local patterns = incoming_syntax.patterns
+  local c = cache[incoming_syntax]
+  if not c or c.patterns ~= patterns or c.n_patterns ~= #patterns then
+    c = {
+      lexer = lexer.new(incoming_syntax, syntax.get, report_lexer_bad_pattern),
+      patterns = patterns, n_patterns = #patterns
+    }
+    cache[incoming_syntax] = c
+  end
+  return c.lexer
+end
+
 ---@param incoming_syntax table
 ---@param text string
 ---@param state string
 function tokenizer.tokenize(incoming_syntax, text, state, resume)
-  local res
-  local i = 1
+  local res, i
 
   state = state or string.char(0)
 
@@ -152,249 +149,34 @@ function tokenizer.tokenize(incoming_syntax, text, state, resume)
     state = resume.state
   end
 
-  res = res or {}
-
-  -- incoming_syntax    : the parent syntax of the file.
-  -- state              : a string of bytes representing syntax state (see above)
-
-  -- current_syntax     : the syntax we're currently in.
-  -- subsyntax_info     : info about the delimiters of this subsyntax.
-  -- current_pattern_idx: the index of the pattern we're on for this syntax.
-  -- current_level      : how many subsyntaxes deep we are.
-  local current_syntax, subsyntax_info, current_pattern_idx, current_level =
-    retrieve_syntax_state(incoming_syntax, state)
-
-  -- Should be used to set the state variable. Don't modify it directly.
-  local function set_subsyntax_pattern_idx(pattern_idx)
-    current_pattern_idx = pattern_idx
-    local state_len = #state
-    if current_level > state_len then
-      state = state .. string.char(pattern_idx)
-    elseif state_len == 1 then
-      state = string.char(pattern_idx)
-    else
-      state = ("%s%s%s"):format(
-        state:sub(1,current_level-1),
-        string.char(pattern_idx),
-        state:sub(current_level+1)
-      )
-    end
-  end
-
-
-  local function push_subsyntax(entering_syntax, pattern_idx)
-    set_subsyntax_pattern_idx(pattern_idx)
-    current_level = current_level + 1
-    subsyntax_info = entering_syntax
-    current_syntax = type(entering_syntax.syntax) == "table" and
-      entering_syntax.syntax or syntax.get(entering_syntax.syntax)
-    current_pattern_idx = 0
-  end
-
-  local function pop_subsyntax()
-    current_level = current_level - 1
-    state = string.sub(state, 1, current_level)
-    set_subsyntax_pattern_idx(0)
-    current_syntax, subsyntax_info, current_pattern_idx, current_level =
-      retrieve_syntax_state(incoming_syntax, state)
-  end
-
-  local function find_text(text, p, offset, at_start, close)
-    local target, res = p.pattern or p.regex, { 1, offset - 1 }
-    local p_idx = close and 2 or 1
-    local code = type(target) == "table" and target[p_idx] or target
-    if p.disabled then return end
-
-    if p.whole_line == nil then p.whole_line = { } end
-    if p.whole_line[p_idx] == nil then
-      -- Match patterns that start with '^'
-      p.whole_line[p_idx] = code:umatch("^%^") and true or false
-      if p.whole_line[p_idx] then
-        -- Remove '^' from the beginning of the pattern
-        if type(target) == "table" then
-          target[p_idx] = code:usub(2)
-          code = target[p_idx]
-        else
-          p.pattern = p.pattern and code:usub(2)
-          p.regex = p.regex and code:usub(2)
-          code = p.pattern or p.regex
-        end
-      end
-    end
-
-    if p.regex and type(p.regex) ~= "table" then
-      p._regex = p._regex or regex.compile(p.regex)
-      code = p._regex
-    end
-
-    repeat
-      local next = res[2] + 1
-      -- If the pattern contained '^', allow matching only the whole line
-      if p.whole_line[p_idx] and next > 1 then
-        return
-      end
-      res = p.pattern and { text:ufind((at_start or p.whole_line[p_idx]) and "^" .. code or code, next) }
-        or { regex.find(code, text, text:ucharpos(next), (at_start or p.whole_line[p_idx]) and regex.ANCHORED or 0) }
-      if p.regex and #res > 0 then -- set correct utf8 len for regex result
-        local char_pos_1 = res[1] > next and string.ulen(text:sub(1, res[1])) or next
-        local char_pos_2 = string.ulen(text:sub(1, res[2]))
-        for i=3,#res do
-          res[i] = string.ulen(text:sub(1, res[i] - 1)) + 1
-        end
-        res[1] = char_pos_1
-        res[2] = char_pos_2
-      end
-      if not res[1] then return end
-      if res[1] and target[3] then
-        -- Check to see if the escaped character is there,
-        -- and if it is not itself escaped.
-        local count = 0
-        for i = res[1] - 1, 1, -1 do
-          if text:ubyte(i) ~= target[3]:ubyte() then break end
-          count = count + 1
-        end
-        if count % 2 == 0 then
-          -- The match is not escaped, so confirm it
-          break
-        else
-          -- The match is escaped, so avoid it
-          res[1] = false
-        end
-      end
-    until at_start or not close or not target[3]
-    return table.unpack(res)
+  local resume_i
+  res, state, resume_i = get_lexer(incoming_syntax):tokenize(text, state, i, res, 0.5 / config.fps)
+  if resume_i then
+    -- We're out of time
+    return res, string.char(0), {
+      res = res,
+      i = resume_i,
+      state = state
+    }
   end
+  return res, state
+end
 
-  local text_len = text:ulen()
-  local start_time = system.get_time()
-  local starting_i = i
-  while i <= text_len do
-    -- Every 200 chars, check if we're out of time
-    if i - starting_i > 200 then
-      starting_i = i
-      if system.get_time() - start_time > 0.5 / config.fps then
-        -- We're out of time
-        push_token(res, "incomplete", string.usub(text, i))
-        return res, string.char(0), {
-          res = res,
-          i = i,
-          state = state
-        }
-      end
-    end
-    -- continue trying to match the end pattern of a pair if we have a state set
-    if current_pattern_idx > 0 then
-      local p = current_syntax.patterns[current_pattern_idx]
-      local find_results = { find_text(text, p, i, false, true) }
-      local s, e = find_results[1], find_results[2]
-      -- Use the first token type specified in the type table for the "middle"
-      -- part of the subsyntax.
-      local token_type = type(p.type) == "table" and p.type[1] or p.type
-
-      local cont = true
-      -- If we're in subsyntax mode, always check to see if we end our syntax
-      -- first, before the found delimeter, as ending the subsyntax takes
-      -- precedence over ending the delimiter in the subsyntax.
-      if subsyntax_info then
-        local ss, se = find_text(text, subsyntax_info, i, false, true)
-        -- If we find that we end the subsyntax before the
-        -- delimiter, push the token, and signal we shouldn't
-        -- treat the bit after as a token to be normally parsed
-        -- (as it's the syntax delimiter).
-        if ss and (s == nil or ss < s) then
-          push_token(res, token_type, text:usub(i, ss - 1))
-          i = ss
-          cont = false
-        end
-      end
-      -- If we don't have any concerns about syntax delimiters,
-      -- continue on as normal.
-      if cont then
-        if s then
-          -- Push remaining token before the end delimiter
-          if s > i then
-            push_token(res, token_type, text:usub(i, s - 1))
-          end
-          -- Push the end delimiter
-          push_tokens(res, current_syntax, p, text, find_results)
-          set_subsyntax_pattern_idx(0)
-          i = e + 1
-        else
-          push_token(res, token_type, text:usub(i))
-          break
-        end
-      end
-    end
-    -- General end of syntax check. Applies in the case where
-    -- we're ending early in the middle of a delimiter, or
-    -- just normally, upon finding a token.
-    while subsyntax_info do
-      local find_results = { find_text(text, subsyntax_info, i, true, true) }
-      local s, e = find_results[1], find_results[2]
-      if s then
-        push_tokens(res, current_syntax, subsyntax_info, text, find_results)
-        -- On finding unescaped delimiter, pop it.
-        pop_subsyntax()
-        i = e + 1
-      else
-        break
-      end
-    end
-
-    -- find matching pattern
-    local matched = false
-    for n, p in ipairs(current_syntax.patterns) do
-      local find_results = { find_text(text, p, i, true, false) }
-      if find_results[1] then
-        -- Check for patterns successfully matching nothing
-        if find_results[1] > find_results[2] then
-          report_bad_pattern(core.warn, current_syntax, n,
-              "Pattern successfully matched, but nothing was captured.")
-          goto continue
-        end
-
-        -- Check for patterns with mismatching number of `types`
-        local type_is_table = type(p.type) == "table"
-        local n_types = type_is_table and #p.type or 1
-        if #find_results == 2 and type_is_table then
-          report_bad_pattern(core.warn, current_syntax, n,
-            "Token type is a table, but a string was expected.")
-          p.type = p.type[1]
-        elseif #find_results - 1 > n_types then
-          report_bad_pattern(core.error, current_syntax, n,
-            "Not enough token types: got %d needed %d.", n_types, #find_results - 1)
-        elseif #find_results - 1 < n_types then
-          report_bad_pattern(core.warn, current_syntax, n,
-            "Too many token types: got %d needed %d.", n_types, #find_results - 1)
-        end
-
-        -- matched pattern; make and add tokens
-        push_tokens(res, current_syntax, p, text, find_results)
-        -- update state if this was a start|end pattern pair
-        if type(p.pattern or p.regex) == "table" then
-          -- If we have a subsyntax, push that onto the subsyntax stack.
-          if p.syntax then
-            push_subsyntax(p, n)
-          else
-            set_subsyntax_pattern_idx(n)
-          end
-        end
-        -- move cursor past this token
-        i = find_results[2] + 1
-        matched = true
-        break
-        ::continue::
-      end
-    end
-
-    -- consume character if we didn't match
-    if not matched then
-      push_token(res, "normal", text:usub(i, i))
-      i = i + 1
-    end
-  end
 
-  return res, state
+---Starts tokenizing `lines` from `line` to `last` in a background thread.
+---
+---The results are collected with `job:poll()` after a "highlighted" event
+---with the given `id` was received.
+---@param incoming_syntax table
+---@param lines buffer
+---@param line integer
+---@param state string?
+---@param last integer
+---@param id integer
+---@return lexer.highlight_job? job
+---@return string? error
+function tokenizer.highlight(incoming_syntax, lines, line, state, last, id)
+  return get_lexer(incoming_syntax, true):highlight(lines, line, state or string.char(0), last, id)
 end
 
 
@@ -46,6 +46,8 @@ local Scrollbar = require "core.scrollbar"
 ---@field v_scrollbar core.scrollbar
 ---@field h_scrollbar core.scrollbar
 ---@field current_scale number
+---@field clean boolean
+---@field draw_record table?
 local View = Object:extend()
 
 function View:__tostring() return "View" end
@@ -335,6 +337,46 @@ function View:draw()
 end
 
 
+---Marks the view as unchanged since the previous frame, so that its next
+---draw replays the commands it issued then instead of calling View:draw().
+---The mark only lasts until the next draw.
+function View:mark_clean()
+  self.clean = true
+end
+
+
+---Draws the view with View:draw(), recording the issued commands.
+---If the view was marked clean and its position, size and clip rect are the
+---same as when they were recorded, the commands are replayed instead.
+function View:draw_retained()
+  local clean, record = self.clean, self.draw_record
+  self.clean = false
+  local x, y, w, h = self.position.x, self.position.y, self.size.x, self.size.y
+  local cx, cy, cw, ch = table.unpack(core.clip_rect_stack[#core.clip_rect_stack])
+  if clean and record
+  and record.x == x and record.y == y and record.w == w and record.h == h
+  and record.cx == cx and record.cy == cy and record.cw == cw and record.ch == ch
+  and renderer.replay(record.list) then
+    return
+  end
+
+  local deferred = #core.root_view.deferred_draws
+  local start = renderer.begin_record()
+  self:draw()
+  -- deferred draws are not part of the recorded commands, so they can't be replayed
+  local list = #core.root_view.deferred_draws == deferred
+    and renderer.end_record(start, record and record.list)
+  if not list then
+    self.draw_record = nil
+    return
+  end
+  record = record or {}
+  record.list, record.x, record.y, record.w, record.h = list, x, y, w, h
+  record.cx, record.cy, record.cw, record.ch = cx, cy, cw, ch
+  self.draw_record = record
+end
+
+
 ---Returns the list of context menu items to show.
 ---
 ---Called with the coordinates "of the right click".
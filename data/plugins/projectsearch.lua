@@ -4,8 +4,26 @@ local common = require "core.common"
 local keymap = require "core.keymap"
 local command = require "core.command"
 local style = require "core.style"
+local config = require "core.config"
 local View = require "core.view"
 
+config.plugins.projectsearch = common.merge({
+  -- Keep an index of the trigrams of the files under USERDIR/storage
+  index = true,
+  -- The config specification used by gui generators
+  config_spec = {
+    name = "Project Search",
+    {
+      label = "Index",
+      description = "Keep an index of the files searched, so that the next "
+        .. "searches only read the files that can match.",
+      path = "index",
+      type = "toggle",
+      default = true
+    }
+  }
+}, config.plugins.projectsearch)
+
 ---@class plugins.projectsearch.resultsview : core.view
 local ResultsView = View:extend()
 
@@ -13,12 +31,38 @@ function ResultsView:__tostring() return "ResultsView" end
 
 ResultsView.context = "session"
 
-function ResultsView:new(path, text, fn)
+-- Views by the id of their native search, see `ResultsView:on_searched`
+local searches = setmetatable({}, { __mode = "v" })
+local last_search_id = 0
+
+-- Indexes by the path of the root project
+local indexes = {}
+
+local function get_index()
+  if not config.plugins.projectsearch.index then return end
+  local path = core.root_project().path
+  if indexes[path] == nil then
+    local dir = USERDIR .. PATHSEP .. "storage" .. PATHSEP .. "projectsearch"
+    if not system.get_file_info(dir) then common.mkdirp(dir) end
+    local index, err = search.load_index(dir .. PATHSEP .. path:gsub("[\\/:]", "-"))
+    if not index then core.warn("Searching without an index: %s", err) end
+    indexes[path] = index or false
+  end
+  return indexes[path] or nil
+end
+
+---@param path string
+---@param text string
+---@param fn fun(line_text:string):...
+---@param pattern? string|table The text or the compiled regex to search for
+---natively, the plugin then only uses `fn` if the search can't be started.
+---@param no_case? boolean
+function ResultsView:new(path, text, fn, pattern, no_case)
   ResultsView.super.new(self)
   self.scrollable = true
   self.brightness = 0
   self.max_h_scroll = 0
-  self:begin_search(path, text, fn)
+  self:begin_search(path, text, fn, pattern, no_case)
 end
 
 
@@ -50,14 +94,92 @@ local function find_all_matches_in_file(t, filename, fn)
 end
 
 
-function ResultsView:begin_search(path, text, fn)
-  self.search_args = { path, text, fn }
+local function each_file(path)
+  return coroutine.wrap(function()
+    for _, project in ipairs(core.projects) do
+      for _, file in project:files() do
+        if file.type == "file" and (not path or file.filename:find(path, 1, true) == 1) then
+          coroutine.yield(file.filename)
+        end
+      end
+    end
+  end)
+end
+
+
+-- Files are searched by a pool of threads, the view only gives them the files
+-- of the projects, in batches. Results are collected when a "searched" event
+-- is received.
+function ResultsView:begin_native_search(path, pattern, no_case, source)
+  local index = get_index()
+  local job, err = search.new(pattern, no_case, last_search_id + 1, index, source)
+  if not job then
+    core.warn("Searching in the foreground: %s", err)
+    return false
+  end
+  last_search_id = last_search_id + 1
+  searches[last_search_id] = self
+  self.job, self.job_id = job, last_search_id
+  -- files that weren't searched are only dropped after searching them all
+  self.index, self.prune_index = index, not path
+  core.add_thread(function()
+    local files, start = {}, system.get_time()
+    for filename in each_file(path) do
+      table.insert(files, filename)
+      if #files >= 1000 or system.get_time() - start > 0.5 / config.fps then
+        job:add(files)
+        files = {}
+        coroutine.yield()
+        start = system.get_time()
+      end
+    end
+    job:add(files)
+    job:finish()
+  end, self.results)
+  return true
+end
+
+
+function ResultsView:on_searched()
+  local results, n_searched, done, search_err = self.job:poll()
+  for _, result in ipairs(results) do
+    table.insert(self.results, result)
+  end
+  self.last_file_idx = n_searched
+  if search_err and not self.search_error then
+    core.warn("Search: %s", search_err)
+    self.search_error = search_err
+  end
+  if done then
+    self.searching = false
+    self.brightness = 100
+    if self.index then
+      -- files that couldn't be searched weren't seen, and aren't dropped
+      local ok, err = self.index:save(self.prune_index and not self.search_error)
+      if not ok then core.warn("%s", err) end
+    end
+  end
+  core.redraw = true
+end
+
+
+function ResultsView:begin_search(path, text, fn, pattern, no_case)
+  self.search_args = { path, text, fn, pattern, no_case }
   self.results = {}
   self.last_file_idx = 1
   self.query = text
   self.searching = true
+  self.search_error = nil
   self.selected_idx = 0
+  if self.job then
+    self.job:cancel()
+    self.job, self.job_id = nil, nil
+  end
+  self.scroll.to.y = 0
 
+  if pattern and search and self:begin_native_search(path, pattern, no_case, text) then
+    return
+  end
   core.add_thread(function()
     local i = 1
     for k, project in ipairs(core.projects) do
@@ -73,8 +195,6 @@ function ResultsView:begin_search(path, text, fn)
     self.brightness = 100
     core.redraw = true
   end, self.results)
-
-  self.scroll.to.y = 0
 end
 
 
@@ -235,13 +355,15 @@ end
 ---@param path string
 ---@param text string
 ---@param fn fun(line_text:string):...
+---@param pattern? string|table
+---@param no_case? boolean
 ---@return plugins.projectsearch.resultsview?
-local function begin_search(path, text, fn)
+local function begin_search(path, text, fn, pattern, no_case)
   if text == "" then
     core.error("Expected non-empty string")
     return
   end
-  local rv = ResultsView(path, text, fn)
+  local rv = ResultsView(path, text, fn, pattern, no_case)
   core.root_view:get_active_node_default():add_view(rv)
   return rv
 end
@@ -273,7 +395,7 @@ function projectsearch.search_plain(text, path, insensitive)
     else
       return line_text:find(text, nil, true)
     end
-  end)
+  end, text, insensitive)
 end
 
 ---@param text string
@@ -290,7 +412,7 @@ function projectsearch.search_regex(text, path, insensitive)
   if not re then core.log("%s", errmsg) return end
   return begin_search(path, text, function(line_text)
     return regex.cmatch(re, line_text)
-  end)
+  end, re)
 end
 
 ---@param text string
@@ -309,6 +431,17 @@ function projectsearch.search_fuzzy(text, path, insensitive)
 end
 
 
+local on_event = core.on_event
+function core.on_event(type, ...)
+  if type == "searched" then
+    local view = searches[...]
+    if view and view.job_id == ... then view:on_searched() end
+    return false
+  end
+  return on_event(type, ...)
+end
+
+
 command.add(nil, {
   ["project-search:find"] = function(path)
     core.command_view:enter("Find Text In " .. (path or "Project"), {
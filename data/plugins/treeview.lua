@@ -79,6 +79,23 @@ end
 
 
 
+local function get_file(self, project, path, name)
+  local l = path .. PATHSEP .. name
+  local f
+  if self.show_ignored then
+    f = system.get_file_info(l)
+  else
+    f = project:get_file_info(l)
+  end
+  if f and f.type then
+    f.name = name
+    f.abs_filename = l
+    f.ignored = self.show_ignored and project:is_ignored(f, l)
+    return f
+  end
+end
+
+
 function TreeView:get_cached(project, path)
   local t = self.cache[path]
   if not t then
@@ -111,22 +128,21 @@ function TreeView:get_cached(project, path)
     self.cache[path] = t
   end
   if t.expanded and t.type == "dir" and not t.files then
+    local indexed = not self.show_ignored and project:list_dir(path)
+    if indexed then
+      for _, f in ipairs(indexed) do
+        f.abs_filename = path .. PATHSEP .. f.name
+        self.cache[f.abs_filename] = nil
+      end
+      table.sort(indexed, function(a, b) return system.path_compare(a.name, a.type, b.name, b.type) end)
+      t.files = indexed
+      return t
+    end
     t.files = {}
     for i, file in ipairs(system.list_dir(path)) do
-      local l = path .. PATHSEP .. file
-      local f
-      if self.show_ignored then
-        f = system.get_file_info(l)
-      else
-        f = project:get_file_info(l)
-      end
-      if f and f.type then
-        f.name = file
-        f.abs_filename = l
-        f.ignored = self.show_ignored and project:is_ignored(f, l)
-        table.insert(t.files, f)
-      end
-      self.cache[l] = nil
+      local f = get_file(self, project, path, file)
+      if f then table.insert(t.files, f) end
+      self.cache[path .. PATHSEP .. file] = nil
     end
     table.sort(t.files, function(a, b) return system.path_compare(a.name, a.type, b.name, b.type) end)
   end
@@ -134,6 +150,36 @@ function TreeView:get_cached(project, path)
 end
 
 
+---Applies the changes to the entries of a directory to its cached files,
+---instead of listing it again.
+---@param path string
+---@param changes core.dirwatch.change[]
+function TreeView:update_cached(path, changes)
+  local t = self.cache[path]
+  if not t or not t.files then return end
+  for _, change in ipairs(changes) do
+    if change.change ~= "modified" then
+      for i, f in ipairs(t.files) do
+        if f.name == change.name then
+          table.remove(t.files, i)
+          break
+        end
+      end
+      self.cache[path .. PATHSEP .. change.name] = nil
+      local f = (change.change == "created" or change.change == "moved_to")
+        and get_file(self, t.project, path, change.name)
+      if f then
+        local i = 1
+        while t.files[i] and not system.path_compare(f.name, f.type, t.files[i].name, t.files[i].type) do
+          i = i + 1
+        end
+        table.insert(t.files, i, f)
+      end
+    end
+  end
+end
+
+
 function TreeView:get_name()
   return nil
 end
@@ -562,8 +608,13 @@ end
 core.add_thread(function()
   while true do
     for k,v in pairs(view.watches) do
-      v:check(function(directory)
-        view.cache[directory] = nil
+      v:check(function(directory, changes)
+        k:directory_changed(directory)
+        if changes then
+          view:update_cached(directory, changes)
+        else
+          view.cache[directory] = nil
+        end
       end)
     end
     coroutine.yield(0.01)
@@ -0,0 +1,92 @@
+---@meta
+
+---
+---Native storage for the lines of a document. Lines are kept in a balanced
+---tree so that indexing a line, converting between positions and byte
+---offsets and splicing lines in or out all take O(log n) time.
+---
+---A buffer behaves like an array of strings: it can be indexed, its length
+---taken with `#` and it can be iterated with `ipairs`. Assigning to an index
+---replaces a line or appends one past the end, and assigning nil is only
+---allowed for the last line, which is enough for `table.insert` and
+---`table.remove` at the end of the buffer.
+---@class buffer
+---@operator len: integer
+---@field [integer] string
+buffer = {}
+
+---
+---Creates a new buffer.
+---
+---@param lines? string[] Initial lines, copied into the buffer.
+---
+---@return buffer
+function buffer.new(lines) end
+
+---
+---Loads a file in a new buffer. The file is read in one block and its lines
+---are only created when accessed.
+---
+---Line endings are normalized to "\n", and a "\n" is added to the last line
+---if it had none. An empty file gives a buffer with one empty line.
+---
+---@param path string
+---
+---@return buffer? buffer
+---@return boolean|string crlf_or_error Whether some lines ended in "\r\n",
+---or the error message on failure.
+function buffer.load(path) end
+
+---
+---Removes `remove` lines starting at line `at` and inserts `lines` in
+---their place.
+---
+---@param at integer
+---@param remove integer
+---@param lines? string[]
+function buffer:splice(at, remove, lines) end
+
+---
+---Get the text between two positions, the end position is exclusive.
+---
+---@param line1 integer
+---@param col1 integer
+---@param line2 integer
+---@param col2 integer
+---
+---@return string
+function buffer:get_text(line1, col1, line2, col2) end
+
+---
+---Get the 1-based byte offset of a position from the start of the buffer.
+---
+---@param line integer
+---@param col? integer Defaults to 1.
+---
+---@return integer offset
+function buffer:get_offset(line, col) end
+
+---
+---Get the position of a 1-based byte offset from the start of the buffer.
+---
+---@param offset integer
+---
+---@return integer line
+---@return integer col
+function buffer:get_position(offset) end
+
+---
+---Get the total size of the buffer in bytes.
+---
+---@return integer
+function buffer:get_size() end
+
+---
+---Creates a copy of the buffer in O(1) time, the copy shares the lines
+---with the original and is not affected by later edits to it.
+---
+---@return buffer
+function buffer:snapshot() end
+
+
+return buffer
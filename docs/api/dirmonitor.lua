@@ -7,13 +7,21 @@
 ---@class dirmonitor
 dirmonitor = {}
 
----@alias dirmonitor.callback fun(fd_or_path:integer|string)
+---@alias dirmonitor.change "created"|"deleted"|"modified"|"moved_from"|"moved_to"|"overflow"
+
+---@alias dirmonitor.callback fun(fd_or_path:integer|string, name?:string, change?:dirmonitor.change)
 
 ---
 ---Creates a new dirmonitor object.
 ---
+---A "dirmonitor" event is received by the main loop when there are changes
+---to check, at most once until they're checked.
+---
+---@param debounce? number Seconds to wait after changes before sending the
+---event, so that the changes coming meanwhile are read together after these.
+---
 ---@return dirmonitor
-function dirmonitor.new() end
+function dirmonitor.new(debounce) end
 
 ---
 ---Monitors a directory or file for changes.
@@ -45,6 +53,14 @@ function dirmonitor:unwatch(fd_or_path) end
 ---edited, removed or added. A file descriptor will be passed to the
 ---callback in "multiple" mode or a path in "single" mode.
 ---
+---Backends that report the entries that changed in a watched directory, like
+---inotify and fanotify, also pass the name of the entry and the change, once
+---for each change in the order they happened, skipping repeats of the same
+---change. In "single" mode the path is then the one of the entry.
+---The change is "overflow", with a file descriptor of -1, when changes were
+---lost and everything watched has to be checked again. Other backends call
+---the callback once for each file descriptor or path, without a name.
+---
 ---If an error occurred during the callback execution, the error callback will be called with the error object.
 ---This callback should not manipulate coroutines to avoid deadlocks.
 ---
@@ -61,7 +77,8 @@ function dirmonitor:check(callback, error_callback) end
 ---directory contents, backends: inotify and kqueue.
 ---
 ---"single": a single process takes care of monitoring a path recursively
----so no individual file descriptors are used, backends: win32 and fsevents.
+---so no individual file descriptors are used, backends: win32, fsevents and
+---fanotify, which is "multiple" like inotify when it isn't permitted.
 ---
 ---@return "single" | "multiple"
 function dirmonitor:mode() end
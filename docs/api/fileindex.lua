@@ -0,0 +1,93 @@
+---@meta
+
+---
+---Native index of the files of a project. The tree is scanned once by a pool
+---of background threads, applying the ignore rules of the project, and the
+---directories are then rescanned when they're passed to `index:refresh()`.
+---A "fileindex" event is received by the main loop whenever a scan is done.
+---@class fileindex
+fileindex = {}
+
+---
+---An entry of the index.
+---@class fileindex.entry
+---@field filename? string The absolute path, for `files` and `directories`.
+---@field name? string The name in its directory, for `list`.
+---@field type "file"|"dir"
+---@field size integer
+---@field modified number
+
+---
+---Creates an index of `root` and starts scanning it.
+---
+---@param root string The absolute path of the project.
+---@param rules table[] Ignore rules, as compiled by `core.project`, with the
+---fields `pattern`, `use_path` and `match_dir`.
+---@param size_limit? number Files of at least this size in bytes are ignored.
+---
+---@return fileindex? index
+---@return string? error If the scan thread couldn't be started.
+function fileindex.new(root, rules, size_limit) end
+
+---
+---Returns whether the first scan is done, the number of files indexed and a
+---counter of the directory scans, that changes when the index may have, and
+---an error once a scan thread ran out of memory.
+---
+---@return boolean ready
+---@return integer n_files
+---@return integer scans
+---@return string? error
+function fileindex:status() end
+
+---
+---Returns up to `n` files from `cursor`, and the cursor to continue from, or
+---nil once all the files were returned. If the index changes in between,
+---the files added or removed may be skipped or returned twice, the others are
+---returned once. A cursor from before the index compacted its removed entries
+---twice raises an error.
+---
+---@param cursor integer Starts at 1, the others are opaque.
+---@param n? integer Defaults to 1000.
+---
+---@return fileindex.entry[] files
+---@return integer? cursor
+function fileindex:files(cursor, n) end
+
+---
+---Like `index:files()`, for directories.
+---
+---@param cursor integer Starts at 1, the others are opaque.
+---@param n? integer Defaults to 1000.
+---
+---@return fileindex.entry[] directories
+---@return integer? cursor
+function fileindex:directories(cursor, n) end
+
+---
+---Returns the entries of a directory, or nothing if it isn't indexed or was
+---modified since it was scanned.
+---
+---@param path string
+---
+---@return fileindex.entry[]?
+function fileindex:list(path) end
+
+---
+---Queues a directory to be rescanned. If the path isn't indexed, its closest
+---indexed parent is rescanned instead.
+---
+---Without a path, every directory modified since it was scanned is rescanned,
+---for when the directories can't all be watched. This is skipped while a scan
+---is running.
+---
+---@param path? string
+function fileindex:refresh(path) end
+
+---
+---Stops the scan threads and frees the index, which can't be used afterwards.
+---This is also done when the index is collected.
+function fileindex:close() end
+
+
+return fileindex
@@ -0,0 +1,87 @@
+---@meta
+
+---
+---Native tokenizer for syntaxes. A syntax and all the subsyntaxes it can
+---reach are compiled once, and lines are then tokenized the same way
+---`core.tokenizer` describes, without going through Lua for each match.
+---@class lexer
+lexer = {}
+
+---
+---Compiles a syntax in a new lexer.
+---
+---@param syntax table The syntax table, as registered with `core.syntax`.
+---@param resolve fun(name: string): table Used to get the syntax table of
+---subsyntaxes referenced by name.
+---@param report? fun(syntax: table, pattern_idx: integer, kind: string, n_types: integer, n_results: integer)
+---Called when a pattern matches but its types don't fit its captures. `kind`
+---is one of "empty", "type_table", "not_enough_types" or "too_many_types".
+---
+---@return lexer
+function lexer.new(syntax, resolve, report) end
+
+---
+---Tokenizes a line, appending the tokens to `res` as pairs of type and text.
+---
+---If `budget` is given and runs out, an "incomplete" token is pushed with the
+---rest of the line and the byte position to continue from is returned, the
+---returned state is then the state at that position.
+---
+---@param text string
+---@param state string The state at the start of the line.
+---@param i? integer Byte position to start from, defaults to 1.
+---@param res? table Table of tokens to append to.
+---@param budget? number Time budget in seconds.
+---
+---@return table res
+---@return string state
+---@return integer? resume_i
+function lexer:tokenize(text, state, i, res, budget) end
+
+---
+---Starts tokenizing the lines of a buffer in a background thread, from `line`
+---up to `last`. The lines are those of the buffer when the job is started,
+---later changes aren't seen by the job.
+---
+---When lines have been tokenized, a "highlighted" event with `id` is received
+---by the main loop and the results can be collected with `job:poll()`.
+---
+---@param lines buffer
+---@param line integer The first line to tokenize.
+---@param state string The state at the start of `line`.
+---@param last integer The last line to tokenize.
+---@param id integer Passed with the "highlighted" events of the job.
+---
+---@return lexer.highlight_job? job
+---@return string? error If the background thread couldn't be started.
+function lexer:highlight(lines, line, state, last, id) end
+
+
+---
+---A background highlighting job, see `lexer:highlight`.
+---@class lexer.highlight_job
+local highlight_job = {}
+
+---
+---Moves the last line to tokenize forward.
+---
+---@param last integer
+function highlight_job:extend(last) end
+
+---
+---Takes the lines tokenized since the last call. Each result is a table with
+---the `text`, the `tokens` and the end `state` of its line.
+---
+---Bad patterns found meanwhile are reported at this point.
+---
+---@return integer? first The line of the first result, nil if there are none.
+---@return table[] results
+---@return string? error If the job stopped on an error.
+function highlight_job:poll() end
+
+---
+---Stops the job. It's also stopped when it's garbage collected.
+function highlight_job:cancel() end
+
+
+return lexer
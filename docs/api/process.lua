@@ -37,6 +37,13 @@ process.ERROR_INVAL = -4
 ---@type integer
 process.ERROR_NOMEM = -5
 
+---Whether the output of processes is read by a background thread, which wakes
+---the main loop with a "process" event when there is new output or a process
+---exited. Otherwise the output is read when it's requested.
+---@type boolean
+process.IO_EVENTS = true
+
+---
 ---Used for the process:close_stream() method to close stdin.
 ---@type integer
 process.STREAM_STDIN = 0
@@ -173,6 +180,30 @@ function process:read_stdout(len) end
 ---@return process.errortype | integer errcode
 function process:read_stderr(len) end
 
+---
+---Read from the given stream until a delimiter, which is consumed but not
+---returned. At the end of the stream, what's left is returned. The output is
+---read from the buffer of the background thread, only when `process.IO_EVENTS`.
+---
+---@param stream process.streamtype
+---@param delimiter string
+---
+---@return string | nil data Nil until the delimiter was read.
+---@return boolean ended Whether the stream ended, and everything was read.
+function process:read_until(stream, delimiter) end
+
+---
+---Read exactly `n` bytes from the given stream. At the end of the stream,
+---what's left is returned. The output is read from the buffer of the
+---background thread, only when `process.IO_EVENTS`.
+---
+---@param stream process.streamtype
+---@param n integer
+---
+---@return string | nil data Nil until `n` bytes were read.
+---@return boolean ended Whether the stream ended, and everything was read.
+function process:read_exact(stream, n) end
+
 ---
 ---Write to the stdin, if the process fails with a ERROR_PIPE it is
 ---automatically destroyed returning nil along error message and code.
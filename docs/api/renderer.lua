@@ -26,6 +26,26 @@ renderer = {}
 ---@field public smoothing boolean
 ---@field public strikethrough boolean
 
+---
+---Drawing commands recorded with renderer.begin_record() and renderer.end_record().
+---@class renderer.commandlist
+
+---
+---Statistics about the last rendered frame.
+---Times are in seconds.
+---@class renderer.framestats
+---@field public commands integer Number of drawing commands issued.
+---@field public command_bytes integer Size in bytes of the drawing commands.
+---@field public rects integer Number of dirty rectangles redrawn.
+---@field public changed_pixels integer Pixels covered by the cells that changed.
+---@field public redrawn_pixels integer Pixels redrawn, including unchanged ones merged into dirty rectangles.
+---@field public frame_time number Time from renderer.begin_frame to the end of renderer.end_frame.
+---@field public hash_time number Time spent hashing the commands to find the changes.
+---@field public merge_time number Time spent building the dirty rectangles.
+---@field public draw_time number Time spent drawing the dirty rectangles.
+---@field public update_time number Time spent presenting the dirty rectangles to the window.
+---@field public histogram integer[] Frame times of the last 256 frames: element i counts the frames faster than 0.25ms * 2^(i-1), the last element counts all the slower ones.
+
 ---
 ---@class renderer.font
 renderer.font = {}
@@ -107,6 +127,27 @@ function renderer.font:get_path() end
 ---@param enable boolean
 function renderer.show_debug(enable) end
 
+---
+---Set the number of threads used to redraw large areas of the screen.
+---A value of 1 draws everything on the main thread.
+---
+---@param count integer
+function renderer.set_render_threads(count) end
+
+---
+---Set the size, in pixels, of the cells used to detect the changed regions
+---of the screen. Smaller cells redraw less but cost more to compare.
+---The value is clamped between 16 and 512, defaults to 96.
+---
+---@param size integer
+function renderer.set_cell_size(size) end
+
+---
+---Get statistics about the last rendered frame.
+---
+---@return renderer.framestats
+function renderer.get_frame_stats() end
+
 ---
 ---Get the size of the screen area been rendered.
 ---
@@ -156,5 +197,32 @@ function renderer.draw_rect(x, y, width, height, color) end
 ---@return number x
 function renderer.draw_text(font, text, x, y, color) end
 
+---
+---Start recording the drawing commands issued from now on.
+---
+---@return integer start Position to pass to renderer.end_record().
+function renderer.begin_record() end
+
+---
+---Stop recording and copy the drawing commands issued since
+---renderer.begin_record() into a command list, in the same frame.
+---
+---@param start integer Value returned by renderer.begin_record().
+---@param list? renderer.commandlist A list to reuse instead of creating a new one.
+---
+---@return renderer.commandlist|nil list Nil if the commands couldn't be recorded.
+function renderer.end_record(start, list) end
+
+---
+---Issue again the drawing commands of a command list.
+---This only works in the frame right after the one in which the list was
+---recorded or last replayed, and as long as the window size and the fonts
+---didn't change. Otherwise nothing is drawn and false is returned.
+---
+---@param list renderer.commandlist
+---
+---@return boolean replayed
+function renderer.replay(list) end
+
 
 return renderer
@@ -0,0 +1,87 @@
+---@meta
+
+---
+---Search of text in files by a pool of background threads. Files are searched
+---line by line, in the order they're added, and a "searched" event with the id
+---of the search is received by the main loop when there are new results.
+---@class search
+search = {}
+
+---
+---An index of the trigrams of files, stored on disk. Files indexed and not
+---modified since are only read by a search if they may match it, the others
+---are indexed while they're searched.
+---@class search.index
+search.index = {}
+
+---
+---A line that matched.
+---@class search.result
+---@field file string
+---@field text string The line, truncated around the match if it's too long.
+---@field line integer
+---@field col integer The byte where the match starts.
+
+---
+---Creates a search and starts its threads.
+---
+---@param pattern string|table The text to search for, or a compiled regex.
+---@param no_case? boolean Ignore the case of ASCII letters, only for text;
+---the text must then be given in lowercase.
+---@param id integer Sent with the "searched" events.
+---@param index? search.index Used to skip files, and updated.
+---@param source? string The source of the regex, to find the text that its
+---matches have in common.
+---
+---@return search? search
+---@return string? error If the threads couldn't be started.
+function search.new(pattern, no_case, id, index, source) end
+
+---
+---Loads the index stored at `path`, or creates an empty one if it's missing
+---or invalid.
+---
+---@param path string
+---
+---@return search.index? index
+---@return string? error
+function search.load_index(path) end
+
+---
+---Queues files to be searched.
+---
+---@param files string[] Absolute paths.
+function search:add(files) end
+
+---
+---Tells the search that no more files will be added, so that it's done once
+---the queued ones are searched.
+function search:finish() end
+
+---
+---Returns the results found since the last call, the number of files searched
+---and whether the search is done, and an error once a thread ran out of
+---memory, after which some of the files counted weren't searched.
+---
+---@return search.result[] results
+---@return integer n_searched
+---@return boolean done
+---@return string? error
+function search:poll() end
+
+---
+---Stops the threads, the files still queued aren't searched.
+function search:cancel() end
+
+---
+---Writes the index to its path, if it changed.
+---
+---@param prune? boolean Drop the files that weren't searched since the last
+---save, for when all the files were.
+---
+---@return boolean? saved
+---@return string? error
+function search.index:save(prune) end
+
+
+return search
@@ -359,6 +359,21 @@ function system.exec(command) end
 ---@return integer score
 function system.fuzzy_match(haystack, needle, file) end
 
+---
+---Scores every item of a list like `system.fuzzy_match` does, and returns
+---the indexes of the items that match, best matches first. Items with the
+---same score are sorted by their text.
+---
+---Items that aren't strings are converted with `tostring`.
+---
+---@param haystack any[]
+---@param needle string
+---@param file? boolean
+---@param limit? integer Only return the indexes of the `limit` best matches.
+---
+---@return integer[] indexes
+function system.fuzzy_match_list(haystack, needle, file, limit) end
+
 ---
 ---Change the opacity (also known as transparency) of the window.
 ---
@@ -0,0 +1,39 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <SDL3/SDL.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Allocation helpers of the native modules. check_alloc() and grow() exit when
+// memory runs out, try_grow() leaves the caller to recover.
+
+#define check_alloc(P) _check_alloc(P, __FILE__, __LINE__)
+static inline void* _check_alloc(void *ptr, const char *const file, size_t ln) {
+  if (!ptr) {
+    fprintf(stderr, "%s:%zu: memory allocation failed\n", file, ln);
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+// Grows the array at `*ptr` to hold at least `needed` items of `size` bytes,
+// doubling its capacity. Returns false, leaving it as it was, on failure.
+static inline bool try_grow(void **ptr, size_t *capacity, size_t needed, size_t size) {
+  if (needed <= *capacity) { return true; }
+  size_t capacity_ = *capacity ? *capacity : 16;
+  while (capacity_ < needed) { capacity_ *= 2; }
+  void *grown = SDL_realloc(*ptr, capacity_ * size);
+  if (!grown) { return false; }
+  *ptr = grown;
+  *capacity = capacity_;
+  return true;
+}
+
+#define grow(P, C, N, S) _grow(P, C, N, S, __FILE__, __LINE__)
+static inline void _grow(void **ptr, size_t *capacity, size_t needed, size_t size, const char *const file, size_t ln) {
+  if (!try_grow(ptr, capacity, needed, size)) { _check_alloc(NULL, file, ln); }
+}
+
+#endif
@@ -7,6 +7,10 @@ int luaopen_regex(lua_State *L);
 int luaopen_process(lua_State *L);
 int luaopen_dirmonitor(lua_State* L);
 int luaopen_utf8extra(lua_State* L);
+int luaopen_buffer(lua_State* L);
+int luaopen_lexer(lua_State* L);
+int luaopen_fileindex(lua_State* L);
+int luaopen_search(lua_State* L);
 
 static const luaL_Reg libs[] = {
   { "system",     luaopen_system     },
@@ -16,6 +20,10 @@ static const luaL_Reg libs[] = {
   { "process",    luaopen_process    },
   { "dirmonitor", luaopen_dirmonitor },
   { "utf8extra",  luaopen_utf8extra  },
+  { "buffer",     luaopen_buffer     },
+  { "lexer",      luaopen_lexer      },
+  { "fileindex",  luaopen_fileindex  },
+  { "search",     luaopen_search     },
   { NULL, NULL }
 };
 
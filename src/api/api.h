@@ -10,9 +10,32 @@
 #define API_TYPE_DIRMONITOR "Dirmonitor"
 #define API_TYPE_NATIVE_PLUGIN "NativePlugin"
 #define API_TYPE_RENWINDOW "RenWindow"
+#define API_TYPE_COMMANDLIST "CommandList"
+#define API_TYPE_BUFFER "Buffer"
+#define API_TYPE_LEXER "Lexer"
+#define API_TYPE_HIGHLIGHT_JOB "HighlightJob"
+#define API_TYPE_FILEINDEX "FileIndex"
+#define API_TYPE_SEARCH "Search"
+#define API_TYPE_SEARCH_INDEX "SearchIndex"
 
 #define API_CONSTANT_DEFINE(L, idx, key, n) (lua_pushnumber(L, n), lua_setfield(L, idx - 1, key))
 
 void api_load_libs(lua_State *L);
 
+// Finds a utf8 Lua pattern like utf8extra.find, see utf8.c.
+const char *utf8_pattern_find(lua_State *L, const char *s, const char *es,
+                              const char *init, const char *p, const char *ep,
+                              int anchor, const char **end,
+                              const char **captures, int *ncaptures);
+
+// Lines of a buffer that can be read from other threads, see buffer.c.
+typedef struct BufferLines BufferLines;
+BufferLines* buffer_get_lines(lua_State *L, int idx);
+size_t buffer_lines_count(BufferLines *lines);
+// Copies the line at 0-based index `i` in `text`, followed by a '\0' like Lua
+// strings, growing it if needed, and returns its length, or SIZE_MAX when it
+// can't be grown.
+size_t buffer_lines_read(BufferLines *lines, size_t i, char **text, size_t *capacity);
+void buffer_lines_release(BufferLines *lines);
+
 #endif
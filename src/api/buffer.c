@@ -0,0 +1,758 @@
+#include "api.h"
+#include "alloc.h"
+
+#include <SDL3/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The text of a document, stored as a persistent treap of lines. Every node
+** holds one line and caches the number of lines and bytes in its subtree, so
+** that looking up a line or a byte offset and splicing lines in or out are all
+** O(log n) in the number of lines.
+**
+** Nodes and lines are reference counted and never modified once shared: edits
+** copy the nodes on their path instead, while nodes only referenced once are
+** updated in place. This makes snapshots O(1), they just share the root.
+**
+** Files loaded with buffer.load are read in one block, and only a line-offset
+** index is built up front: a node can also hold a run of lines of that block,
+** which is split when an edit lands in the middle of it and whose line
+** strings are only created when accessed. The file itself isn't kept mapped,
+** so it can be changed, truncated or locked by others while it's open. */
+
+typedef struct Line {
+  SDL_AtomicInt refs;
+  size_t len;
+  char text[];
+} Line;
+
+/* The contents of a loaded file and the offsets of its lines. Lines are
+** given with the same line endings as Doc used to read them: a \r before the
+** \n is dropped and a \n is added to the last line if it had none. */
+typedef struct Mapping {
+  SDL_AtomicInt refs;
+  const char *data;
+  size_t size;
+  bool crlf;            /* some lines end in \r\n */
+  bool missing_newline; /* the last line doesn't end in \n */
+  size_t count;
+  size_t *starts;       /* count + 1 offsets of the lines in data */
+  size_t *offsets;      /* count + 1 offsets of the lines with the endings
+                        ** fixed, only needed when crlf */
+} Mapping;
+
+typedef struct Node {
+  SDL_AtomicInt refs;
+  uint32_t priority;
+  struct Node *left, *right;
+  size_t count; /* lines in the subtree */
+  size_t bytes; /* bytes in the subtree */
+  /* the node holds either a single line, or `lines` lines of a mapping
+  ** starting at `first` */
+  Line *line;
+  Mapping *mapping;
+  size_t first;
+  size_t lines; /* lines in the node itself */
+  size_t len;   /* bytes in the node itself */
+} Node;
+
+typedef struct {
+  Node *root;
+  /* last line looked up, to speed up consecutive accesses to the same line */
+  size_t cached_index;
+  Node *cached_node;
+  size_t cached_line;
+} Buffer;
+
+
+static uint32_t next_priority(void) {
+  static uint32_t state = 2463534242u;
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+
+static Line* line_new(const char *text, size_t len) {
+  Line *line = check_alloc(SDL_malloc(sizeof(Line) + len));
+  SDL_SetAtomicInt(&line->refs, 1);
+  line->len = len;
+  memcpy(line->text, text, len);
+  return line;
+}
+
+
+static void line_release(Line *line) {
+  if (SDL_AtomicDecRef(&line->refs)) {
+    SDL_free(line);
+  }
+}
+
+
+static void mapping_release(Mapping *mapping) {
+  if (SDL_AtomicDecRef(&mapping->refs)) {
+    SDL_free((void*) mapping->data);
+    SDL_free(mapping->starts);
+    SDL_free(mapping->offsets);
+    SDL_free(mapping);
+  }
+}
+
+
+/* Offset of the line at 0-based index `i` of the mapping, as seen from Lua. */
+static inline size_t mapping_offset(Mapping *mapping, size_t i) {
+  if (mapping->offsets) { return mapping->offsets[i]; }
+  return mapping->starts[i] + (i == mapping->count && mapping->missing_newline);
+}
+
+
+static inline size_t node_count(Node *node) { return node ? node->count : 0; }
+static inline size_t node_bytes(Node *node) { return node ? node->bytes : 0; }
+
+
+static void node_update(Node *node) {
+  node->count = node->lines + node_count(node->left) + node_count(node->right);
+  node->bytes = node->len + node_bytes(node->left) + node_bytes(node->right);
+}
+
+
+static Node* node_alloc(uint32_t priority) {
+  Node *node = check_alloc(SDL_malloc(sizeof(Node)));
+  SDL_SetAtomicInt(&node->refs, 1);
+  node->priority = priority;
+  node->left = node->right = NULL;
+  node->line = NULL;
+  node->mapping = NULL;
+  node->first = 0;
+  return node;
+}
+
+
+static Node* node_new(Line *line) {
+  Node *node = node_alloc(next_priority());
+  node->line = line;
+  node->lines = 1;
+  node->len = line->len;
+  node_update(node);
+  return node;
+}
+
+
+/* Takes a reference to the mapping. */
+static Node* node_new_mapped(Mapping *mapping, size_t first, size_t lines, uint32_t priority) {
+  Node *node = node_alloc(priority);
+  node->mapping = mapping;
+  node->first = first;
+  node->lines = lines;
+  node->len = mapping_offset(mapping, first + lines) - mapping_offset(mapping, first);
+  node_update(node);
+  return node;
+}
+
+
+/* Offset of the line at 0-based index `i` of the node itself. */
+static inline size_t node_line_offset(Node *node, size_t i) {
+  if (!node->mapping) { return 0; }
+  return mapping_offset(node->mapping, node->first + i) - mapping_offset(node->mapping, node->first);
+}
+
+
+static Node* node_retain(Node *node) {
+  if (node) { SDL_AtomicIncRef(&node->refs); }
+  return node;
+}
+
+
+static void node_release(Node *node) {
+  if (node && SDL_AtomicDecRef(&node->refs)) {
+    node_release(node->left);
+    node_release(node->right);
+    if (node->line) { line_release(node->line); }
+    if (node->mapping) { mapping_release(node->mapping); }
+    SDL_free(node);
+  }
+}
+
+
+/* Takes a reference to a node and returns a node that can be modified: the
+** node itself if that was its only reference, otherwise a copy of it. */
+static Node* node_own(Node *node) {
+  if (SDL_GetAtomicInt(&node->refs) == 1) {
+    return node;
+  }
+  Node *copy = check_alloc(SDL_malloc(sizeof(Node)));
+  *copy = *node;
+  SDL_SetAtomicInt(&copy->refs, 1);
+  node_retain(copy->left);
+  node_retain(copy->right);
+  if (copy->line) { SDL_AtomicIncRef(&copy->line->refs); }
+  if (copy->mapping) { SDL_AtomicIncRef(&copy->mapping->refs); }
+  node_release(node);
+  return copy;
+}
+
+
+/* Splits the tree in its first `k` lines and the rest. Consumes `node`. */
+static void split(Node *node, size_t k, Node **left, Node **right) {
+  if (!node) {
+    *left = *right = NULL;
+    return;
+  }
+  node = node_own(node);
+  size_t before = node_count(node->left);
+  if (before >= k) {
+    split(node->left, k, left, &node->left);
+    node_update(node);
+    *right = node;
+  } else if (before + node->lines <= k) {
+    split(node->right, k - before - node->lines, &node->right, right);
+    node_update(node);
+    *left = node;
+  } else {
+    /* the split falls in a run of mapped lines: the second half of the run
+    ** takes the right subtree, keeping the priority so both halves stay in
+    ** heap order */
+    size_t lines = k - before;
+    SDL_AtomicIncRef(&node->mapping->refs);
+    Node *tail = node_new_mapped(node->mapping, node->first + lines, node->lines - lines, node->priority);
+    tail->right = node->right;
+    node_update(tail);
+    node->right = NULL;
+    node->lines = lines;
+    node->len = node_line_offset(node, lines);
+    node_update(node);
+    *left = node;
+    *right = tail;
+  }
+}
+
+
+/* Joins two trees, all the lines of `a` coming first. Consumes both. */
+static Node* merge(Node *a, Node *b) {
+  if (!a) { return b; }
+  if (!b) { return a; }
+  if (a->priority > b->priority) {
+    a = node_own(a);
+    a->right = merge(a->right, b);
+    node_update(a);
+    return a;
+  }
+  b = node_own(b);
+  b->left = merge(a, b->left);
+  node_update(b);
+  return b;
+}
+
+
+/* Builds a tree from `n` lines in O(n), keeping the stack of the rightmost
+** path of the tree built so far. Takes the references to the lines. */
+static Node* build(Line **lines, size_t n) {
+  if (n == 0) { return NULL; }
+  Node **stack = check_alloc(SDL_malloc(sizeof(Node*) * n));
+  size_t top = 0;
+  for (size_t i = 0; i < n; i++) {
+    Node *node = node_new(lines[i]);
+    Node *last = NULL;
+    while (top > 0 && stack[top - 1]->priority < node->priority) {
+      last = stack[--top];
+      node_update(last);
+    }
+    node->left = last;
+    if (top > 0) { stack[top - 1]->right = node; }
+    stack[top++] = node;
+  }
+  while (top > 1) { node_update(stack[--top]); }
+  node_update(stack[0]);
+  Node *root = stack[0];
+  SDL_free(stack);
+  return root;
+}
+
+
+/* Returns the node with the line at 0-based index `i`, which must be in
+** range, and the index of the line in the node. */
+static Node* get_line(Node *node, size_t i, size_t *line) {
+  for (;;) {
+    size_t left = node_count(node->left);
+    if (i < left) {
+      node = node->left;
+    } else if (i < left + node->lines) {
+      *line = i - left;
+      return node;
+    } else {
+      i -= left + node->lines;
+      node = node->right;
+    }
+  }
+}
+
+
+/* Appends the bytes [from, to) of the line at 0-based index `i` of the
+** mapping to `b`, the line ending being fixed if needed. */
+static void add_mapped_line(Mapping *mapping, size_t i, size_t from, size_t to, luaL_Buffer *b) {
+  size_t len = mapping_offset(mapping, i + 1) - mapping_offset(mapping, i);
+  const char *text = mapping->data + mapping->starts[i];
+  /* every line is its text without the ending, then a \n */
+  if (from < len - 1) {
+    luaL_addlstring(b, text + from, (to < len - 1 ? to : len - 1) - from);
+  }
+  if (to == len) {
+    luaL_addchar(b, '\n');
+  }
+}
+
+
+static void push_line(lua_State *L, Node *node, size_t i) {
+  if (node->line) {
+    lua_pushlstring(L, node->line->text, node->line->len);
+    return;
+  }
+  Mapping *mapping = node->mapping;
+  i += node->first;
+  size_t len = mapping_offset(mapping, i + 1) - mapping_offset(mapping, i);
+  const char *text = mapping->data + mapping->starts[i];
+  if (mapping->starts[i + 1] - mapping->starts[i] == len && text[len - 1] == '\n') {
+    lua_pushlstring(L, text, len);
+    return;
+  }
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  add_mapped_line(mapping, i, 0, len, &b);
+  luaL_pushresult(&b);
+}
+
+
+/* Bytes before the line at 0-based index `i`. */
+static size_t line_offset(Node *node, size_t i) {
+  size_t offset = 0;
+  while (node) {
+    size_t left = node_count(node->left);
+    if (i < left) {
+      node = node->left;
+    } else if (i < left + node->lines) {
+      return offset + node_bytes(node->left) + node_line_offset(node, i - left);
+    } else {
+      offset += node_bytes(node->left) + node->len;
+      i -= left + node->lines;
+      node = node->right;
+    }
+  }
+  return offset;
+}
+
+
+/* Index of the line of the node itself that contains the byte `offset`. */
+static size_t node_find_line(Node *node, size_t offset) {
+  size_t lo = 0, hi = node->lines - 1;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo + 1) / 2;
+    if (node_line_offset(node, mid) <= offset) { lo = mid; } else { hi = mid - 1; }
+  }
+  return lo;
+}
+
+
+/* Finds the line that contains the 0-based byte `offset`, which must be in
+** range, and the offset of the byte in that line. */
+static size_t find_offset(Node *node, size_t offset, size_t *col) {
+  size_t index = 0;
+  for (;;) {
+    size_t left = node_bytes(node->left);
+    if (offset < left) {
+      node = node->left;
+    } else if (offset < left + node->len) {
+      size_t line = node_find_line(node, offset - left);
+      *col = offset - left - node_line_offset(node, line);
+      return index + node_count(node->left) + line;
+    } else {
+      offset -= left + node->len;
+      index += node_count(node->left) + node->lines;
+      node = node->right;
+    }
+  }
+}
+
+
+/* Appends the bytes [from, to) of a run of mapped lines to `b`. */
+static void add_mapped_bytes(Node *node, size_t from, size_t to, luaL_Buffer *b) {
+  Mapping *mapping = node->mapping;
+  size_t base = mapping_offset(mapping, node->first);
+  if (!mapping->crlf) {
+    /* the text is the same as in the file, save for the last \n */
+    size_t end = to + base < mapping->size ? to + base : mapping->size;
+    if (from + base < end) {
+      luaL_addlstring(b, mapping->data + from + base, end - from - base);
+    }
+    if (to + base > mapping->size) {
+      luaL_addchar(b, '\n');
+    }
+    return;
+  }
+  size_t i = node_find_line(node, from);
+  while (from < to) {
+    size_t line_start = node_line_offset(node, i);
+    size_t line_end = node_line_offset(node, i + 1);
+    size_t line_to = to < line_end ? to : line_end;
+    add_mapped_line(mapping, node->first + i, from - line_start, line_to - line_start, b);
+    from = line_to;
+    i++;
+  }
+}
+
+
+/* Appends the bytes [start, end) of the subtree to `b`. */
+static void add_bytes(Node *node, size_t start, size_t end, luaL_Buffer *b) {
+  while (node && start < end) {
+    size_t line_start = node_bytes(node->left);
+    size_t line_end = line_start + node->len;
+    if (start < line_start) {
+      add_bytes(node->left, start, end < line_start ? end : line_start, b);
+    }
+    if (start < line_end && end > line_start) {
+      size_t from = (start > line_start ? start : line_start) - line_start;
+      size_t to = (end < line_end ? end : line_end) - line_start;
+      if (node->line) {
+        luaL_addlstring(b, node->line->text + from, to - from);
+      } else {
+        add_mapped_bytes(node, from, to, b);
+      }
+    }
+    if (end <= line_end) { return; }
+    start = start > line_end ? start - line_end : 0;
+    end -= line_end;
+    node = node->right;
+  }
+}
+
+
+static void set_root(Buffer *buffer, Node *root) {
+  buffer->root = root;
+  buffer->cached_index = 0;
+  buffer->cached_node = NULL;
+}
+
+
+/* Lines are taken from the array part of the table at `idx`. */
+static Node* build_from_table(lua_State *L, int idx) {
+  size_t n = luaL_len(L, idx);
+  if (n == 0) { return NULL; }
+  Line **lines = check_alloc(SDL_malloc(sizeof(Line*) * n));
+  for (size_t i = 0; i < n; i++) {
+    lua_rawgeti(L, idx, i + 1);
+    size_t len;
+    const char *text = lua_tolstring(L, -1, &len);
+    if (!text) {
+      for (size_t j = 0; j < i; j++) { line_release(lines[j]); }
+      SDL_free(lines);
+      luaL_error(L, "bad line #%d (string expected, got %s)", (int) i + 1, luaL_typename(L, -1));
+      return NULL;
+    }
+    lines[i] = line_new(text, len);
+    lua_pop(L, 1);
+  }
+  Node *root = build(lines, n);
+  SDL_free(lines);
+  return root;
+}
+
+
+static void splice(Buffer *buffer, size_t at, size_t remove, Node *insert) {
+  Node *before, *removed, *after;
+  split(buffer->root, at, &before, &after);
+  split(after, remove, &removed, &after);
+  node_release(removed);
+  set_root(buffer, merge(merge(before, insert), after));
+}
+
+
+/* Builds the line-offset index of the mapping. */
+static void index_lines(Mapping *mapping) {
+  const char *data = mapping->data, *end = data + mapping->size;
+  size_t capacity = mapping->size / 32 + 16;
+  size_t *starts = check_alloc(SDL_malloc(sizeof(size_t) * capacity));
+  size_t count = 0;
+  for (const char *p = data; p < end; count++) {
+    /* memchr is vectorized by the C library, this runs at memory speed */
+    const char *newline = memchr(p, '\n', end - p);
+    const char *line_end = newline ? newline : end;
+    if (line_end > p && line_end[-1] == '\r') { mapping->crlf = true; }
+    if (count + 2 > capacity) {
+      capacity *= 2;
+      starts = check_alloc(SDL_realloc(starts, sizeof(size_t) * capacity));
+    }
+    starts[count] = p - data;
+    p = newline ? newline + 1 : end;
+    mapping->missing_newline = !newline;
+  }
+  starts[count] = mapping->size;
+  starts = check_alloc(SDL_realloc(starts, sizeof(size_t) * (count + 1)));
+  mapping->starts = starts;
+  mapping->count = count;
+  if (mapping->crlf) {
+    size_t *offsets = check_alloc(SDL_malloc(sizeof(size_t) * (count + 1)));
+    offsets[0] = 0;
+    for (size_t i = 0; i < count; i++) {
+      size_t len = starts[i + 1] - starts[i];
+      bool newline = i + 1 < count || !mapping->missing_newline;
+      /* drop the line ending, any \r before it, then add a \n back */
+      if (newline) { len--; }
+      if (len > 0 && data[starts[i] + len - 1] == '\r') { len--; }
+      offsets[i + 1] = offsets[i] + len + 1;
+    }
+    mapping->offsets = offsets;
+  }
+}
+
+
+static Buffer* new_buffer(lua_State *L, Node *root) {
+  Buffer *buffer = lua_newuserdata(L, sizeof(Buffer));
+  set_root(buffer, root);
+  luaL_setmetatable(L, API_TYPE_BUFFER);
+  return buffer;
+}
+
+
+static lua_Integer check_line(lua_State *L, Buffer *buffer, int idx) {
+  lua_Integer line = luaL_checkinteger(L, idx);
+  luaL_argcheck(L, line >= 1 && (size_t) line <= node_count(buffer->root), idx, "line out of range");
+  return line;
+}
+
+
+static int f_buffer_new(lua_State *L) {
+  Node *root = NULL;
+  if (!lua_isnoneornil(L, 1)) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    root = build_from_table(L, 1);
+  }
+  new_buffer(L, root);
+  return 1;
+}
+
+
+static int f_buffer_load(lua_State *L) {
+  const char *path = luaL_checkstring(L, 1);
+  size_t size = 0;
+  const char *data = SDL_LoadFile(path, &size);
+  if (!data) {
+    lua_pushnil(L);
+    lua_pushstring(L, SDL_GetError());
+    return 2;
+  }
+  Mapping *mapping = check_alloc(SDL_calloc(1, sizeof(Mapping)));
+  SDL_SetAtomicInt(&mapping->refs, 1);
+  mapping->data = data;
+  mapping->size = size;
+  index_lines(mapping);
+  Node *root;
+  if (mapping->count > 0) {
+    root = node_new_mapped(mapping, 0, mapping->count, next_priority());
+  } else {
+    /* like an empty document, an empty file has one empty line */
+    mapping_release(mapping);
+    root = node_new(line_new("\n", 1));
+  }
+  new_buffer(L, root);
+  lua_pushboolean(L, root->mapping && root->mapping->crlf);
+  return 2;
+}
+
+
+static int f_buffer_gc(lua_State *L) {
+  Buffer *buffer = luaL_checkudata(L, 1, API_TYPE_BUFFER);
+  node_release(buffer->root);
+  set_root(buffer, NULL);
+  return 0;
+}
+
+
+static int f_buffer_len(lua_State *L) {
+  Buffer *buffer = luaL_checkudata(L, 1, API_TYPE_BUFFER);
+  lua_pushinteger(L, node_count(buffer->root));
+  return 1;
+}
+
+
+static int f_buffer_index(lua_State *L) {
+  Buffer *buffer = lua_touserdata(L, 1);
+  if (lua_type(L, 2) != LUA_TNUMBER) {
+    lua_getmetatable(L, 1);
+    lua_pushvalue(L, 2);
+    lua_rawget(L, -2);
+    return 1;
+  }
+  int isnum;
+  lua_Integer i = lua_tointegerx(L, 2, &isnum);
+  if (!isnum || i < 1 || (size_t) i > node_count(buffer->root)) {
+    lua_pushnil(L);
+    return 1;
+  }
+  if (buffer->cached_index != (size_t) i) {
+    buffer->cached_node = get_line(buffer->root, i - 1, &buffer->cached_line);
+    buffer->cached_index = i;
+  }
+  push_line(L, buffer->cached_node, buffer->cached_line);
+  return 1;
+}
+
+
+/* Only supports what table.insert and table.remove need on top of replacing
+** lines: appending a line and removing the last one. */
+static int f_buffer_newindex(lua_State *L) {
+  Buffer *buffer = luaL_checkudata(L, 1, API_TYPE_BUFFER);
+  lua_Integer i = luaL_checkinteger(L, 2);
+  size_t count = node_count(buffer->root);
+  if (lua_isnil(L, 3)) {
+    luaL_argcheck(L, count > 0 && (size_t) i == count, 2, "only the last line can be removed");
+    splice(buffer, count - 1, 1, NULL);
+    return 0;
+  }
+  size_t len;
+  const char *text = luaL_checklstring(L, 3, &len);
+  luaL_argcheck(L, i >= 1 && (size_t) i <= count + 1, 2, "line out of range");
+  splice(buffer, i - 1, (size_t) i <= count ? 1 : 0, node_new(line_new(text, len)));
+  return 0;
+}
+
+
+static int f_buffer_splice(lua_State *L) {
+  Buffer *buffer = luaL_checkudata(L, 1, API_TYPE_BUFFER);
+  size_t count = node_count(buffer->root);
+  lua_Integer at = luaL_checkinteger(L, 2);
+  lua_Integer remove = luaL_checkinteger(L, 3);
+  luaL_argcheck(L, at >= 1 && (size_t) at <= count + 1, 2, "line out of range");
+  luaL_argcheck(L, remove >= 0 && (size_t) remove <= count - (at - 1), 3, "invalid number of lines to remove");
+  Node *insert = NULL;
+  if (!lua_isnoneornil(L, 4)) {
+    luaL_checktype(L, 4, LUA_TTABLE);
+    insert = build_from_table(L, 4);
+  }
+  splice(buffer, at - 1, remove, insert);
+  return 0;
+}
+
+
+static int f_buffer_get_text(lua_State *L) {
+  Buffer *buffer = luaL_checkudata(L, 1, API_TYPE_BUFFER);
+  lua_Integer line1 = check_line(L, buffer, 2);
+  lua_Integer col1 = luaL_checkinteger(L, 3);
+  lua_Integer line2 = check_line(L, buffer, 4);
+  lua_Integer col2 = luaL_checkinteger(L, 5);
+  lua_Integer start = line_offset(buffer->root, line1 - 1) + col1 - 1;
+  lua_Integer end = line_offset(buffer->root, line2 - 1) + col2 - 1;
+  start = start < 0 ? 0 : start;
+  end = (size_t) end > node_bytes(buffer->root) ? (lua_Integer) node_bytes(buffer->root) : end;
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  if (start < end) {
+    add_bytes(buffer->root, start, end, &b);
+  }
+  luaL_pushresult(&b);
+  return 1;
+}
+
+
+static int f_buffer_get_offset(lua_State *L) {
+  Buffer *buffer = luaL_checkudata(L, 1, API_TYPE_BUFFER);
+  lua_Integer line = check_line(L, buffer, 2);
+  lua_Integer col = luaL_optinteger(L, 3, 1);
+  lua_pushinteger(L, line_offset(buffer->root, line - 1) + col);
+  return 1;
+}
+
+
+static int f_buffer_get_position(lua_State *L) {
+  Buffer *buffer = luaL_checkudata(L, 1, API_TYPE_BUFFER);
+  lua_Integer offset = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, offset >= 1 && (size_t) offset <= node_bytes(buffer->root), 2, "offset out of range");
+  size_t col;
+  size_t line = find_offset(buffer->root, offset - 1, &col);
+  lua_pushinteger(L, line + 1);
+  lua_pushinteger(L, col + 1);
+  return 2;
+}
+
+
+static int f_buffer_get_size(lua_State *L) {
+  Buffer *buffer = luaL_checkudata(L, 1, API_TYPE_BUFFER);
+  lua_pushinteger(L, node_bytes(buffer->root));
+  return 1;
+}
+
+
+static int f_buffer_snapshot(lua_State *L) {
+  Buffer *buffer = luaL_checkudata(L, 1, API_TYPE_BUFFER);
+  new_buffer(L, node_retain(buffer->root));
+  return 1;
+}
+
+
+struct BufferLines {
+  Node *root;
+};
+
+
+BufferLines* buffer_get_lines(lua_State *L, int idx) {
+  Buffer *buffer = luaL_checkudata(L, idx, API_TYPE_BUFFER);
+  BufferLines *lines = check_alloc(SDL_malloc(sizeof(BufferLines)));
+  lines->root = node_retain(buffer->root);
+  return lines;
+}
+
+
+size_t buffer_lines_count(BufferLines *lines) {
+  return node_count(lines->root);
+}
+
+
+size_t buffer_lines_read(BufferLines *lines, size_t i, char **text, size_t *capacity) {
+  size_t k;
+  Node *node = get_line(lines->root, i, &k);
+  Mapping *mapping = node->mapping;
+  size_t len = node->line ? node->line->len
+    : mapping_offset(mapping, node->first + k + 1) - mapping_offset(mapping, node->first + k);
+  if (!try_grow((void**) text, capacity, len + 1, 1)) { return SIZE_MAX; }
+  (*text)[len] = '\0';
+  if (node->line) {
+    memcpy(*text, node->line->text, len);
+    return len;
+  }
+  /* every line is its text without the ending, then a \n */
+  memcpy(*text, mapping->data + mapping->starts[node->first + k], len - 1);
+  (*text)[len - 1] = '\n';
+  return len;
+}
+
+
+void buffer_lines_release(BufferLines *lines) {
+  node_release(lines->root);
+  SDL_free(lines);
+}
+
+
+static const luaL_Reg buffer_lib[] = {
+  { "new",          f_buffer_new          },
+  { "load",         f_buffer_load         },
+  { "__gc",         f_buffer_gc           },
+  { "__len",        f_buffer_len          },
+  { "__index",      f_buffer_index        },
+  { "__newindex",   f_buffer_newindex     },
+  { "splice",       f_buffer_splice       },
+  { "get_text",     f_buffer_get_text     },
+  { "get_offset",   f_buffer_get_offset   },
+  { "get_position", f_buffer_get_position },
+  { "get_size",     f_buffer_get_size     },
+  { "snapshot",     f_buffer_snapshot     },
+  { NULL, NULL }
+};
+
+
+int luaopen_buffer(lua_State *L) {
+  luaL_newmetatable(L, API_TYPE_BUFFER);
+  luaL_setfuncs(L, buffer_lib, 0);
+  return 1;
+}
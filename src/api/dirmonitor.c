@@ -7,11 +7,17 @@
 #include <stdbool.h>
 #include <assert.h>
 
+// Backends returning no changes, like kqueue after its timeout, are polled again after this
+#define IDLE_WAIT_MS 100
+
 struct dirmonitor {
   SDL_Thread* thread;
   SDL_Mutex* mutex;
+  // signaled when the changes were checked, or the monitor is freed
+  SDL_Condition* checked;
   char buffer[64512];
   volatile int length;
+  Sint32 debounce_ms;
   struct dirmonitor_internal* internal;
 };
 
@@ -19,24 +25,42 @@ struct dirmonitor {
 struct dirmonitor_internal* init_dirmonitor();
 void deinit_dirmonitor(struct dirmonitor_internal*);
 int get_changes_dirmonitor(struct dirmonitor_internal*, char*, int);
-int translate_changes_dirmonitor(struct dirmonitor_internal*, char*, int, int (*)(int, const char*, void*), void*);
+int translate_changes_dirmonitor(struct dirmonitor_internal*, char*, int, int (*)(int, const char*, const char*, const char*, void*), void*);
 int add_dirmonitor(struct dirmonitor_internal*, const char*);
 void remove_dirmonitor(struct dirmonitor_internal*, int);
 int get_mode_dirmonitor();
 
 
-static int f_check_dir_callback(int watch_id, const char* path, void* L) {
+static int f_check_dir_callback(int watch_id, const char* path, const char* name, const char* change, void* L) {
   // using absolute indices from f_dirmonitor_check (2: callback, 3: error_callback, 4: watch_id notified table)
 
-  // Check if we already notified about this watch
-  lua_rawgeti(L, 4, watch_id);
-  bool skip = !lua_isnoneornil(L, -1);
-  lua_pop(L, 1);
-  if (skip) return 0;
+  if (!change) {
+    // Check if we already notified about this watch
+    lua_rawgeti(L, 4, watch_id);
+    bool skip = !lua_isnoneornil(L, -1);
+    lua_pop(L, 1);
+    if (skip) return 0;
 
-  // Set watch as notified
-  lua_pushboolean(L, true);
-  lua_rawseti(L, 4, watch_id);
+    // Set watch as notified
+    lua_pushboolean(L, true);
+    lua_rawseti(L, 4, watch_id);
+  } else {
+    // Skip changes repeating the last one notified for the same entry, like a file written in many times
+    if (path)
+      lua_pushlstring(L, path, watch_id);
+    else
+      lua_pushfstring(L, "%d/%s", watch_id, name ? name : "");
+    lua_pushvalue(L, -1);
+    lua_rawget(L, 4);
+    bool skip = lua_isstring(L, -1) && strcmp(lua_tostring(L, -1), change) == 0;
+    lua_pop(L, 1);
+    if (skip) {
+      lua_pop(L, 1);
+      return 0;
+    }
+    lua_pushstring(L, change);
+    lua_rawset(L, 4);
+  }
 
   // Prepare callback call
   lua_pushvalue(L, 2);
@@ -44,31 +68,55 @@ static int f_check_dir_callback(int watch_id, const char* path, void* L) {
     lua_pushlstring(L, path, watch_id);
   else
     lua_pushnumber(L, watch_id);
+  if (name)
+    lua_pushstring(L, name);
+  else
+    lua_pushnil(L);
+  if (change)
+    lua_pushstring(L, change);
+  else
+    lua_pushnil(L);
 
   int result = 0;
-  if (lua_pcall(L, 1, 1, 3) == LUA_OK)
+  if (lua_pcall(L, 3, 1, 3) == LUA_OK)
     result = lua_toboolean(L, -1);
   lua_pop(L, 1);
   return !result;
 }
 
 
+// Blocks on the backend until there are changes, and only reads more once they were checked.
+// The main loop is woken up after the debounce time, so that the changes coming meanwhile
+// are left in the backend and read together after these.
 static int dirmonitor_check_thread(void* data) {
   struct dirmonitor* monitor = data;
 
+  SDL_LockMutex(monitor->mutex);
   while (monitor->length >= 0) {
-    if (monitor->length == 0) {
-      int result = get_changes_dirmonitor(monitor->internal, monitor->buffer, sizeof(monitor->buffer));
-      SDL_LockMutex(monitor->mutex);
-      if (monitor->length == 0)
-        monitor->length = result;
-      SDL_UnlockMutex(monitor->mutex);
+    if (monitor->length > 0) {
+      SDL_WaitCondition(monitor->checked, monitor->mutex);
+      continue;
+    }
+    SDL_UnlockMutex(monitor->mutex);
+    int result = get_changes_dirmonitor(monitor->internal, monitor->buffer, sizeof(monitor->buffer));
+    SDL_LockMutex(monitor->mutex);
+    if (monitor->length != 0)
+      continue;
+    monitor->length = result;
+    if (result == 0) {
+      SDL_WaitConditionTimeout(monitor->checked, monitor->mutex, IDLE_WAIT_MS);
+    } else if (result > 0) {
+      if (monitor->debounce_ms > 0)
+        SDL_WaitConditionTimeout(monitor->checked, monitor->mutex, monitor->debounce_ms);
+      // the changes may have been checked already
+      if (monitor->length > 0) {
+        CustomEvent event;
+        SDL_zero(event);
+        push_custom_event("dirmonitor", &event);
+      }
     }
-    SDL_Delay(1);
-    CustomEvent event;
-    SDL_zero(event);
-    push_custom_event("dirmonitor", &event);
   }
+  SDL_UnlockMutex(monitor->mutex);
   return 0;
 }
 
@@ -77,7 +125,9 @@ static int f_dirmonitor_new(lua_State* L) {
   struct dirmonitor* monitor = lua_newuserdata(L, sizeof(struct dirmonitor));
   luaL_setmetatable(L, API_TYPE_DIRMONITOR);
   memset(monitor, 0, sizeof(struct dirmonitor));
+  monitor->debounce_ms = luaL_optnumber(L, 1, 0) * 1000;
   monitor->mutex = SDL_CreateMutex();
+  monitor->checked = SDL_CreateCondition();
   monitor->internal = init_dirmonitor();
   return 1;
 }
@@ -88,9 +138,11 @@ static int f_dirmonitor_gc(lua_State* L) {
   SDL_LockMutex(monitor->mutex);
   monitor->length = -1;
   deinit_dirmonitor(monitor->internal);
+  SDL_BroadcastCondition(monitor->checked);
   SDL_UnlockMutex(monitor->mutex);
   SDL_WaitThread(monitor->thread, NULL);
   SDL_free(monitor->internal);
+  SDL_DestroyCondition(monitor->checked);
   SDL_DestroyMutex(monitor->mutex);
   return 0;
 }
@@ -132,8 +184,10 @@ static int f_dirmonitor_check(lua_State* L) {
     // Create a table for keeping track of what watch ids were notified in this check,
     // so that we avoid notifying multiple times.
     lua_newtable(L);
-    if (translate_changes_dirmonitor(monitor->internal, monitor->buffer, monitor->length, f_check_dir_callback, L) == 0)
+    if (translate_changes_dirmonitor(monitor->internal, monitor->buffer, monitor->length, f_check_dir_callback, L) == 0) {
       monitor->length = 0;
+      SDL_SignalCondition(monitor->checked);
+    }
     lua_pushboolean(L, 1);
   } else
     lua_pushboolean(L, 0);
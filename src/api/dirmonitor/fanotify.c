@@ -0,0 +1,367 @@
+#define _GNU_SOURCE
+#include <SDL3/SDL.h>
+#include <sys/fanotify.h>
+#include <sys/statfs.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+
+// Without the permissions fanotify needs, this backend works like the inotify one,
+// with a watch for each directory.
+#define dirmonitor_internal inotify_dirmonitor
+#define init_dirmonitor init_inotify_dirmonitor
+#define deinit_dirmonitor deinit_inotify_dirmonitor
+#define get_changes_dirmonitor get_inotify_changes_dirmonitor
+#define translate_changes_dirmonitor translate_inotify_changes_dirmonitor
+#define add_dirmonitor add_inotify_dirmonitor
+#define remove_dirmonitor remove_inotify_dirmonitor
+#define get_mode_dirmonitor get_inotify_mode_dirmonitor
+#include "inotify.c"
+#undef dirmonitor_internal
+#undef init_dirmonitor
+#undef deinit_dirmonitor
+#undef get_changes_dirmonitor
+#undef translate_changes_dirmonitor
+#undef add_dirmonitor
+#undef remove_dirmonitor
+#undef get_mode_dirmonitor
+
+// fanotify marks whole filesystems, so a single watch covers a tree of any size.
+// Events carry the handle of the directory and the name of the entry. As a mark
+// reports every change of its filesystem, the events are resolved in the thread:
+// the events of other filesystems are dropped from their fsid, and the directory
+// of the others is opened from its handle to find its path only once, as it's then
+// cached, along with the directories that aren't under the watched paths.
+
+#define FANOTIFY_EVENTS (FAN_CREATE | FAN_DELETE | FAN_MODIFY | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR)
+#define MAX_ROOTS 64
+#define CACHE_SIZE 256
+
+struct fanotify_root {
+  char* path;      // as watched
+  char* real_path; // as the kernel reports it
+  int fd;          // to open the handles of its filesystem
+  fsid_t fsid;
+};
+
+struct fanotify_cached_dir {
+  bool used;
+  fsid_t fsid;
+  int handle_type;
+  unsigned int handle_bytes;
+  unsigned char handle[MAX_HANDLE_SZ];
+  char* path; // as watched, NULL when it isn't under the watched paths
+};
+
+// A change resolved by the thread, as it's passed from get_changes to translate.
+struct fanotify_change {
+  int size;     // of the record, aligned to an int
+  int path_len; // -1 for an overflow
+  int name;     // offset of the name in the path, -1 if none
+  uint64_t mask;
+  char path[];  // followed by a NUL
+};
+
+struct dirmonitor_internal {
+  struct inotify_dirmonitor* inotify;
+  int fd;
+  // a pipe is used to wake the thread in case of exit
+  int sig[2];
+  // the roots and the cache are used by the thread and changed when watching,
+  // held only to resolve an event so that it's never contended for long
+  SDL_SpinLock lock;
+  struct fanotify_root roots[MAX_ROOTS];
+  int n_roots;
+  struct fanotify_cached_dir cache[CACHE_SIZE];
+  // events read but not resolved yet, when their changes didn't fit
+  _Alignas(struct fanotify_event_metadata) char events[16384];
+  int events_start, events_length;
+};
+
+
+// Whether fanotify can mark filesystems and open the handles it reports.
+static bool fanotify_permitted() {
+  static int permitted = -1;
+  if (permitted >= 0)
+    return permitted;
+  permitted = 0;
+  int fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_REPORT_DFID_NAME, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  if (fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FANOTIFY_EVENTS, AT_FDCWD, "/") == 0) {
+    struct { struct file_handle handle; unsigned char bytes[MAX_HANDLE_SZ]; } handle;
+    handle.handle.handle_bytes = MAX_HANDLE_SZ;
+    int mount_id;
+    int root = open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root >= 0 && name_to_handle_at(AT_FDCWD, "/", &handle.handle, &mount_id, 0) == 0) {
+      int opened = open_by_handle_at(root, &handle.handle, O_PATH | O_CLOEXEC);
+      if (opened >= 0) {
+        permitted = 1;
+        close(opened);
+      }
+    }
+    if (root >= 0)
+      close(root);
+  }
+  close(fd);
+  return permitted;
+}
+
+
+struct dirmonitor_internal* init_dirmonitor() {
+  struct dirmonitor_internal* monitor = SDL_calloc(1, sizeof(struct dirmonitor_internal));
+  if (!fanotify_permitted()) {
+    monitor->inotify = init_inotify_dirmonitor();
+    return monitor;
+  }
+  monitor->fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_REPORT_DFID_NAME, O_RDONLY | O_CLOEXEC);
+  pipe(monitor->sig);
+  fcntl(monitor->sig[0], F_SETFD, FD_CLOEXEC);
+  fcntl(monitor->sig[1], F_SETFD, FD_CLOEXEC);
+  return monitor;
+}
+
+
+static void clear_cache(struct dirmonitor_internal* monitor) {
+  for (int i = 0; i < CACHE_SIZE; i++) {
+    SDL_free(monitor->cache[i].path);
+    monitor->cache[i].path = NULL;
+    monitor->cache[i].used = false;
+  }
+}
+
+
+static void free_roots(struct dirmonitor_internal* monitor) {
+  for (int i = 0; i < monitor->n_roots; i++) {
+    SDL_free(monitor->roots[i].path);
+    free(monitor->roots[i].real_path);
+    close(monitor->roots[i].fd);
+  }
+  monitor->n_roots = 0;
+  clear_cache(monitor);
+}
+
+
+void deinit_dirmonitor(struct dirmonitor_internal* monitor) {
+  if (monitor->inotify) {
+    deinit_inotify_dirmonitor(monitor->inotify);
+    SDL_free(monitor->inotify);
+    return;
+  }
+  SDL_LockSpinlock(&monitor->lock);
+  free_roots(monitor);
+  SDL_UnlockSpinlock(&monitor->lock);
+  close(monitor->fd);
+  close(monitor->sig[0]);
+  close(monitor->sig[1]);
+}
+
+
+static const char* fanotify_change_name(uint64_t mask) {
+  if (mask & FAN_Q_OVERFLOW) return "overflow";
+  if (mask & FAN_CREATE) return "created";
+  if (mask & FAN_DELETE) return "deleted";
+  if (mask & FAN_MOVED_FROM) return "moved_from";
+  if (mask & FAN_MOVED_TO) return "moved_to";
+  if (mask & FAN_MODIFY) return "modified";
+  return NULL;
+}
+
+
+// Finds the path of a directory from its handle, as it's watched, in `path`.
+static bool directory_path(struct dirmonitor_internal* monitor, struct fanotify_root* root, struct file_handle* handle, char* path, size_t size) {
+  // the directory may be gone already, then the event of its deletion is enough
+  int fd = open_by_handle_at(root->fd, handle, O_PATH | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  char link[64], dir[PATH_MAX];
+  snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+  ssize_t dir_len = readlink(link, dir, sizeof(dir) - 1);
+  close(fd);
+  if (dir_len <= 0)
+    return false;
+  dir[dir_len] = '\0';
+  path[0] = '\0';
+  for (int i = 0; i < monitor->n_roots; i++) {
+    struct fanotify_root* watched = &monitor->roots[i];
+    size_t real_len = strlen(watched->real_path);
+    if (strncmp(dir, watched->real_path, real_len) == 0 && (dir[real_len] == '/' || dir[real_len] == '\0')) {
+      int len = snprintf(path, size, "%s%s", watched->path, dir + real_len);
+      return len > 0 && (size_t)len < size;
+    }
+  }
+  return true;
+}
+
+
+// Returns the path of the directory of an event, as it's watched, or NULL if it
+// isn't under the watched paths.
+static const char* event_directory(struct dirmonitor_internal* monitor, struct fanotify_event_info_fid* fid) {
+  struct file_handle* handle = (struct file_handle*)fid->handle;
+  if (handle->handle_bytes > MAX_HANDLE_SZ)
+    return NULL;
+  struct fanotify_root* root = NULL;
+  for (int i = 0; i < monitor->n_roots && !root; i++) {
+    if (memcmp(&monitor->roots[i].fsid, &fid->fsid, sizeof(fsid_t)) == 0)
+      root = &monitor->roots[i];
+  }
+  if (!root)
+    return NULL;
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < sizeof(fsid_t); i++)
+    hash = (hash ^ ((unsigned char*)&fid->fsid)[i]) * 16777619u;
+  for (unsigned int i = 0; i < handle->handle_bytes; i++)
+    hash = (hash ^ handle->f_handle[i]) * 16777619u;
+  struct fanotify_cached_dir* cached = &monitor->cache[hash % CACHE_SIZE];
+  if (cached->used && memcmp(&cached->fsid, &fid->fsid, sizeof(fsid_t)) == 0 && cached->handle_type == handle->handle_type
+    && cached->handle_bytes == handle->handle_bytes && memcmp(cached->handle, handle->f_handle, handle->handle_bytes) == 0)
+    return cached->path;
+  char path[PATH_MAX];
+  if (!directory_path(monitor, root, handle, path, sizeof(path)))
+    return NULL;
+  SDL_free(cached->path);
+  cached->used = true;
+  memcpy(&cached->fsid, &fid->fsid, sizeof(fsid_t));
+  cached->handle_type = handle->handle_type;
+  cached->handle_bytes = handle->handle_bytes;
+  memcpy(cached->handle, handle->f_handle, handle->handle_bytes);
+  cached->path = path[0] ? SDL_strdup(path) : NULL;
+  return cached->path;
+}
+
+
+// Writes the path of the entry of an event in `path`, and the offset of its name.
+// Returns the length of the path, or -1 when the event isn't reported.
+static int resolve_event(struct dirmonitor_internal* monitor, struct fanotify_event_metadata* event, char* path, size_t size, int* name_offset) {
+  struct fanotify_event_info_fid* fid = (struct fanotify_event_info_fid*)(event + 1);
+  if (event->event_len < event->metadata_len + sizeof(*fid) || fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+    return -1;
+  const char* dir = event_directory(monitor, fid);
+  if (!dir)
+    return -1;
+  // the name follows the handle, "." for changes of the directory itself
+  struct file_handle* handle = (struct file_handle*)fid->handle;
+  const char* name = (const char*)handle->f_handle + handle->handle_bytes;
+  int len;
+  if (strcmp(name, ".") != 0) {
+    len = snprintf(path, size, "%s/%s", dir, name);
+    *name_offset = strlen(dir) + 1;
+  } else {
+    len = snprintf(path, size, "%s", dir);
+    const char* dir_name = strrchr(path, '/');
+    *name_offset = dir_name ? dir_name + 1 - path : -1;
+  }
+  // the cached paths under a directory that moved are wrong now
+  if ((event->mask & FAN_ONDIR) && (event->mask & (FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO)))
+    clear_cache(monitor);
+  return len > 0 && (size_t)len < size ? len : -1;
+}
+
+
+int get_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int length) {
+  if (monitor->inotify)
+    return get_inotify_changes_dirmonitor(monitor->inotify, buffer, length);
+  if (monitor->events_start >= monitor->events_length) {
+    struct pollfd fds[2] = { { .fd = monitor->fd, .events = POLLIN | POLLERR, .revents = 0 }, { .fd = monitor->sig[0], .events = POLLIN | POLLERR, .revents = 0 } };
+    poll(fds, 2, -1);
+    int n = read(monitor->fd, monitor->events, sizeof(monitor->events));
+    if (n <= 0)
+      return n;
+    monitor->events_start = 0;
+    monitor->events_length = n;
+  }
+  char path[PATH_MAX];
+  int written = 0, remaining = monitor->events_length - monitor->events_start;
+  struct fanotify_event_metadata* event = (struct fanotify_event_metadata*)(monitor->events + monitor->events_start);
+  for (; FAN_EVENT_OK(event, remaining); event = FAN_EVENT_NEXT(event, remaining)) {
+    if (!fanotify_change_name(event->mask))
+      continue;
+    int path_len = -1, name_offset = -1;
+    if (!(event->mask & FAN_Q_OVERFLOW)) {
+      SDL_LockSpinlock(&monitor->lock);
+      path_len = resolve_event(monitor, event, path, sizeof(path), &name_offset);
+      SDL_UnlockSpinlock(&monitor->lock);
+      if (path_len < 0)
+        continue;
+    }
+    int size = sizeof(struct fanotify_change) + (path_len > 0 ? path_len : 0) + 1;
+    size = (size + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+    // the rest is resolved in the next call
+    if (written + size > length)
+      break;
+    struct fanotify_change* change = (struct fanotify_change*)(buffer + written);
+    change->size = size;
+    change->path_len = path_len;
+    change->name = name_offset;
+    change->mask = event->mask;
+    if (path_len > 0)
+      memcpy(change->path, path, path_len);
+    change->path[path_len > 0 ? path_len : 0] = '\0';
+    written += size;
+  }
+  monitor->events_start = monitor->events_length - (FAN_EVENT_OK(event, remaining) ? remaining : 0);
+  return written;
+}
+
+
+int translate_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int length, int (*change_callback)(int, const char*, const char*, const char*, void*), void* data) {
+  if (monitor->inotify)
+    return translate_inotify_changes_dirmonitor(monitor->inotify, buffer, length, change_callback, data);
+  struct fanotify_change* change;
+  for (int offset = 0; offset + (int)sizeof(*change) <= length; offset += change->size) {
+    change = (struct fanotify_change*)(buffer + offset);
+    const char* name = change->name >= 0 ? change->path + change->name : NULL;
+    if (change->path_len < 0)
+      change_callback(-1, NULL, NULL, fanotify_change_name(change->mask), data);
+    else
+      change_callback(change->path_len, change->path, name, fanotify_change_name(change->mask), data);
+  }
+  return 0;
+}
+
+
+int add_dirmonitor(struct dirmonitor_internal* monitor, const char* path) {
+  if (monitor->inotify)
+    return add_inotify_dirmonitor(monitor->inotify, path);
+  struct statfs st;
+  char* real_path = realpath(path, NULL);
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (real_path && fd >= 0 && monitor->n_roots < MAX_ROOTS && fstatfs(fd, &st) == 0
+    && fanotify_mark(monitor->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FANOTIFY_EVENTS, AT_FDCWD, path) == 0) {
+    SDL_LockSpinlock(&monitor->lock);
+    struct fanotify_root* root = &monitor->roots[monitor->n_roots++];
+    root->path = SDL_strdup(path);
+    root->real_path = real_path;
+    root->fd = fd;
+    root->fsid = st.f_fsid;
+    // directories found outside of the watched paths may be under this one
+    clear_cache(monitor);
+    SDL_UnlockSpinlock(&monitor->lock);
+    return 1;
+  }
+  free(real_path);
+  if (fd >= 0)
+    close(fd);
+  return -1;
+}
+
+
+// In single mode only the last path is unwatched, which removes all the others.
+void remove_dirmonitor(struct dirmonitor_internal* monitor, int fd) {
+  if (monitor->inotify) {
+    remove_inotify_dirmonitor(monitor->inotify, fd);
+    return;
+  }
+  fanotify_mark(monitor->fd, FAN_MARK_FLUSH | FAN_MARK_FILESYSTEM, 0, AT_FDCWD, NULL);
+  SDL_LockSpinlock(&monitor->lock);
+  free_roots(monitor);
+  SDL_UnlockSpinlock(&monitor->lock);
+}
+
+
+int get_mode_dirmonitor() { return fanotify_permitted() ? 1 : 2; }
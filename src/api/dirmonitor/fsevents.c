@@ -124,13 +124,13 @@ int translate_changes_dirmonitor(
   struct dirmonitor_internal* monitor,
   char* buffer,
   int buffer_size,
-  int (*change_callback)(int, const char*, void*),
+  int (*change_callback)(int, const char*, const char*, const char*, void*),
   void* L
 ) {
   SDL_LockMutex(monitor->lock);
   if (monitor->count > 0) {
     for (size_t i = 0; i<monitor->count; i++) {
-      change_callback(strlen(monitor->changes[i]), monitor->changes[i], L);
+      change_callback(strlen(monitor->changes[i]), monitor->changes[i], NULL, NULL, L);
       SDL_free(monitor->changes[i]);
     }
     SDL_free(monitor->changes);
@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <stdint.h>
 
 
 struct dirmonitor_internal {
@@ -37,10 +38,24 @@ int get_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, in
 }
 
 
-int translate_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int length, int (*change_callback)(int, const char*, void*), void* data) {
-  for (struct inotify_event* info = (struct inotify_event*)buffer; (char*)info < buffer + length; info = (struct inotify_event*)((char*)info + sizeof(struct inotify_event))) {
-    if ((info->mask & (~IN_IGNORED)) > 0)
-      change_callback(info->wd, NULL, data);
+static const char* change_name(uint32_t mask) {
+  if (mask & IN_Q_OVERFLOW) return "overflow";
+  if (mask & IN_CREATE) return "created";
+  if (mask & IN_DELETE) return "deleted";
+  if (mask & IN_MOVED_FROM) return "moved_from";
+  if (mask & IN_MOVED_TO) return "moved_to";
+  if (mask & IN_MODIFY) return "modified";
+  return NULL;
+}
+
+
+int translate_changes_dirmonitor(struct dirmonitor_internal* monitor, char* buffer, int length, int (*change_callback)(int, const char*, const char*, const char*, void*), void* data) {
+  // events are followed by their name, padded with NULs to `len` bytes
+  for (char* p = buffer; p + sizeof(struct inotify_event) <= buffer + length; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+    struct inotify_event* info = (struct inotify_event*)p;
+    const char* change = change_name(info->mask);
+    if (change)
+      change_callback(info->wd, NULL, info->len > 0 ? info->name : NULL, change, data);
   }
   return 0;
 }
@@ -0,0 +1,991 @@
+#include "alloc.h"
+#include "api.h"
+#include "custom_events.h"
+
+#include <SDL3/SDL.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+  #include <dirent.h>
+  #include <fcntl.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+/* A native index of the files of a project. Entries are kept in an array,
+** with their names in an arena, and are linked to their parent and to their
+** siblings, so that a path is rebuilt by following the parent links. A hash
+** table of (parent, name) finds the entries of a directory by name.
+**
+** Each index has a pool of threads that scan the tree once, applying the
+** ignore rules of the project, and then wait for the directories to rescan
+** that are queued with index:refresh() when the dirmonitor reports a change.
+** Without a dirmonitor that watches whole trees, index:refresh() is instead
+** called without a path from time to time, to rescan the directories whose
+** modification time changed.
+** The threads take directories from a shared queue, list them without the
+** lock and merge them in the index with it. Each has its own Lua state, only
+** used to catch the errors raised by the ignore patterns.
+**
+** Outside of Windows, directories are read with openat() and only the entries
+** that aren't known to be directories from their d_type are stat'ed, with
+** fstatat() relative to the directory.
+**
+** Removed entries are left in the array, so that the ids held by the threads
+** stay valid, and are compacted away with their names once they're half of
+** the entries and no thread is scanning. The cursors given to Lua hold the
+** generation of the ids they're from, and those of the previous generation
+** are mapped to the current ids.
+**
+** A thread that runs out of memory leaves the directory it was scanning as
+** it was and reports it in index:status(), instead of exiting. */
+
+#ifdef _WIN32
+  #define PATHSEP '\\'
+#else
+  #define PATHSEP '/'
+#endif
+
+#define NO_ENTRY UINT32_MAX
+#define TOMBSTONE (UINT32_MAX - 1)
+#define MAX_SCAN_DEPTH 256 /* when link cycles can't be found */
+#define MAX_CAPTURES 32    /* LUA_MAXCAPTURES in utf8.c */
+#define MAX_CHUNK 65536    /* entries returned at once */
+#define MAX_SCAN_THREADS 8 /* scanning is mostly waiting on the filesystem */
+
+enum { ENTRY_REMOVED, ENTRY_FILE, ENTRY_DIR };
+
+typedef struct {
+  uint32_t parent, first_child, prev_sibling, next_sibling;
+  uint32_t name, name_len; /* in the names arena, the root has its path */
+  uint32_t stamp;          /* scan that last saw the entry */
+  uint16_t depth;
+  uint8_t type;
+  bool scanned;            /* directories whose entries are indexed */
+  bool descend;            /* directories scanned with their parent */
+  bool check;              /* queued to be rescanned only if modified */
+  uint64_t size;
+  int64_t modified;        /* in ns, directories have it once scanned */
+  uint64_t file_id;        /* of scanned directories, to find link cycles */
+} Entry;
+
+typedef struct {
+  char *pattern;
+  size_t len;
+  bool anchored, use_path, match_dir;
+} IgnoreRule;
+
+typedef struct {
+  SDL_Mutex *lock;
+  SDL_Condition *wake;
+  SDL_Thread *threads[MAX_SCAN_THREADS];
+  int n_threads;
+  /* guarded by the lock */
+  bool quit, ready;   /* ready once the tree was scanned */
+  bool changed;       /* scanned since the last notification */
+  int busy;           /* threads listing a directory */
+  uint32_t stamp;
+  Entry *entries;
+  size_t n_entries, entries_capacity, n_files;
+  size_t n_removed;   /* entries removed since the last compaction */
+  uint32_t generation; /* compactions, ids change with each */
+  uint32_t *remap;     /* the ids of the previous generation in this one */
+  size_t remap_len;
+  char *names;
+  size_t names_len, names_capacity;
+  uint32_t *slots; /* open addressing, a power of two of slots */
+  size_t slots_capacity, slots_used;
+  uint32_t *queue; /* directories to scan */
+  size_t n_queue, queue_capacity;
+  const char *error; /* set when a thread ran out of memory */
+  /* only read once the index is created */
+  IgnoreRule *rules;
+  size_t n_rules;
+  uint64_t size_limit;
+} FileIndex;
+
+/* The entries of a directory, as listed by a thread before merging them. */
+typedef struct {
+  size_t name, name_len;
+  uint8_t type;
+  bool descend;
+  uint64_t size;
+  int64_t modified;
+} Listed;
+
+typedef struct {
+  FileIndex *index;
+  lua_State *L;
+  Listed *items;
+  size_t n_items, items_capacity;
+  char *names;
+  size_t names_len, names_capacity;
+  char *path; /* the directory path, with room for the entry names */
+  size_t path_len, path_capacity;
+  char *scratch;
+  size_t scratch_capacity;
+  bool failed; /* out of memory while listing */
+} Listing;
+
+
+/* Called with the lock held. */
+static void fail(FileIndex *index) {
+  index->error = "not enough memory, some directories aren't indexed";
+}
+
+
+static uint64_t hash_name(uint32_t parent, const char *name, size_t len) {
+  uint64_t h = 14695981039346656037ull ^ parent;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (unsigned char) name[i]) * 1099511628211ull;
+  }
+  return h;
+}
+
+
+static uint32_t find_child(FileIndex *index, uint32_t parent, const char *name, size_t len) {
+  if (index->slots_capacity == 0) { return NO_ENTRY; }
+  size_t mask = index->slots_capacity - 1;
+  for (size_t i = hash_name(parent, name, len) & mask;; i = (i + 1) & mask) {
+    uint32_t id = index->slots[i];
+    if (id == NO_ENTRY) { return NO_ENTRY; }
+    if (id == TOMBSTONE) { continue; }
+    Entry *entry = &index->entries[id];
+    if (entry->parent == parent && entry->name_len == len && memcmp(index->names + entry->name, name, len) == 0) {
+      return id;
+    }
+  }
+}
+
+
+static void insert_slot(FileIndex *index, uint32_t id) {
+  size_t mask = index->slots_capacity - 1;
+  Entry *entry = &index->entries[id];
+  size_t i = hash_name(entry->parent, index->names + entry->name, entry->name_len) & mask;
+  while (index->slots[i] != NO_ENTRY && index->slots[i] != TOMBSTONE) { i = (i + 1) & mask; }
+  if (index->slots[i] == NO_ENTRY) { index->slots_used++; }
+  index->slots[i] = id;
+}
+
+
+static void remove_slot(FileIndex *index, uint32_t id) {
+  size_t mask = index->slots_capacity - 1;
+  Entry *entry = &index->entries[id];
+  size_t i = hash_name(entry->parent, index->names + entry->name, entry->name_len) & mask;
+  while (index->slots[i] != id) { i = (i + 1) & mask; }
+  index->slots[i] = TOMBSTONE;
+}
+
+
+/* Allocates empty slots for `n_entries`, or returns NULL. */
+static uint32_t* new_slots(size_t n_entries, size_t *capacity) {
+  *capacity = 1024;
+  while (*capacity < (n_entries + 1) * 4) { *capacity *= 2; }
+  uint32_t *slots = SDL_malloc(sizeof(uint32_t) * *capacity);
+  if (slots) { memset(slots, 0xFF, sizeof(uint32_t) * *capacity); }
+  return slots;
+}
+
+
+static void rehash(FileIndex *index, uint32_t *slots, size_t capacity) {
+  SDL_free(index->slots);
+  index->slots = slots;
+  index->slots_capacity = capacity;
+  index->slots_used = 0;
+  /* the root isn't looked up by name */
+  for (size_t id = 1; id < index->n_entries; id++) {
+    if (index->entries[id].type != ENTRY_REMOVED) { insert_slot(index, id); }
+  }
+}
+
+
+/* Rehashes the entries when the slots get half full, tombstones included.
+** Returns false, keeping the slots, if they can't be allocated. */
+static bool reserve_slot(FileIndex *index) {
+  if ((index->slots_used + 1) * 2 <= index->slots_capacity) { return true; }
+  size_t capacity;
+  uint32_t *slots = new_slots(index->n_entries, &capacity);
+  if (!slots) { return false; }
+  rehash(index, slots, capacity);
+  return true;
+}
+
+
+/* Returns NO_ENTRY, leaving the index as it was, when out of memory. */
+static uint32_t add_entry(FileIndex *index, uint32_t parent, const char *name, size_t len, const Listed *listed) {
+  if (!try_grow((void**) &index->entries, &index->entries_capacity, index->n_entries + 1, sizeof(Entry))
+      || !try_grow((void**) &index->names, &index->names_capacity, index->names_len + len, 1)
+      || (parent != NO_ENTRY && !reserve_slot(index))) {
+    return NO_ENTRY;
+  }
+  uint32_t id = index->n_entries++;
+  Entry *entry = &index->entries[id];
+  memset(entry, 0, sizeof(Entry));
+  entry->parent = parent;
+  entry->first_child = entry->prev_sibling = entry->next_sibling = NO_ENTRY;
+  entry->name = index->names_len;
+  entry->name_len = len;
+  memcpy(index->names + index->names_len, name, len);
+  index->names_len += len;
+  entry->type = listed->type;
+  entry->descend = listed->descend;
+  entry->size = listed->size;
+  entry->modified = listed->modified;
+  if (parent != NO_ENTRY) {
+    Entry *p = &index->entries[parent];
+    entry->depth = p->depth + 1;
+    entry->next_sibling = p->first_child;
+    if (p->first_child != NO_ENTRY) { index->entries[p->first_child].prev_sibling = id; }
+    p->first_child = id;
+    insert_slot(index, id);
+  }
+  if (entry->type == ENTRY_FILE) { index->n_files++; }
+  return id;
+}
+
+
+static void remove_entry(FileIndex *index, uint32_t id) {
+  Entry *entry = &index->entries[id];
+  while (entry->first_child != NO_ENTRY) {
+    remove_entry(index, entry->first_child);
+  }
+  if (entry->prev_sibling != NO_ENTRY) {
+    index->entries[entry->prev_sibling].next_sibling = entry->next_sibling;
+  } else {
+    index->entries[entry->parent].first_child = entry->next_sibling;
+  }
+  if (entry->next_sibling != NO_ENTRY) {
+    index->entries[entry->next_sibling].prev_sibling = entry->prev_sibling;
+  }
+  remove_slot(index, id);
+  if (entry->type == ENTRY_FILE) { index->n_files--; }
+  entry->type = ENTRY_REMOVED;
+  index->n_removed++;
+}
+
+
+/* Drops the removed entries and their names, keeping the order of the others.
+** Only done while no ids are queued or held by a thread, and skipped when out
+** of memory. */
+static void compact(FileIndex *index) {
+  size_t slots_capacity;
+  uint32_t *ids = SDL_malloc(sizeof(uint32_t) * (index->n_entries + 1));
+  char *names = SDL_malloc(index->names_len);
+  uint32_t *slots = new_slots(index->n_entries - index->n_removed, &slots_capacity);
+  if (!ids || !names || !slots) {
+    SDL_free(ids);
+    SDL_free(names);
+    SDL_free(slots);
+    return;
+  }
+  size_t n = 0, names_len = 0;
+  for (size_t id = 0; id < index->n_entries; id++) {
+    Entry *entry = &index->entries[id];
+    /* removed entries map to the next one kept, for the cursors */
+    if (entry->type == ENTRY_REMOVED) {
+      ids[id] = n;
+      continue;
+    }
+    memcpy(names + names_len, index->names + entry->name, entry->name_len);
+    entry->name = names_len;
+    names_len += entry->name_len;
+    ids[id] = n;
+    index->entries[n++] = *entry;
+  }
+  ids[index->n_entries] = n;
+  for (size_t id = 0; id < n; id++) {
+    Entry *entry = &index->entries[id];
+    if (entry->parent != NO_ENTRY) { entry->parent = ids[entry->parent]; }
+    if (entry->first_child != NO_ENTRY) { entry->first_child = ids[entry->first_child]; }
+    if (entry->prev_sibling != NO_ENTRY) { entry->prev_sibling = ids[entry->prev_sibling]; }
+    if (entry->next_sibling != NO_ENTRY) { entry->next_sibling = ids[entry->next_sibling]; }
+  }
+  SDL_free(index->remap);
+  index->remap = ids;
+  index->remap_len = index->n_entries + 1;
+  index->generation++;
+  SDL_free(index->names);
+  index->names = names;
+  index->names_len = index->names_capacity = names_len;
+  index->n_entries = n;
+  index->n_removed = 0;
+  rehash(index, slots, slots_capacity);
+}
+
+
+/* Writes the path of an entry in `path`, growing it if needed, and returns its
+** length, or SIZE_MAX if it can't be grown. The path is followed by a '\0'. */
+static size_t get_path(FileIndex *index, uint32_t id, char **path, size_t *capacity) {
+  size_t len = 0;
+  for (uint32_t i = id; i != NO_ENTRY; i = index->entries[i].parent) {
+    len += index->entries[i].name_len + (i != id);
+  }
+  if (!try_grow((void**) path, capacity, len + 1, 1)) { return SIZE_MAX; }
+  (*path)[len] = '\0';
+  size_t end = len;
+  for (uint32_t i = id; i != NO_ENTRY; i = index->entries[i].parent) {
+    Entry *entry = &index->entries[i];
+    if (i != id) { (*path)[--end] = PATHSEP; }
+    end -= entry->name_len;
+    memcpy(*path + end, index->names + entry->name, entry->name_len);
+  }
+  return len;
+}
+
+
+/* Finds the entry of a path, or NO_ENTRY. */
+static uint32_t find_path(FileIndex *index, const char *path, size_t len) {
+  Entry *root = &index->entries[0];
+  if (len < root->name_len || memcmp(path, index->names + root->name, root->name_len) != 0) {
+    return NO_ENTRY;
+  }
+  uint32_t id = 0;
+  size_t i = root->name_len;
+  if (i < len && path[i] != PATHSEP) { return NO_ENTRY; }
+  while (i < len && id != NO_ENTRY) {
+    size_t start = i + 1, end = start;
+    while (end < len && path[end] != PATHSEP) { end++; }
+    if (end > start) { id = find_child(index, id, path + start, end - start); }
+    i = end;
+  }
+  return id;
+}
+
+
+typedef struct {
+  const IgnoreRule *rule;
+  const char *text;
+  size_t len;
+  bool matched;
+} RuleMatch;
+
+static int f_match_rule(lua_State *L) {
+  RuleMatch *m = lua_touserdata(L, 1);
+  const char *captures[MAX_CAPTURES], *end;
+  int n_captures;
+  m->matched = utf8_pattern_find(L, m->text, m->text + m->len, m->text, m->rule->pattern,
+                                 m->rule->pattern + m->rule->len, m->rule->anchored, &end,
+                                 captures, &n_captures) != NULL;
+  return 0;
+}
+
+
+/* Like string.find, a pattern raising an error doesn't match. */
+static bool match_rule(lua_State *L, const IgnoreRule *rule, const char *text, size_t len) {
+  RuleMatch m = { rule, text, len, false };
+  lua_pushcfunction(L, f_match_rule);
+  lua_pushlightuserdata(L, &m);
+  if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+    lua_pop(L, 1);
+    return false;
+  }
+  return m.matched;
+}
+
+
+/* Applies the same rules as Project:get_file_info to an entry of the listed
+** directory. Directories that pass are only scanned if their name also
+** doesn't match any pattern, like Project:files() does. */
+static bool is_ignored(Listing *listing, Listed *listed, const char *name) {
+  FileIndex *index = listing->index;
+  if (listed->size >= index->size_limit) { return true; }
+  /* paths are matched from a '/' and with '/' as separators, and the names of
+  ** directories with a '/' at the end */
+  size_t full_len = listing->path_len + listed->name_len + 2;
+  if (!try_grow((void**) &listing->scratch, &listing->scratch_capacity, full_len + listed->name_len + 2, 1)) {
+    listing->failed = true;
+    return true;
+  }
+  char *full = listing->scratch;
+  full[0] = '/';
+  for (size_t i = 0; i < listing->path_len; i++) {
+    full[i + 1] = listing->path[i] == '\\' ? '/' : listing->path[i];
+  }
+  full[listing->path_len + 1] = '/';
+  memcpy(full + listing->path_len + 2, name, listed->name_len);
+  full[full_len] = '/';
+  char *base = full + full_len + 1;
+  memcpy(base, name, listed->name_len);
+  base[listed->name_len] = '/';
+  bool dir = listed->type == ENTRY_DIR;
+  for (size_t r = 0; r < index->n_rules; r++) {
+    const IgnoreRule *rule = &index->rules[r];
+    if (rule->match_dir && !dir) { continue; }
+    const char *test = rule->use_path ? full : base;
+    size_t len = rule->use_path ? full_len : listed->name_len;
+    if (match_rule(listing->L, rule, test, len + rule->match_dir)) { return true; }
+  }
+  listed->descend = dir;
+  for (size_t r = 0; r < index->n_rules && listed->descend; r++) {
+    if (match_rule(listing->L, &index->rules[r], base, listed->name_len)) { listed->descend = false; }
+  }
+  return false;
+}
+
+
+static void add_listed(Listing *listing, const char *name, Listed *listed) {
+  listed->name_len = strlen(name);
+  if (is_ignored(listing, listed, name)) { return; }
+  if (!try_grow((void**) &listing->names, &listing->names_capacity, listing->names_len + listed->name_len, 1)
+      || !try_grow((void**) &listing->items, &listing->items_capacity, listing->n_items + 1, sizeof(Listed))) {
+    listing->failed = true;
+    return;
+  }
+  memcpy(listing->names + listing->names_len, name, listed->name_len);
+  listed->name = listing->names_len;
+  listing->names_len += listed->name_len;
+  listing->items[listing->n_items++] = *listed;
+}
+
+
+#ifdef _WIN32
+static bool get_modified(const char *path, int64_t *modified) {
+  SDL_PathInfo info;
+  if (!SDL_GetPathInfo(path, &info)) { return false; }
+  *modified = info.modify_time;
+  return true;
+}
+
+
+static SDL_EnumerationResult list_callback(void *userdata, const char *dirname, const char *fname) {
+  (void) dirname;
+  Listing *listing = userdata;
+  size_t name_len = strlen(fname);
+  if (!try_grow((void**) &listing->path, &listing->path_capacity, listing->path_len + name_len + 2, 1)) {
+    listing->failed = true;
+    return SDL_ENUM_FAILURE;
+  }
+  char *path = listing->path;
+  path[listing->path_len] = PATHSEP;
+  memcpy(path + listing->path_len + 1, fname, name_len + 1);
+  SDL_PathInfo info;
+  bool ok = SDL_GetPathInfo(path, &info);
+  path[listing->path_len] = '\0';
+  if (ok && (info.type == SDL_PATHTYPE_FILE || info.type == SDL_PATHTYPE_DIRECTORY)) {
+    Listed listed = {
+      .type = info.type == SDL_PATHTYPE_DIRECTORY ? ENTRY_DIR : ENTRY_FILE,
+      .size = info.size, .modified = info.modify_time
+    };
+    add_listed(listing, fname, &listed);
+  }
+  return listing->failed ? SDL_ENUM_FAILURE : SDL_ENUM_CONTINUE;
+}
+
+
+/* Lists the entries of listing->path that aren't ignored. The id of the
+** directory is unknown here, 0. */
+static bool list_directory(Listing *listing, int64_t *modified, uint64_t *file_id) {
+  *file_id = 0;
+  return get_modified(listing->path, modified)
+      && SDL_EnumerateDirectory(listing->path, list_callback, listing);
+}
+#else
+#ifdef __APPLE__
+  #define MODIFIED_NS(st) ((int64_t) (st).st_mtimespec.tv_sec * 1000000000 + (st).st_mtimespec.tv_nsec)
+#else
+  #define MODIFIED_NS(st) ((int64_t) (st).st_mtim.tv_sec * 1000000000 + (st).st_mtim.tv_nsec)
+#endif
+
+static bool get_modified(const char *path, int64_t *modified) {
+  struct stat st;
+  if (stat(path, &st) != 0) { return false; }
+  *modified = MODIFIED_NS(st);
+  return true;
+}
+
+
+/* Lists the entries of listing->path that aren't ignored, and gets an id of
+** the directory from its device and inode. */
+static bool list_directory(Listing *listing, int64_t *modified, uint64_t *file_id) {
+  int fd = open(listing->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) { return false; }
+  struct stat st;
+  DIR *dir = fstat(fd, &st) == 0 ? fdopendir(fd) : NULL;
+  if (!dir) {
+    close(fd);
+    return false;
+  }
+  *modified = MODIFIED_NS(st);
+  *file_id = (uint64_t) st.st_dev << 40 ^ (uint64_t) st.st_ino;
+  if (*file_id == 0) { *file_id = 1; }
+  struct dirent *de;
+  while (!listing->failed && (de = readdir(dir))) {
+    const char *name = de->d_name;
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) { continue; }
+    Listed listed = { .type = ENTRY_DIR };
+    /* directories get their modification time when they're scanned, files
+    ** need their size, and links are followed */
+  #ifdef DT_DIR
+    if (de->d_type != DT_DIR)
+  #endif
+    {
+      if (fstatat(fd, name, &st, 0) != 0) { continue; }
+      if (S_ISREG(st.st_mode)) {
+        listed.type = ENTRY_FILE;
+        listed.size = st.st_size;
+        listed.modified = MODIFIED_NS(st);
+      } else if (!S_ISDIR(st.st_mode)) {
+        continue;
+      }
+    }
+    add_listed(listing, name, &listed);
+  }
+  closedir(dir);
+  return true;
+}
+#endif
+
+
+/* Lists a directory and merges its entries in the index, queueing the
+** directories that weren't indexed yet. */
+static void scan_directory(Listing *listing, uint32_t id) {
+  FileIndex *index = listing->index;
+  SDL_LockMutex(index->lock);
+  Entry *entry = &index->entries[id];
+  bool valid = entry->type == ENTRY_DIR;
+  bool check = entry->check;
+  int64_t scanned_modified = entry->modified;
+  entry->check = false;
+  if (valid) {
+    listing->path_len = get_path(index, id, &listing->path, &listing->path_capacity);
+    if (listing->path_len == SIZE_MAX) {
+      fail(index);
+      valid = false;
+    }
+  }
+  SDL_UnlockMutex(index->lock);
+  if (!valid) { return; }
+
+  int64_t modified;
+  uint64_t file_id;
+  if (check && get_modified(listing->path, &modified) && modified == scanned_modified) { return; }
+  listing->n_items = listing->names_len = 0;
+  listing->failed = false;
+  bool listed = list_directory(listing, &modified, &file_id);
+  if (listing->failed) {
+    SDL_LockMutex(index->lock);
+    fail(index);
+    SDL_UnlockMutex(index->lock);
+  }
+  if (!listed || listing->failed) { return; }
+
+  SDL_LockMutex(index->lock);
+  Entry *dir = &index->entries[id];
+  size_t n_queue = index->n_queue;
+  if (dir->type == ENTRY_DIR) {
+    uint32_t stamp = ++index->stamp;
+    dir->scanned = true;
+    dir->modified = modified;
+    dir->file_id = file_id;
+    /* a linked directory that is also one of its parents is left empty */
+    for (uint32_t parent = dir->parent; file_id && parent != NO_ENTRY; parent = index->entries[parent].parent) {
+      if (index->entries[parent].file_id == file_id) {
+        listing->n_items = 0;
+        break;
+      }
+    }
+    size_t i = 0;
+    for (; i < listing->n_items; i++) {
+      Listed *listed = &listing->items[i];
+      const char *name = listing->names + listed->name;
+      uint32_t child = find_child(index, id, name, listed->name_len);
+      if (child != NO_ENTRY && index->entries[child].type != listed->type) {
+        remove_entry(index, child);
+        child = NO_ENTRY;
+      }
+      if (child == NO_ENTRY) {
+        if (!try_grow((void**) &index->queue, &index->queue_capacity, index->n_queue + 1, sizeof(uint32_t))
+            || (child = add_entry(index, id, name, listed->name_len, listed)) == NO_ENTRY) {
+          break;
+        }
+        if (listed->descend && index->entries[child].depth < MAX_SCAN_DEPTH) {
+          index->queue[index->n_queue++] = child;
+        }
+      } else {
+        Entry *entry = &index->entries[child];
+        if (entry->type == ENTRY_FILE) {
+          entry->size = listed->size;
+          entry->modified = listed->modified;
+        }
+        entry->descend = listed->descend;
+      }
+      index->entries[child].stamp = stamp;
+    }
+    dir = &index->entries[id];
+    if (i < listing->n_items) {
+      /* the entries not merged yet are kept, and the directory is taken as
+      ** modified so that it's listed directly and checked again */
+      dir->modified = 0;
+      fail(index);
+    } else {
+      for (uint32_t child = dir->first_child; child != NO_ENTRY;) {
+        uint32_t next = index->entries[child].next_sibling;
+        if (index->entries[child].stamp != stamp) { remove_entry(index, child); }
+        child = next;
+      }
+    }
+    index->changed = true;
+  }
+  if (index->n_queue > n_queue) { SDL_BroadcastCondition(index->wake); }
+  SDL_UnlockMutex(index->lock);
+}
+
+
+static void notify(void) {
+  CustomEvent event;
+  SDL_zero(event);
+  push_custom_event("fileindex", &event);
+}
+
+
+static int index_thread(void *data) {
+  FileIndex *index = data;
+  Listing listing = { .index = index, .L = luaL_newstate() };
+  SDL_LockMutex(index->lock);
+  if (!listing.L) {
+    fail(index);
+    SDL_UnlockMutex(index->lock);
+    return 0;
+  }
+  for (;;) {
+    while (!index->quit && index->n_queue == 0) {
+      if (index->busy == 0 && index->n_removed * 2 > index->n_entries) { compact(index); }
+      /* the last thread to run out of directories reports the scan */
+      if (index->busy == 0 && index->changed) {
+        index->ready = true;
+        index->changed = false;
+        notify();
+      }
+      SDL_WaitCondition(index->wake, index->lock);
+    }
+    if (index->quit) { break; }
+    uint32_t id = index->queue[--index->n_queue];
+    index->busy++;
+    SDL_UnlockMutex(index->lock);
+    scan_directory(&listing, id);
+    SDL_LockMutex(index->lock);
+    index->busy--;
+  }
+  SDL_UnlockMutex(index->lock);
+  lua_close(listing.L);
+  SDL_free(listing.items);
+  SDL_free(listing.names);
+  SDL_free(listing.path);
+  SDL_free(listing.scratch);
+  return 0;
+}
+
+
+static FileIndex* check_index(lua_State *L, int idx) {
+  FileIndex **index = luaL_checkudata(L, idx, API_TYPE_FILEINDEX);
+  luaL_argcheck(L, *index != NULL, idx, "index was freed");
+  return *index;
+}
+
+
+static void free_index(FileIndex *index) {
+  if (index->n_threads > 0) {
+    SDL_LockMutex(index->lock);
+    index->quit = true;
+    SDL_BroadcastCondition(index->wake);
+    SDL_UnlockMutex(index->lock);
+    for (int i = 0; i < index->n_threads; i++) { SDL_WaitThread(index->threads[i], NULL); }
+  }
+  for (size_t i = 0; i < index->n_rules; i++) { SDL_free(index->rules[i].pattern); }
+  SDL_free(index->rules);
+  SDL_free(index->queue);
+  SDL_free(index->entries);
+  SDL_free(index->names);
+  SDL_free(index->slots);
+  SDL_free(index->remap);
+  SDL_DestroyCondition(index->wake);
+  SDL_DestroyMutex(index->lock);
+  SDL_free(index);
+}
+
+
+static int f_fileindex_new(lua_State *L) {
+  size_t root_len;
+  const char *root = luaL_checklstring(L, 1, &root_len);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_Number size_limit = luaL_optnumber(L, 3, HUGE_VAL);
+  while (root_len > 1 && root[root_len - 1] == PATHSEP) { root_len--; }
+
+  FileIndex **ud = lua_newuserdatauv(L, sizeof(FileIndex*), 0);
+  *ud = NULL;
+  luaL_setmetatable(L, API_TYPE_FILEINDEX);
+  FileIndex *index = check_alloc(SDL_calloc(1, sizeof(FileIndex)));
+  *ud = index;
+  index->generation = 1;
+  index->size_limit = size_limit >= 1.8e19 ? UINT64_MAX : (size_limit > 0 ? (uint64_t) size_limit : 0);
+
+  size_t n_rules = luaL_len(L, 2);
+  index->rules = check_alloc(SDL_calloc(n_rules > 0 ? n_rules : 1, sizeof(IgnoreRule)));
+  for (size_t i = 0; i < n_rules; i++) {
+    if (lua_rawgeti(L, 2, i + 1) != LUA_TTABLE) {
+      lua_pop(L, 1);
+      continue;
+    }
+    IgnoreRule *rule = &index->rules[index->n_rules];
+    size_t len;
+    lua_getfield(L, -1, "pattern");
+    const char *pattern = lua_tolstring(L, -1, &len);
+    if (pattern) {
+      rule->anchored = len > 0 && pattern[0] == '^';
+      rule->pattern = check_alloc(SDL_malloc(len + 1));
+      memcpy(rule->pattern, pattern + rule->anchored, len - rule->anchored + 1);
+      rule->len = len - rule->anchored;
+      lua_getfield(L, -2, "use_path");
+      rule->use_path = lua_toboolean(L, -1);
+      lua_getfield(L, -3, "match_dir");
+      rule->match_dir = lua_toboolean(L, -1);
+      lua_pop(L, 2);
+      index->n_rules++;
+    }
+    lua_pop(L, 2);
+  }
+
+  Listed root_entry = { .type = ENTRY_DIR, .descend = true };
+  add_entry(index, NO_ENTRY, root, root_len, &root_entry);
+  grow((void**) &index->queue, &index->queue_capacity, 1, sizeof(uint32_t));
+  index->queue[index->n_queue++] = 0;
+  /* reported as ready even if the root can't be listed */
+  index->changed = true;
+  index->lock = SDL_CreateMutex();
+  index->wake = SDL_CreateCondition();
+  if (index->lock && index->wake) {
+    int n_threads = SDL_clamp(SDL_GetNumLogicalCPUCores(), 2, MAX_SCAN_THREADS);
+    for (int i = 0; i < n_threads; i++) {
+      SDL_Thread *thread = SDL_CreateThread(index_thread, "fileindex", index);
+      if (!thread) { break; }
+      index->threads[index->n_threads++] = thread;
+    }
+  }
+  if (index->n_threads == 0) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "unable to start the indexing threads: %s", SDL_GetError());
+    free_index(index);
+    *ud = NULL;
+    return 2;
+  }
+  return 1;
+}
+
+
+static int f_fileindex_close(lua_State *L) {
+  FileIndex **index = luaL_checkudata(L, 1, API_TYPE_FILEINDEX);
+  if (*index) { free_index(*index); }
+  *index = NULL;
+  return 0;
+}
+
+
+static int f_fileindex_status(lua_State *L) {
+  FileIndex *index = check_index(L, 1);
+  SDL_LockMutex(index->lock);
+  bool ready = index->ready;
+  size_t n_files = index->n_files;
+  uint32_t scans = index->stamp;
+  const char *error = index->error;
+  SDL_UnlockMutex(index->lock);
+  lua_pushboolean(L, ready);
+  lua_pushinteger(L, n_files);
+  lua_pushinteger(L, scans);
+  if (error) { lua_pushstring(L, error); } else { lua_pushnil(L); }
+  return 4;
+}
+
+
+static void push_info(lua_State *L, uint8_t type, uint64_t size, int64_t modified) {
+  lua_pushstring(L, type == ENTRY_DIR ? "dir" : "file");
+  lua_setfield(L, -2, "type");
+  lua_pushinteger(L, size);
+  lua_setfield(L, -2, "size");
+  lua_pushnumber(L, modified / 1e9);
+  lua_setfield(L, -2, "modified");
+}
+
+
+/* An entry copied out of the index, so that Lua values are only created
+** once the lock is released. */
+typedef struct {
+  size_t text, len;
+  uint8_t type;
+  uint64_t size;
+  int64_t modified;
+} Copied;
+
+static int push_copied(lua_State *L, Copied *copied, size_t n, char *text, const char *field) {
+  lua_createtable(L, n, 0);
+  for (size_t i = 0; i < n; i++) {
+    lua_createtable(L, 0, 4);
+    lua_pushlstring(L, text + copied[i].text, copied[i].len);
+    lua_setfield(L, -2, field);
+    push_info(L, copied[i].type, copied[i].size, copied[i].modified);
+    lua_rawseti(L, -2, i + 1);
+  }
+  SDL_free(copied);
+  SDL_free(text);
+  return 1;
+}
+
+
+/* Returns up to `n` entries of a type from `cursor`, and the cursor to continue
+** from, or nil at the end. */
+static int get_entries(lua_State *L, uint8_t type) {
+  FileIndex *index = check_index(L, 1);
+  lua_Integer cursor = luaL_checkinteger(L, 2);
+  lua_Integer n = luaL_optinteger(L, 3, 1000);
+  luaL_argcheck(L, cursor >= 1 && (cursor & 0xFFFFFFFF) != 0, 2, "cursor out of range");
+  luaL_argcheck(L, n >= 1, 3, "count out of range");
+  if (n > MAX_CHUNK) { n = MAX_CHUNK; }
+  Copied *copied = check_alloc(SDL_malloc(sizeof(Copied) * n));
+  char *text = NULL, *path = NULL;
+  size_t n_copied = 0, text_len = 0, text_capacity = 0, path_capacity = 0;
+
+  /* the id to continue from is in the low bits, and the generation it's
+  ** from in the high bits, 0 in a cursor starting from an id */
+  uint32_t generation = (uint64_t) cursor >> 32;
+  size_t id = ((uint64_t) cursor & 0xFFFFFFFF) - 1;
+  SDL_LockMutex(index->lock);
+  if (generation != 0 && generation != index->generation) {
+    if (generation + 1 != index->generation || !index->remap) {
+      SDL_UnlockMutex(index->lock);
+      SDL_free(copied);
+      return luaL_argerror(L, 2, "cursor out of date, the index was compacted twice since");
+    }
+    id = index->remap[id < index->remap_len ? id : index->remap_len - 1];
+  }
+  for (; id < index->n_entries && n_copied < (size_t) n; id++) {
+    Entry *entry = &index->entries[id];
+    if (entry->type != type || id == 0) { continue; }
+    size_t len = get_path(index, id, &path, &path_capacity);
+    if (len == SIZE_MAX) { check_alloc(NULL); }
+    grow((void**) &text, &text_capacity, text_len + len, 1);
+    memcpy(text + text_len, path, len);
+    copied[n_copied++] = (Copied) { text_len, len, entry->type, entry->size, entry->modified };
+    text_len += len;
+  }
+  bool more = id < index->n_entries;
+  generation = index->generation;
+  SDL_UnlockMutex(index->lock);
+
+  SDL_free(path);
+  push_copied(L, copied, n_copied, text, "filename");
+  if (more) { lua_pushinteger(L, (lua_Integer) ((uint64_t) generation << 32 | (id + 1))); } else { lua_pushnil(L); }
+  return 2;
+}
+
+
+static int f_fileindex_files(lua_State *L) {
+  return get_entries(L, ENTRY_FILE);
+}
+
+
+static int f_fileindex_directories(lua_State *L) {
+  return get_entries(L, ENTRY_DIR);
+}
+
+
+static int f_fileindex_list(lua_State *L) {
+  FileIndex *index = check_index(L, 1);
+  size_t len;
+  const char *path = luaL_checklstring(L, 2, &len);
+  while (len > 1 && path[len - 1] == PATHSEP) { len--; }
+  int64_t modified;
+  if (!get_modified(path, &modified)) { return 0; }
+
+  SDL_LockMutex(index->lock);
+  uint32_t id = find_path(index, path, len);
+  Entry *dir = id != NO_ENTRY ? &index->entries[id] : NULL;
+  /* directories changed since they were scanned are rescanned, and are to be
+  ** listed directly meanwhile */
+  if (!dir || dir->type != ENTRY_DIR || !dir->scanned || dir->modified != modified) {
+    SDL_UnlockMutex(index->lock);
+    return 0;
+  }
+  size_t n = 0, text_len = 0, text_capacity = 0;
+  for (uint32_t child = dir->first_child; child != NO_ENTRY; child = index->entries[child].next_sibling) { n++; }
+  Copied *copied = check_alloc(SDL_malloc(sizeof(Copied) * (n > 0 ? n : 1)));
+  char *text = NULL;
+  n = 0;
+  for (uint32_t child = dir->first_child; child != NO_ENTRY; child = index->entries[child].next_sibling) {
+    Entry *entry = &index->entries[child];
+    grow((void**) &text, &text_capacity, text_len + entry->name_len, 1);
+    memcpy(text + text_len, index->names + entry->name, entry->name_len);
+    copied[n++] = (Copied) { text_len, entry->name_len, entry->type, entry->size, entry->modified };
+    text_len += entry->name_len;
+  }
+  SDL_UnlockMutex(index->lock);
+  return push_copied(L, copied, n, text, "name");
+}
+
+
+static int f_fileindex_refresh(lua_State *L) {
+  FileIndex *index = check_index(L, 1);
+  if (lua_isnoneornil(L, 2)) {
+    SDL_LockMutex(index->lock);
+    /* checked only between scans, so that checks don't pile up */
+    if (index->ready && index->n_queue == 0 && index->busy == 0) {
+      for (size_t id = 0; id < index->n_entries; id++) {
+        Entry *entry = &index->entries[id];
+        if (entry->type != ENTRY_DIR || !entry->scanned) { continue; }
+        entry->check = true;
+        grow((void**) &index->queue, &index->queue_capacity, index->n_queue + 1, sizeof(uint32_t));
+        index->queue[index->n_queue++] = id;
+      }
+      SDL_BroadcastCondition(index->wake);
+    }
+    SDL_UnlockMutex(index->lock);
+    return 0;
+  }
+  size_t len;
+  const char *path = luaL_checklstring(L, 2, &len);
+  while (len > 1 && path[len - 1] == PATHSEP) { len--; }
+  SDL_LockMutex(index->lock);
+  /* the parent of a path that isn't indexed is rescanned instead */
+  uint32_t id = find_path(index, path, len);
+  while (id == NO_ENTRY && len > 0) {
+    while (len > 0 && path[len - 1] != PATHSEP) { len--; }
+    if (len > 0) { len--; }
+    id = find_path(index, path, len);
+  }
+  if (id != NO_ENTRY && index->entries[id].type == ENTRY_DIR) {
+    index->entries[id].check = false;
+    grow((void**) &index->queue, &index->queue_capacity, index->n_queue + 1, sizeof(uint32_t));
+    index->queue[index->n_queue++] = id;
+    SDL_SignalCondition(index->wake);
+  }
+  SDL_UnlockMutex(index->lock);
+  return 0;
+}
+
+
+static const luaL_Reg fileindex_lib[] = {
+  { "new",         f_fileindex_new         },
+  { "__gc",        f_fileindex_close       },
+  { "close",       f_fileindex_close       },
+  { "status",      f_fileindex_status      },
+  { "files",       f_fileindex_files       },
+  { "directories", f_fileindex_directories },
+  { "list",        f_fileindex_list        },
+  { "refresh",     f_fileindex_refresh     },
+  { NULL, NULL }
+};
+
+
+int luaopen_fileindex(lua_State *L) {
+  if (!register_custom_event("fileindex", NULL)) {
+    return luaL_error(L, "Unable to register custom fileindex event: %s", SDL_GetError());
+  }
+  luaL_newmetatable(L, API_TYPE_FILEINDEX);
+  luaL_setfuncs(L, fileindex_lib, 0);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  return 1;
+}
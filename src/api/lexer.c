@@ -0,0 +1,1419 @@
+#include "alloc.h"
+#include "api.h"
+#include "custom_events.h"
+
+#define PCRE2_CODE_UNIT_WIDTH 8
+
+#include <SDL3/SDL.h>
+#include <ctype.h>
+#include <pcre2.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Native implementation of the tokenizer of core.tokenizer. Syntaxes are
+** compiled once, with every subsyntax they reference, into arrays of patterns
+** with their regexes compiled and their token types and symbols interned, so
+** that tokenizing a line doesn't need to go back to the syntax tables.
+**
+** The algorithm and the results are the same as the Lua tokenizer it
+** replaces, down to the format of the state strings, but positions are byte
+** offsets rather than character indices.
+**
+** Each syntax also gets a table of the patterns that can match from each
+** byte, derived from the first item of their code, so that the patterns
+** that can't match at a position aren't tried there.
+**
+** Lines can also be tokenized in the background by highlight jobs, which go
+** through a snapshot of a buffer in a worker thread shared by all jobs, see
+** below. */
+
+#define MAX_CAPTURES 32 /* LUA_MAXCAPTURES in utf8.c */
+#define MAX_DEPTH 255   /* subsyntaxes in a state */
+#define TIME_CHECK_INTERVAL 200
+
+#define TYPE_NORMAL 0
+#define TYPE_INCOMPLETE 1
+
+/* indexes in the uservalue of a lexer */
+enum { UV_TYPES = 1, UV_TYPE_IDS, UV_SYNTAXES, UV_REPORT, UV_COUNT = UV_REPORT };
+
+typedef struct {
+  bool disabled;
+  bool regex;
+  bool pair;        /* a { open, close, escape } pattern */
+  bool type_is_table;
+  bool whole_line[2];
+  char *code[2];    /* open and close patterns, the same if not a pair */
+  size_t code_len[2];
+  pcre2_code *re[2];
+  char *escape;     /* escape character of a pair */
+  size_t escape_len;
+  int *types;
+  int n_types;
+  int syntax;       /* subsyntax, or -1 */
+  uint8_t reported; /* bad pattern reports already made */
+  bool any_first;    /* the first byte of a match can't be told */
+  uint8_t first[32]; /* bit set of the bytes a match can start with */
+} Pattern;
+
+typedef struct {
+  char *text;
+  size_t len;
+  int type;
+} Symbol;
+
+typedef struct {
+  Pattern *patterns;
+  int n_patterns;
+  Symbol *symbols; /* open addressing, a power of two of slots */
+  size_t symbols_capacity;
+  /* the patterns to try at a byte c, in order, are candidates[starts[c]] up
+  ** to candidates[starts[c + 1]], and those to try at the end of the line
+  ** are at c = 256 */
+  int *candidates;
+  size_t candidates_start[258];
+} Syntax;
+
+typedef struct {
+  int type;
+  size_t start, end;
+  bool space;
+} Token;
+
+typedef struct {
+  Syntax *syntaxes;
+  int n_syntaxes;
+  int max_captures;
+  pcre2_match_data *match_data;
+  /* kept between calls so that nothing leaks when a pattern raises an error */
+  Token *tokens;
+  size_t n_tokens, tokens_capacity;
+} Lexer;
+
+struct HighlightJob;
+
+/* The state of the tokenizer while going through a line. */
+typedef struct {
+  lua_State *L;
+  Lexer *lexer;
+  struct HighlightJob *job; /* set in the worker thread */
+  int uservalue;     /* stack index of the uservalue of the lexer */
+  const char *text;
+  size_t len;
+  char state[MAX_DEPTH + 1];
+  size_t state_len;
+  int syntax;        /* current syntax */
+  Pattern *sub;      /* pattern of the parent syntax that entered the current
+                     ** syntax, or NULL */
+  int pattern;       /* pattern of the current syntax we're in, 1-based, or 0 */
+  size_t level;      /* 1-based position in the state of `pattern` */
+} Context;
+
+/* A match of a pattern, in byte offsets. */
+typedef struct {
+  size_t start, end;
+  size_t captures[MAX_CAPTURES];
+  int n_captures;
+} Match;
+
+enum { REPORT_EMPTY = 1, REPORT_TYPE_TABLE = 2, REPORT_NOT_ENOUGH_TYPES = 4, REPORT_TOO_MANY_TYPES = 8 };
+
+/* A bad pattern found in the worker thread, reported when the results of the
+** job are collected. */
+typedef struct {
+  int syntax, pattern, report, n_types, n_results;
+} JobReport;
+
+/* A line tokenized by a job, allocated in one block with its tokens, text
+** and end state. */
+typedef struct {
+  Token *tokens;
+  size_t n_tokens;
+  char *text;
+  size_t len;
+  char *state;
+  size_t state_len;
+} LineResult;
+
+/* Tokenizes the lines of a buffer snapshot in the worker thread, from a line
+** and a state up to `end`, which can be moved forward. */
+typedef struct HighlightJob {
+  Lexer *lexer; /* not used by the main thread, see f_lexer_highlight */
+  BufferLines *lines;
+  lua_Integer id;
+  SDL_AtomicInt cancelled;
+  /* only used by the worker */
+  char state[MAX_DEPTH + 1];
+  size_t state_len;
+  char *text;
+  size_t text_capacity;
+  /* guarded by the lock of the worker */
+  size_t line, end; /* 0-based, end is exclusive */
+  bool queued, finished, notified;
+  struct HighlightJob *next;
+  LineResult **results;
+  size_t results_line, n_results, results_capacity;
+  JobReport *reports;
+  size_t n_reports, reports_capacity;
+  char *error;
+} HighlightJob;
+
+/* The worker thread, started with the first job and stopped with the module. */
+static struct {
+  SDL_Thread *thread;
+  SDL_Mutex *lock;
+  SDL_Condition *wake; /* a job was queued, or the worker is to quit */
+  SDL_Condition *idle; /* the job being run was put down */
+  HighlightJob *first, *last, *current;
+  bool quit;
+} worker;
+
+
+static uint64_t hash_string(const char *text, size_t len) {
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (unsigned char) text[i]) * 1099511628211ull;
+  }
+  return h;
+}
+
+
+static char* copy_string(const char *text, size_t len) {
+  char *copy = check_alloc(SDL_malloc(len + 1));
+  memcpy(copy, text, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+
+/* Returns the id of the token type at the top of the stack, and pops it. */
+static int intern_type(lua_State *L, int lexer_idx) {
+  lua_getiuservalue(L, lexer_idx, 1);
+  lua_rawgeti(L, -1, UV_TYPE_IDS);
+  lua_pushvalue(L, -3);
+  lua_rawget(L, -2);
+  int id;
+  if (lua_isinteger(L, -1)) {
+    id = lua_tointeger(L, -1);
+  } else {
+    lua_rawgeti(L, -3, UV_TYPES);
+    id = luaL_len(L, -1);
+    lua_pushvalue(L, -5);
+    lua_rawseti(L, -2, id + 1);
+    lua_pushvalue(L, -5);
+    lua_pushinteger(L, id);
+    lua_rawset(L, -5);
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 4);
+  return id;
+}
+
+
+static const Symbol* find_symbol(const Syntax *syntax, const char *text, size_t len) {
+  if (syntax->symbols_capacity == 0) { return NULL; }
+  size_t mask = syntax->symbols_capacity - 1;
+  for (size_t i = hash_string(text, len) & mask;; i = (i + 1) & mask) {
+    const Symbol *symbol = &syntax->symbols[i];
+    if (!symbol->text) { return NULL; }
+    if (symbol->len == len && memcmp(symbol->text, text, len) == 0) { return symbol; }
+  }
+}
+
+
+static void compile_symbols(lua_State *L, int lexer_idx, Syntax *syntax) {
+  size_t n = 0;
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {
+    if (lua_type(L, -2) == LUA_TSTRING && lua_type(L, -1) == LUA_TSTRING) { n++; }
+    lua_pop(L, 1);
+  }
+  if (n == 0) { return; }
+  size_t capacity = 8;
+  while (capacity < n * 2) { capacity *= 2; }
+  syntax->symbols = check_alloc(SDL_calloc(capacity, sizeof(Symbol)));
+  syntax->symbols_capacity = capacity;
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {
+    if (lua_type(L, -2) == LUA_TSTRING && lua_type(L, -1) == LUA_TSTRING) {
+      size_t len;
+      const char *text = lua_tolstring(L, -2, &len);
+      size_t i = hash_string(text, len) & (capacity - 1);
+      while (syntax->symbols[i].text) { i = (i + 1) & (capacity - 1); }
+      syntax->symbols[i].text = copy_string(text, len);
+      syntax->symbols[i].len = len;
+      syntax->symbols[i].type = intern_type(L, lexer_idx);
+    } else {
+      lua_pop(L, 1);
+    }
+  }
+}
+
+
+/* Compiles the code of a pattern at the top of the stack, without popping
+** it. Returns false if the pattern can't be used. */
+static bool compile_code(lua_State *L, Lexer *lexer, Pattern *pattern, int i) {
+  size_t len;
+  const char *code = lua_tolstring(L, -1, &len);
+  if (!code) { return false; }
+  /* patterns starting with '^' only match at the start of the line */
+  pattern->whole_line[i] = len > 0 && code[0] == '^';
+  if (pattern->whole_line[i]) {
+    code++;
+    len--;
+  }
+  pattern->code[i] = copy_string(code, len);
+  pattern->code_len[i] = len;
+  if (pattern->regex) {
+    int error;
+    PCRE2_SIZE error_offset;
+    pattern->re[i] = pcre2_compile((PCRE2_SPTR) code, len, PCRE2_UTF, &error, &error_offset, NULL);
+    if (!pattern->re[i]) { return false; }
+    pcre2_jit_compile(pattern->re[i], PCRE2_JIT_COMPLETE);
+    uint32_t captures;
+    pcre2_pattern_info(pattern->re[i], PCRE2_INFO_CAPTURECOUNT, &captures);
+    if ((int) captures + 1 > lexer->max_captures) { lexer->max_captures = captures + 1; }
+  }
+  return true;
+}
+
+
+static void add_byte(uint8_t *set, unsigned char c) {
+  set[c >> 3] |= 1 << (c & 7);
+}
+
+
+static bool has_byte(const uint8_t *set, unsigned char c) {
+  return set[c >> 3] & (1 << (c & 7));
+}
+
+
+static void add_bytes(uint8_t *set, int from, int to) {
+  for (int c = from; c <= to; c++) { add_byte(set, c); }
+}
+
+
+/* Adds the bytes a character of a %-class can start with. Non ASCII
+** characters are matched with their unicode properties, so any lead byte
+** is added for them. Returns false for unknown classes. */
+static bool add_class(uint8_t *set, char class) {
+  int (*is_class)(int);
+  switch (tolower((unsigned char) class)) {
+    case 'a': is_class = isalpha; break;
+    case 'c': is_class = iscntrl; break;
+    case 'd': is_class = isdigit; break;
+    case 'g': is_class = isgraph; break;
+    case 'l': is_class = islower; break;
+    case 'p': is_class = ispunct; break;
+    case 's': is_class = isspace; break;
+    case 'u': is_class = isupper; break;
+    case 'w': is_class = isalnum; break;
+    case 'x': is_class = isxdigit; break;
+    default: return false;
+  }
+  bool complement = isupper((unsigned char) class);
+  for (int c = 0; c < 0x80; c++) {
+    if (!is_class(c) == complement) { add_byte(set, c); }
+  }
+  add_bytes(set, 0x80, 0xFF);
+  return true;
+}
+
+
+/* Adds the bytes a match of a Lua pattern can start with, returns false if
+** they can't be told, which includes patterns that can match nothing. */
+static bool add_pattern_first(uint8_t *set, const char *p, const char *end) {
+  /* captures don't consume anything */
+  while (p < end && *p == '(') {
+    p++;
+    if (p < end && *p == ')') { p++; }
+  }
+  if (p == end || (*p == '$' && p + 1 == end)) { return false; }
+  const char *next;
+  if (*p == '.') {
+    return false;
+  } else if (*p == '%') {
+    if (p + 1 == end) { return false; }
+    char c = p[1];
+    next = p + 2;
+    if (c == 'b') {
+      if (p + 3 >= end) { return false; }
+      add_byte(set, p[2]);
+      return true;
+    } else if (isalpha((unsigned char) c)) {
+      if (!add_class(set, c)) { return false; }
+    } else if (isdigit((unsigned char) c)) {
+      return false;
+    } else {
+      add_byte(set, c);
+    }
+  } else if (*p == '[') {
+    const char *q = p + 1;
+    if (q < end && *q == '^') { return false; }
+    /* a ']' right after the '[' is part of the set */
+    do {
+      if (q >= end) { return false; }
+      if (*q == '%') {
+        if (++q >= end) { return false; }
+        if (isalpha((unsigned char) *q)) {
+          if (!add_class(set, *q)) { return false; }
+        } else {
+          add_byte(set, *q);
+        }
+        q++;
+        continue;
+      }
+      unsigned char from = *q++;
+      while (q < end && (*q & 0xC0) == 0x80) { q++; }
+      if (q + 1 < end && *q == '-' && q[1] != ']') {
+        unsigned char to = q[1];
+        q += 2;
+        while (q < end && (*q & 0xC0) == 0x80) { q++; }
+        if (from < 0x80) { add_bytes(set, from, to < 0x80 ? to : 0x7F); }
+        if (to >= 0x80) { add_bytes(set, from < 0xC0 ? 0xC0 : from, 0xFF); }
+      } else {
+        add_byte(set, from);
+      }
+    } while (q < end && *q != ']');
+    if (q >= end) { return false; }
+    next = q + 1;
+  } else {
+    add_byte(set, *p);
+    next = p + 1;
+    while (next < end && (*next & 0xC0) == 0x80) { next++; }
+  }
+  /* the first item can be skipped */
+  return next == end || (*next != '*' && *next != '-' && *next != '?');
+}
+
+
+static bool add_regex_first(uint8_t *set, const pcre2_code *re) {
+  uint32_t min_length, type;
+  const uint8_t *bitmap;
+  pcre2_pattern_info(re, PCRE2_INFO_MINLENGTH, &min_length);
+  if (min_length == 0) { return false; }
+  pcre2_pattern_info(re, PCRE2_INFO_FIRSTCODETYPE, &type);
+  if (type == 1) {
+    uint32_t unit;
+    pcre2_pattern_info(re, PCRE2_INFO_FIRSTCODEUNIT, &unit);
+    add_byte(set, unit);
+    /* the first code unit can be caseless, where some non ASCII characters
+    ** also match ASCII letters */
+    if (unit < 0x80 && isalpha(unit)) {
+      add_byte(set, tolower(unit));
+      add_byte(set, toupper(unit));
+      add_bytes(set, 0x80, 0xFF);
+    }
+    return true;
+  }
+  if (pcre2_pattern_info(re, PCRE2_INFO_FIRSTBITMAP, &bitmap) == 0 && bitmap) {
+    memcpy(set, bitmap, 32);
+    return true;
+  }
+  return false;
+}
+
+
+static void compile_first(Pattern *pattern) {
+  memset(pattern->first, 0, sizeof(pattern->first));
+  if (pattern->disabled) { return; }
+  bool known = pattern->regex ? add_regex_first(pattern->first, pattern->re[0])
+    : add_pattern_first(pattern->first, pattern->code[0], pattern->code[0] + pattern->code_len[0]);
+  if (!known) {
+    pattern->any_first = true;
+    memset(pattern->first, 0xFF, sizeof(pattern->first));
+  }
+}
+
+
+/* Builds the candidates of a syntax from the first bytes of its patterns.
+** Only the patterns whose first byte isn't known are tried at the end of
+** the line, as the others need a character to match. */
+static void compile_candidates(Syntax *syntax) {
+  size_t count = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    count = 0;
+    for (int c = 0; c <= 256; c++) {
+      syntax->candidates_start[c] = count;
+      for (int n = 0; n < syntax->n_patterns; n++) {
+        const Pattern *pattern = &syntax->patterns[n];
+        bool candidate = c < 256 ? has_byte(pattern->first, c) : pattern->any_first;
+        if (!candidate) { continue; }
+        if (pass == 1) { syntax->candidates[count] = n; }
+        count++;
+      }
+    }
+    syntax->candidates_start[257] = count;
+    if (pass == 0) {
+      syntax->candidates = check_alloc(SDL_malloc(sizeof(int) * (count > 0 ? count : 1)));
+    }
+  }
+}
+
+
+static int compile_syntax(lua_State *L, int lexer_idx, int memo_idx, int resolve_idx);
+
+/* Compiles the pattern at the top of the stack, without popping it. */
+static void compile_pattern(lua_State *L, int lexer_idx, int memo_idx, int resolve_idx, int syntax_id, int n) {
+  Lexer *lexer = lua_touserdata(L, lexer_idx);
+  Pattern *pattern = &lexer->syntaxes[syntax_id].patterns[n];
+  pattern->syntax = -1;
+
+  lua_getfield(L, -1, "disabled");
+  pattern->disabled = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+
+  if (lua_getfield(L, -1, "pattern") == LUA_TNIL) {
+    lua_pop(L, 1);
+    lua_getfield(L, -1, "regex");
+    pattern->regex = true;
+  }
+  if (lua_istable(L, -1)) {
+    pattern->pair = true;
+    for (int i = 0; i < 2; i++) {
+      lua_rawgeti(L, -1, i + 1);
+      if (!compile_code(L, lexer, pattern, i)) { pattern->disabled = true; }
+      lua_pop(L, 1);
+    }
+    lua_rawgeti(L, -1, 3);
+    size_t len;
+    const char *escape = lua_tolstring(L, -1, &len);
+    if (escape && len > 0) {
+      /* only the first character is looked for */
+      size_t char_len = 1;
+      while (char_len < len && (escape[char_len] & 0xC0) == 0x80) { char_len++; }
+      pattern->escape = copy_string(escape, char_len);
+      pattern->escape_len = char_len;
+    }
+    lua_pop(L, 1);
+  } else {
+    if (!compile_code(L, lexer, pattern, 0)) { pattern->disabled = true; }
+  }
+  lua_pop(L, 1);
+  compile_first(pattern);
+
+  lua_getfield(L, -1, "type");
+  pattern->type_is_table = lua_istable(L, -1);
+  pattern->n_types = pattern->type_is_table ? luaL_len(L, -1) : 1;
+  pattern->types = check_alloc(SDL_malloc(sizeof(int) * (pattern->n_types > 0 ? pattern->n_types : 1)));
+  pattern->types[0] = TYPE_NORMAL;
+  for (int i = 0; i < pattern->n_types; i++) {
+    if (pattern->type_is_table) { lua_rawgeti(L, -1, i + 1); } else { lua_pushvalue(L, -1); }
+    if (lua_isstring(L, -1)) {
+      pattern->types[i] = intern_type(L, lexer_idx);
+    } else {
+      pattern->types[i] = TYPE_NORMAL;
+      lua_pop(L, 1);
+    }
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, -1, "syntax");
+  if (!lua_isnil(L, -1) && !lua_istable(L, -1)) {
+    lua_pushvalue(L, resolve_idx);
+    lua_insert(L, -2);
+    lua_call(L, 1, 1);
+  }
+  if (lua_istable(L, -1)) {
+    int sub = compile_syntax(L, lexer_idx, memo_idx, resolve_idx);
+    /* the syntaxes may have moved */
+    lexer = lua_touserdata(L, lexer_idx);
+    lexer->syntaxes[syntax_id].patterns[n].syntax = sub;
+  }
+  lua_pop(L, 1);
+}
+
+
+/* Compiles the syntax at the top of the stack, without popping it, and
+** returns its id. Syntaxes already compiled are looked up in `memo`. */
+static int compile_syntax(lua_State *L, int lexer_idx, int memo_idx, int resolve_idx) {
+  lua_pushvalue(L, -1);
+  if (lua_rawget(L, memo_idx) == LUA_TNUMBER) {
+    int id = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    return id;
+  }
+  lua_pop(L, 1);
+
+  Lexer *lexer = lua_touserdata(L, lexer_idx);
+  int id = lexer->n_syntaxes++;
+  lexer->syntaxes = check_alloc(SDL_realloc(lexer->syntaxes, sizeof(Syntax) * lexer->n_syntaxes));
+  Syntax *syntax = &lexer->syntaxes[id];
+  memset(syntax, 0, sizeof(Syntax));
+  lua_pushvalue(L, -1);
+  lua_pushinteger(L, id);
+  lua_rawset(L, memo_idx);
+  lua_getiuservalue(L, lexer_idx, 1);
+  lua_rawgeti(L, -1, UV_SYNTAXES);
+  lua_pushvalue(L, -3);
+  lua_rawseti(L, -2, id + 1);
+  lua_pop(L, 2);
+
+  if (lua_getfield(L, -1, "symbols") == LUA_TTABLE) {
+    compile_symbols(L, lexer_idx, syntax);
+  }
+  lua_pop(L, 1);
+
+  if (lua_getfield(L, -1, "patterns") == LUA_TTABLE) {
+    int n = luaL_len(L, -1);
+    syntax->patterns = check_alloc(SDL_calloc(n > 0 ? n : 1, sizeof(Pattern)));
+    syntax->n_patterns = n;
+    for (int i = 0; i < n; i++) {
+      if (lua_rawgeti(L, -1, i + 1) == LUA_TTABLE) {
+        compile_pattern(L, lexer_idx, memo_idx, resolve_idx, id, i);
+      } else {
+        lexer = lua_touserdata(L, lexer_idx);
+        lexer->syntaxes[id].patterns[i].disabled = true;
+        lexer->syntaxes[id].patterns[i].syntax = -1;
+      }
+      lua_pop(L, 1);
+    }
+  }
+  lua_pop(L, 1);
+  lexer = lua_touserdata(L, lexer_idx);
+  compile_candidates(&lexer->syntaxes[id]);
+  return id;
+}
+
+
+static bool is_space(lua_State *L, const char *text, const char *end) {
+  static const char spaces[] = "%s*";
+  for (const char *p = text; p < end; p++) {
+    if ((unsigned char) *p >= 0x80) {
+      /* leave unicode spaces to the pattern matcher */
+      const char *captures[MAX_CAPTURES], *match_end;
+      int n_captures;
+      return utf8_pattern_find(L, p, end, p, spaces, spaces + sizeof(spaces) - 1, 1, &match_end, captures, &n_captures)
+        && match_end == end;
+    }
+    if (*p != ' ' && (*p < '\t' || *p > '\r')) { return false; }
+  }
+  return true;
+}
+
+
+static void push_token(Context *ctx, int type, size_t start, size_t end) {
+  if (end <= start) { return; }
+  Lexer *lexer = ctx->lexer;
+  const char *text = ctx->text;
+  if (lexer->n_tokens > 0) {
+    Token *prev = &lexer->tokens[lexer->n_tokens - 1];
+    if (prev->type == type || (prev->space && type != TYPE_INCOMPLETE)) {
+      prev->type = type;
+      prev->end = end;
+      prev->space = prev->space && is_space(ctx->L, text + start, text + end);
+      return;
+    }
+  }
+  /* raised in the worker too, where it fails the job */
+  if (!try_grow((void**) &lexer->tokens, &lexer->tokens_capacity, lexer->n_tokens + 1, sizeof(Token))) {
+    luaL_error(ctx->L, "not enough memory");
+  }
+  lexer->tokens[lexer->n_tokens++] = (Token) { type, start, end, is_space(ctx->L, text + start, text + end) };
+}
+
+
+static void push_span(Context *ctx, const Syntax *syntax, int type, size_t start, size_t end) {
+  const Symbol *symbol = find_symbol(syntax, ctx->text + start, end - start);
+  push_token(ctx, symbol ? symbol->type : type, start, end);
+}
+
+
+static void push_tokens(Context *ctx, const Syntax *syntax, const Pattern *pattern, const Match *match) {
+  if (match->n_captures == 0) {
+    push_span(ctx, syntax, pattern->types[0], match->start, match->end);
+    return;
+  }
+  /* each capture is a position where the next token starts */
+  size_t start = match->start;
+  for (int i = 0; i <= match->n_captures; i++) {
+    size_t end = i < match->n_captures ? match->captures[i] : match->end;
+    /* a string type is indexed like a table too, giving no type */
+    int type = pattern->type_is_table && i < pattern->n_types ? pattern->types[i] : TYPE_NORMAL;
+    if (end > start) {
+      push_span(ctx, syntax, type, start, end);
+    }
+    start = end;
+  }
+}
+
+
+static bool match_code(Context *ctx, const Pattern *pattern, int i, size_t offset, bool anchored, Match *match) {
+  const char *text = ctx->text, *end = text + ctx->len;
+  if (pattern->regex) {
+    pcre2_match_data *md = ctx->lexer->match_data;
+    /* matched on the rest of the line only, like regex.find does */
+    int rc = pcre2_match(pattern->re[i], (PCRE2_SPTR) (text + offset), ctx->len - offset, 0,
+                         anchored ? PCRE2_ANCHORED : 0, md, NULL);
+    if (rc < 0) {
+      if (rc != PCRE2_ERROR_NOMATCH) {
+        PCRE2_UCHAR buffer[120];
+        pcre2_get_error_message(rc, buffer, sizeof(buffer));
+        luaL_error(ctx->L, "regex matching error %d: %s", rc, buffer);
+      }
+      return false;
+    }
+    PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(md);
+    if (ovector[0] > ovector[1]) {
+      luaL_error(ctx->L, "regex matching error: \\K was used in an assertion to "
+      " set the match start after its end");
+    }
+    match->start = offset + ovector[0];
+    match->end = offset + ovector[1];
+    match->n_captures = rc - 1 < MAX_CAPTURES ? rc - 1 : MAX_CAPTURES;
+    for (int c = 0; c < match->n_captures; c++) {
+      PCRE2_SIZE capture = ovector[(c + 1) * 2];
+      match->captures[c] = capture == PCRE2_UNSET ? match->end : offset + capture;
+    }
+    return true;
+  }
+  const char *captures[MAX_CAPTURES], *match_end;
+  const char *start = utf8_pattern_find(ctx->L, text, end, text + offset, pattern->code[i],
+                                        pattern->code[i] + pattern->code_len[i], anchored,
+                                        &match_end, captures, &match->n_captures);
+  if (!start) { return false; }
+  match->start = start - text;
+  match->end = match_end - text;
+  for (int c = 0; c < match->n_captures; c++) {
+    match->captures[c] = captures[c] - text;
+  }
+  return true;
+}
+
+
+static bool is_escaped(Context *ctx, const Pattern *pattern, size_t offset) {
+  size_t count = 0;
+  const char *text = ctx->text, *p = text + offset;
+  while (p > text) {
+    const char *prev = p - 1;
+    while (prev > text && (*prev & 0xC0) == 0x80) { prev--; }
+    if ((size_t) (p - prev) != pattern->escape_len || memcmp(prev, pattern->escape, pattern->escape_len) != 0) {
+      break;
+    }
+    count++;
+    p = prev;
+  }
+  return count % 2 == 1;
+}
+
+
+/* Looks for the open or close pattern of `pattern` from `offset`, anchored
+** there if `at_start`. Matches of a pair preceded by its escape character
+** are skipped when looking for a close pattern. */
+static bool find_text(Context *ctx, const Pattern *pattern, size_t offset, bool at_start, bool close, Match *match) {
+  if (pattern->disabled) { return false; }
+  int i = close && pattern->pair ? 1 : 0;
+  size_t next = offset;
+  for (;;) {
+    if (pattern->whole_line[i] && next > 0) { return false; }
+    if (!match_code(ctx, pattern, i, next, at_start || pattern->whole_line[i], match)) { return false; }
+    if (!pattern->escape || !is_escaped(ctx, pattern, match->start)) { return true; }
+    if (at_start || !close) { return false; }
+    next = match->end;
+  }
+}
+
+
+static void retrieve_syntax_state(Context *ctx) {
+  Lexer *lexer = ctx->lexer;
+  ctx->syntax = 0;
+  ctx->sub = NULL;
+  ctx->pattern = ctx->state_len > 0 ? (unsigned char) ctx->state[0] : 0;
+  ctx->level = 1;
+  if (ctx->pattern > lexer->syntaxes[0].n_patterns) {
+    ctx->pattern = 0;
+  }
+  if (ctx->pattern == 0) { return; }
+  for (size_t i = 0; i < ctx->state_len; i++) {
+    int target = (unsigned char) ctx->state[i];
+    if (target == 0) { break; }
+    const Syntax *syntax = &lexer->syntaxes[ctx->syntax];
+    if (target > syntax->n_patterns) {
+      ctx->pattern = 0;
+      break;
+    }
+    Pattern *pattern = &syntax->patterns[target - 1];
+    if (pattern->syntax >= 0) {
+      ctx->sub = pattern;
+      ctx->syntax = pattern->syntax;
+      ctx->pattern = 0;
+      ctx->level = i + 2;
+    } else {
+      ctx->pattern = target;
+      break;
+    }
+  }
+}
+
+
+static void set_subsyntax_pattern(Context *ctx, int pattern) {
+  ctx->pattern = pattern;
+  if (ctx->level > ctx->state_len) {
+    if (ctx->state_len == MAX_DEPTH) {
+      luaL_error(ctx->L, "too many nested subsyntaxes");
+    }
+    ctx->state[ctx->state_len++] = pattern;
+  } else {
+    ctx->state[ctx->level - 1] = pattern;
+  }
+}
+
+
+static void push_subsyntax(Context *ctx, Pattern *pattern, int n) {
+  set_subsyntax_pattern(ctx, n);
+  ctx->level++;
+  ctx->sub = pattern;
+  ctx->syntax = pattern->syntax;
+  ctx->pattern = 0;
+}
+
+
+static void pop_subsyntax(Context *ctx) {
+  ctx->level--;
+  ctx->state_len = ctx->level;
+  set_subsyntax_pattern(ctx, 0);
+  retrieve_syntax_state(ctx);
+}
+
+
+static void call_report(lua_State *L, int uservalue, JobReport report) {
+  const char *kind = report.report == REPORT_EMPTY ? "empty"
+    : report.report == REPORT_TYPE_TABLE ? "type_table"
+    : report.report == REPORT_NOT_ENOUGH_TYPES ? "not_enough_types" : "too_many_types";
+  lua_rawgeti(L, uservalue, UV_REPORT);
+  lua_rawgeti(L, uservalue, UV_SYNTAXES);
+  lua_rawgeti(L, -1, report.syntax + 1);
+  lua_remove(L, -2);
+  lua_pushinteger(L, report.pattern);
+  lua_pushstring(L, kind);
+  lua_pushinteger(L, report.n_types);
+  lua_pushinteger(L, report.n_results);
+  lua_call(L, 5, 0);
+}
+
+
+static void report_bad_pattern(Context *ctx, Pattern *pattern, int n, int report, int n_results) {
+  if (pattern->reported & report) { return; }
+  pattern->reported |= report;
+  if (ctx->job) {
+    HighlightJob *job = ctx->job;
+    SDL_LockMutex(worker.lock);
+    /* reports are only warnings, drop them rather than fail the job */
+    if (try_grow((void**) &job->reports, &job->reports_capacity, job->n_reports + 1, sizeof(JobReport))) {
+      job->reports[job->n_reports++] = (JobReport) { ctx->syntax, n, report, pattern->n_types, n_results };
+    }
+    SDL_UnlockMutex(worker.lock);
+    return;
+  }
+  lua_State *L = ctx->L;
+  call_report(L, ctx->uservalue, (JobReport) { ctx->syntax, n, report, pattern->n_types, n_results });
+}
+
+
+/* Tokenizes the line from `i`, returns whether it got through all of it
+** before `deadline` or the job being cancelled, otherwise `i` is where to
+** resume. */
+static bool tokenize(Context *ctx, size_t *i, uint64_t deadline) {
+  Lexer *lexer = ctx->lexer;
+  size_t len = ctx->len;
+  size_t starting_i = *i;
+  Match match, sub_match;
+  retrieve_syntax_state(ctx);
+  while (*i < len) {
+    if (*i - starting_i > TIME_CHECK_INTERVAL) {
+      starting_i = *i;
+      if (SDL_GetTicksNS() > deadline || (ctx->job && SDL_GetAtomicInt(&ctx->job->cancelled))) {
+        push_token(ctx, TYPE_INCOMPLETE, *i, len);
+        return false;
+      }
+    }
+    /* continue trying to match the end pattern of a pair if we're in one */
+    if (ctx->pattern > 0) {
+      Pattern *pattern = &lexer->syntaxes[ctx->syntax].patterns[ctx->pattern - 1];
+      bool found = find_text(ctx, pattern, *i, false, true, &match);
+      int type = pattern->types[0];
+      bool cont = true;
+      /* ending the subsyntax takes precedence over ending the pair in it */
+      if (ctx->sub && find_text(ctx, ctx->sub, *i, false, true, &sub_match)
+          && (!found || sub_match.start < match.start)) {
+        push_token(ctx, type, *i, sub_match.start);
+        *i = sub_match.start;
+        cont = false;
+      }
+      if (cont) {
+        if (found) {
+          push_token(ctx, type, *i, match.start);
+          push_tokens(ctx, &lexer->syntaxes[ctx->syntax], pattern, &match);
+          set_subsyntax_pattern(ctx, 0);
+          *i = match.end;
+        } else {
+          push_token(ctx, type, *i, len);
+          break;
+        }
+      }
+    }
+    /* end of the subsyntax, either right after a token or in a pair */
+    while (ctx->sub && find_text(ctx, ctx->sub, *i, true, true, &match)) {
+      push_tokens(ctx, &lexer->syntaxes[ctx->syntax], ctx->sub, &match);
+      pop_subsyntax(ctx);
+      *i = match.end;
+    }
+
+    bool matched = false;
+    Syntax *syntax = &lexer->syntaxes[ctx->syntax];
+    size_t c = *i < len ? (unsigned char) ctx->text[*i] : 256;
+    for (size_t k = syntax->candidates_start[c]; k < syntax->candidates_start[c + 1]; k++) {
+      int n = syntax->candidates[k];
+      Pattern *pattern = &syntax->patterns[n];
+      if (!find_text(ctx, pattern, *i, true, false, &match)) { continue; }
+      int n_results = match.n_captures + 1;
+      if (match.start == match.end) {
+        report_bad_pattern(ctx, pattern, n + 1, REPORT_EMPTY, n_results);
+        continue;
+      }
+      if (match.n_captures == 0 && pattern->type_is_table) {
+        report_bad_pattern(ctx, pattern, n + 1, REPORT_TYPE_TABLE, n_results);
+        /* from now on only the first type is used */
+        pattern->type_is_table = false;
+        pattern->n_types = 1;
+      } else if (n_results > pattern->n_types) {
+        report_bad_pattern(ctx, pattern, n + 1, REPORT_NOT_ENOUGH_TYPES, n_results);
+      } else if (n_results < pattern->n_types) {
+        report_bad_pattern(ctx, pattern, n + 1, REPORT_TOO_MANY_TYPES, n_results);
+      }
+      push_tokens(ctx, syntax, pattern, &match);
+      if (pattern->pair) {
+        if (pattern->syntax >= 0) {
+          push_subsyntax(ctx, pattern, n + 1);
+        } else {
+          set_subsyntax_pattern(ctx, n + 1);
+        }
+      }
+      *i = match.end;
+      matched = true;
+      break;
+    }
+
+    /* consume a character if nothing matched */
+    if (!matched) {
+      if (*i >= len) { break; }
+      size_t next = *i + 1;
+      while (next < len && (ctx->text[next] & 0xC0) == 0x80) { next++; }
+      push_token(ctx, TYPE_NORMAL, *i, next);
+      *i = next;
+    }
+  }
+  return true;
+}
+
+
+static Lexer* check_lexer(lua_State *L, int idx) {
+  Lexer *lexer = luaL_checkudata(L, idx, API_TYPE_LEXER);
+  luaL_argcheck(L, lexer->n_syntaxes > 0, idx, "lexer not compiled");
+  return lexer;
+}
+
+
+static int f_lexer_new(lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  luaL_checktype(L, 3, LUA_TFUNCTION);
+  lua_settop(L, 3);
+  Lexer *lexer = lua_newuserdatauv(L, sizeof(Lexer), 1);
+  memset(lexer, 0, sizeof(Lexer));
+  lexer->max_captures = MAX_CAPTURES;
+  luaL_setmetatable(L, API_TYPE_LEXER);
+  int lexer_idx = lua_gettop(L);
+
+  lua_createtable(L, UV_COUNT, 0);
+  lua_createtable(L, 16, 0);
+  lua_pushliteral(L, "normal");
+  lua_rawseti(L, -2, TYPE_NORMAL + 1);
+  lua_pushliteral(L, "incomplete");
+  lua_rawseti(L, -2, TYPE_INCOMPLETE + 1);
+  lua_rawseti(L, -2, UV_TYPES);
+  lua_createtable(L, 0, 16);
+  lua_pushliteral(L, "normal");
+  lua_pushinteger(L, TYPE_NORMAL);
+  lua_rawset(L, -3);
+  lua_pushliteral(L, "incomplete");
+  lua_pushinteger(L, TYPE_INCOMPLETE);
+  lua_rawset(L, -3);
+  lua_rawseti(L, -2, UV_TYPE_IDS);
+  lua_newtable(L);
+  lua_rawseti(L, -2, UV_SYNTAXES);
+  lua_pushvalue(L, 3);
+  lua_rawseti(L, -2, UV_REPORT);
+  lua_setiuservalue(L, lexer_idx, 1);
+
+  lua_newtable(L);
+  int memo_idx = lua_gettop(L);
+  lua_pushvalue(L, 1);
+  compile_syntax(L, lexer_idx, memo_idx, 2);
+  lua_pop(L, 2);
+
+  lexer = lua_touserdata(L, lexer_idx);
+  lexer->match_data = pcre2_match_data_create(lexer->max_captures, NULL);
+  return 1;
+}
+
+
+static int f_lexer_gc(lua_State *L) {
+  Lexer *lexer = luaL_checkudata(L, 1, API_TYPE_LEXER);
+  for (int s = 0; s < lexer->n_syntaxes; s++) {
+    Syntax *syntax = &lexer->syntaxes[s];
+    for (int p = 0; p < syntax->n_patterns; p++) {
+      Pattern *pattern = &syntax->patterns[p];
+      for (int i = 0; i < 2; i++) {
+        SDL_free(pattern->code[i]);
+        if (pattern->re[i]) { pcre2_code_free(pattern->re[i]); }
+      }
+      SDL_free(pattern->escape);
+      SDL_free(pattern->types);
+    }
+    for (size_t i = 0; i < syntax->symbols_capacity; i++) {
+      SDL_free(syntax->symbols[i].text);
+    }
+    SDL_free(syntax->patterns);
+    SDL_free(syntax->symbols);
+    SDL_free(syntax->candidates);
+  }
+  SDL_free(lexer->syntaxes);
+  SDL_free(lexer->tokens);
+  if (lexer->match_data) { pcre2_match_data_free(lexer->match_data); }
+  memset(lexer, 0, sizeof(Lexer));
+  return 0;
+}
+
+
+static int f_lexer_tokenize(lua_State *L) {
+  Lexer *lexer = check_lexer(L, 1);
+  size_t len, state_len;
+  const char *text = luaL_checklstring(L, 2, &len);
+  const char *state = luaL_checklstring(L, 3, &state_len);
+  lua_Integer i = luaL_optinteger(L, 4, 1);
+  luaL_argcheck(L, i >= 1 && (size_t) i <= len + 1, 4, "position out of range");
+  double budget = luaL_optnumber(L, 6, 0);
+  lua_settop(L, 6);
+  if (lua_isnil(L, 5)) {
+    lua_newtable(L);
+    lua_replace(L, 5);
+  }
+  luaL_checktype(L, 5, LUA_TTABLE);
+  lua_getiuservalue(L, 1, 1);
+
+  Context ctx = { .L = L, .lexer = lexer, .uservalue = 7, .text = text, .len = len };
+  ctx.state_len = state_len < MAX_DEPTH ? state_len : MAX_DEPTH;
+  memcpy(ctx.state, state, ctx.state_len);
+
+  /* when resuming, the last token can still be merged with the next ones */
+  lexer->n_tokens = 0;
+  size_t out = luaL_len(L, 5) + 1;
+  size_t offset = i - 1;
+  if (out > 2 && lua_rawgeti(L, 5, out - 2) == LUA_TSTRING && lua_rawgeti(L, 5, out - 1) == LUA_TSTRING
+      && lua_rawlen(L, -1) <= offset) {
+    size_t prev_len = lua_rawlen(L, -1);
+    lua_pushvalue(L, -2);
+    push_token(&ctx, intern_type(L, 1), offset - prev_len, offset);
+    out -= 2;
+  }
+  lua_settop(L, 7);
+
+  uint64_t deadline = budget > 0 ? SDL_GetTicksNS() + (uint64_t) (budget * 1e9) : UINT64_MAX;
+  bool complete = tokenize(&ctx, &offset, deadline);
+
+  lua_rawgeti(L, 7, UV_TYPES);
+  for (size_t t = 0; t < lexer->n_tokens; t++) {
+    Token *token = &lexer->tokens[t];
+    lua_rawgeti(L, -1, token->type + 1);
+    lua_rawseti(L, 5, out++);
+    lua_pushlstring(L, text + token->start, token->end - token->start);
+    lua_rawseti(L, 5, out++);
+  }
+  lua_pop(L, 1);
+  lexer->n_tokens = 0;
+
+  lua_pushvalue(L, 5);
+  lua_pushlstring(L, ctx.state, ctx.state_len);
+  if (complete) { return 2; }
+  lua_pushinteger(L, offset + 1);
+  return 3;
+}
+
+
+/* Background highlighting. Jobs are queued to a single worker thread, which
+** runs each for a while before going to the next one, and queues the lines
+** it tokenized in the job. A "highlighted" event with the id of the job is
+** then posted for the main thread to collect them with job:poll(), which
+** converts them to Lua values and makes the reports of bad patterns.
+**
+** The worker has its own Lua state, only used to catch the errors raised
+** while tokenizing. As a lexer keeps its match data and tokens between calls,
+** the lexer of a job is only used by the worker. */
+
+#define JOB_SLICE_NS 5000000 /* time a job runs before the next one's turn */
+
+static void enqueue_job(HighlightJob *job) {
+  job->queued = true;
+  job->next = NULL;
+  if (worker.last) {
+    worker.last->next = job;
+  } else {
+    worker.first = job;
+  }
+  worker.last = job;
+  SDL_SignalCondition(worker.wake);
+}
+
+
+static void dequeue_job(HighlightJob *job) {
+  HighlightJob **link = &worker.first, *prev = NULL;
+  while (*link && *link != job) {
+    prev = *link;
+    link = &(*link)->next;
+  }
+  if (!*link) { return; }
+  *link = job->next;
+  if (worker.last == job) { worker.last = prev; }
+  job->next = NULL;
+  job->queued = false;
+}
+
+
+static int run_job(lua_State *L) {
+  HighlightJob *job = lua_touserdata(L, 1);
+  Lexer *lexer = job->lexer;
+  size_t count = buffer_lines_count(job->lines);
+  uint64_t deadline = SDL_GetTicksNS() + JOB_SLICE_NS;
+  SDL_LockMutex(worker.lock);
+  size_t line = job->line, end = job->end < count ? job->end : count;
+  SDL_UnlockMutex(worker.lock);
+  while (line < end && !SDL_GetAtomicInt(&job->cancelled) && SDL_GetTicksNS() < deadline) {
+    size_t len = buffer_lines_read(job->lines, line, &job->text, &job->text_capacity);
+    if (len == SIZE_MAX) { return luaL_error(L, "not enough memory"); }
+    Context ctx = { .L = L, .lexer = lexer, .job = job, .text = job->text, .len = len };
+    ctx.state_len = job->state_len;
+    memcpy(ctx.state, job->state, job->state_len);
+    lexer->n_tokens = 0;
+    size_t i = 0;
+    if (!tokenize(&ctx, &i, UINT64_MAX)) { break; }
+
+    LineResult *result = SDL_malloc(sizeof(LineResult) + sizeof(Token) * lexer->n_tokens + len + ctx.state_len);
+    if (!result) { return luaL_error(L, "not enough memory"); }
+    result->tokens = (Token*) (result + 1);
+    result->n_tokens = lexer->n_tokens;
+    memcpy(result->tokens, lexer->tokens, sizeof(Token) * lexer->n_tokens);
+    result->text = (char*) (result->tokens + lexer->n_tokens);
+    result->len = len;
+    memcpy(result->text, job->text, len);
+    result->state = result->text + len;
+    result->state_len = ctx.state_len;
+    memcpy(result->state, ctx.state, ctx.state_len);
+    memcpy(job->state, ctx.state, ctx.state_len);
+    job->state_len = ctx.state_len;
+
+    SDL_LockMutex(worker.lock);
+    if (!try_grow((void**) &job->results, &job->results_capacity, job->n_results + 1, sizeof(LineResult*))) {
+      SDL_UnlockMutex(worker.lock);
+      SDL_free(result);
+      return luaL_error(L, "not enough memory");
+    }
+    if (job->n_results == 0) { job->results_line = line; }
+    job->results[job->n_results++] = result;
+    line = ++job->line;
+    end = job->end < count ? job->end : count;
+    SDL_UnlockMutex(worker.lock);
+  }
+  return 0;
+}
+
+
+static int highlight_worker(void *data) {
+  lua_State *L = data;
+  SDL_LockMutex(worker.lock);
+  for (;;) {
+    while (!worker.first && !worker.quit) {
+      SDL_WaitCondition(worker.wake, worker.lock);
+    }
+    if (worker.quit) { break; }
+    HighlightJob *job = worker.first;
+    dequeue_job(job);
+    worker.current = job;
+    SDL_UnlockMutex(worker.lock);
+
+    lua_pushcfunction(L, run_job);
+    lua_pushlightuserdata(L, job);
+    int status = lua_pcall(L, 1, 0, 0);
+
+    SDL_LockMutex(worker.lock);
+    if (status != LUA_OK) {
+      const char *message = lua_tostring(L, -1);
+      job->error = SDL_strdup(message ? message : "error while tokenizing");
+      job->finished = true;
+      lua_pop(L, 1);
+    } else if (job->line >= buffer_lines_count(job->lines)) {
+      job->finished = true;
+    } else if (job->line < job->end && !SDL_GetAtomicInt(&job->cancelled)) {
+      enqueue_job(job);
+    }
+    if (!job->notified && (job->n_results > 0 || job->n_reports > 0 || job->error)
+        && !SDL_GetAtomicInt(&job->cancelled)) {
+      CustomEvent event;
+      SDL_zero(event);
+      event.data1 = (void*) (intptr_t) job->id;
+      job->notified = push_custom_event("highlighted", &event);
+    }
+    worker.current = NULL;
+    SDL_BroadcastCondition(worker.idle);
+  }
+  SDL_UnlockMutex(worker.lock);
+  lua_close(L);
+  return 0;
+}
+
+
+static bool start_worker(void) {
+  if (worker.lock) { return true; }
+  worker.lock = SDL_CreateMutex();
+  worker.wake = SDL_CreateCondition();
+  worker.idle = SDL_CreateCondition();
+  lua_State *L = luaL_newstate();
+  if (!worker.lock || !worker.wake || !worker.idle || !L) { goto fail; }
+  worker.thread = SDL_CreateThread(highlight_worker, "highlight_worker", L);
+  if (!worker.thread) { goto fail; }
+  return true;
+fail:
+  if (L) { lua_close(L); }
+  SDL_DestroyMutex(worker.lock);
+  SDL_DestroyCondition(worker.wake);
+  SDL_DestroyCondition(worker.idle);
+  SDL_zero(worker);
+  return false;
+}
+
+
+/* The jobs are collected before the module, so none is left to run. */
+static void stop_worker(void) {
+  if (!worker.thread) { return; }
+  SDL_LockMutex(worker.lock);
+  worker.quit = true;
+  SDL_SignalCondition(worker.wake);
+  SDL_UnlockMutex(worker.lock);
+  SDL_WaitThread(worker.thread, NULL);
+  SDL_DestroyMutex(worker.lock);
+  SDL_DestroyCondition(worker.wake);
+  SDL_DestroyCondition(worker.idle);
+  SDL_zero(worker);
+}
+
+
+static void cancel_job(HighlightJob *job) {
+  SDL_SetAtomicInt(&job->cancelled, 1);
+  SDL_LockMutex(worker.lock);
+  if (job->queued) { dequeue_job(job); }
+  while (worker.current == job) {
+    SDL_WaitCondition(worker.idle, worker.lock);
+  }
+  SDL_UnlockMutex(worker.lock);
+}
+
+
+static HighlightJob* check_job(lua_State *L, int idx) {
+  HighlightJob *job = luaL_checkudata(L, idx, API_TYPE_HIGHLIGHT_JOB);
+  luaL_argcheck(L, job->lines != NULL, idx, "job was freed");
+  return job;
+}
+
+
+static int f_lexer_highlight(lua_State *L) {
+  Lexer *lexer = check_lexer(L, 1);
+  luaL_checkudata(L, 2, API_TYPE_BUFFER);
+  lua_Integer line = luaL_checkinteger(L, 3);
+  size_t state_len;
+  const char *state = luaL_checklstring(L, 4, &state_len);
+  lua_Integer end = luaL_checkinteger(L, 5);
+  lua_Integer id = luaL_checkinteger(L, 6);
+  luaL_argcheck(L, line >= 1, 3, "line out of range");
+  if (!start_worker()) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "unable to start the highlighting thread: %s", SDL_GetError());
+    return 2;
+  }
+  HighlightJob *job = lua_newuserdatauv(L, sizeof(HighlightJob), 1);
+  memset(job, 0, sizeof(HighlightJob));
+  luaL_setmetatable(L, API_TYPE_HIGHLIGHT_JOB);
+  lua_pushvalue(L, 1);
+  lua_setiuservalue(L, -2, 1);
+  job->lexer = lexer;
+  job->lines = buffer_get_lines(L, 2);
+  job->id = id;
+  job->state_len = state_len < MAX_DEPTH ? state_len : MAX_DEPTH;
+  memcpy(job->state, state, job->state_len);
+  job->line = line - 1;
+  job->end = end > 0 ? end : 0;
+  SDL_LockMutex(worker.lock);
+  if (job->line < job->end) { enqueue_job(job); }
+  SDL_UnlockMutex(worker.lock);
+  return 1;
+}
+
+
+static int f_job_extend(lua_State *L) {
+  HighlightJob *job = check_job(L, 1);
+  lua_Integer end = luaL_checkinteger(L, 2);
+  SDL_LockMutex(worker.lock);
+  if (end > 0 && (size_t) end > job->end) {
+    job->end = end;
+    if (!job->queued && !job->finished && worker.current != job && !SDL_GetAtomicInt(&job->cancelled)) {
+      enqueue_job(job);
+    }
+  }
+  SDL_UnlockMutex(worker.lock);
+  return 0;
+}
+
+
+static int f_job_poll(lua_State *L) {
+  HighlightJob *job = check_job(L, 1);
+  lua_settop(L, 1);
+  lua_getiuservalue(L, 1, 1);
+  lua_getiuservalue(L, 2, 1);
+  lua_rawgeti(L, 3, UV_TYPES);
+
+  SDL_LockMutex(worker.lock);
+  LineResult **results = job->results;
+  size_t first = job->results_line, n_results = job->n_results;
+  char *error = job->error;
+  job->results = NULL;
+  job->n_results = job->results_capacity = 0;
+  job->error = NULL;
+  job->notified = false;
+  SDL_UnlockMutex(worker.lock);
+
+  if (error) {
+    lua_pushstring(L, error);
+    SDL_free(error);
+  } else {
+    lua_pushnil(L);
+  }
+  lua_createtable(L, n_results, 0);
+  for (size_t r = 0; r < n_results; r++) {
+    LineResult *result = results[r];
+    lua_createtable(L, 0, 3);
+    lua_pushlstring(L, result->text, result->len);
+    lua_setfield(L, -2, "text");
+    lua_createtable(L, result->n_tokens * 2, 0);
+    for (size_t t = 0; t < result->n_tokens; t++) {
+      Token *token = &result->tokens[t];
+      lua_rawgeti(L, 4, token->type + 1);
+      lua_rawseti(L, -2, t * 2 + 1);
+      lua_pushlstring(L, result->text + token->start, token->end - token->start);
+      lua_rawseti(L, -2, t * 2 + 2);
+    }
+    lua_setfield(L, -2, "tokens");
+    lua_pushlstring(L, result->state, result->state_len);
+    lua_setfield(L, -2, "state");
+    lua_rawseti(L, -2, r + 1);
+    SDL_free(result);
+  }
+  SDL_free(results);
+
+  /* reports are taken one at a time, in case one raises an error */
+  for (;;) {
+    SDL_LockMutex(worker.lock);
+    bool found = job->n_reports > 0;
+    JobReport report;
+    if (found) {
+      report = job->reports[0];
+      memmove(job->reports, job->reports + 1, sizeof(JobReport) * --job->n_reports);
+    }
+    SDL_UnlockMutex(worker.lock);
+    if (!found) { break; }
+    call_report(L, 3, report);
+  }
+
+  if (n_results == 0 && lua_isnil(L, 5)) { return 0; }
+  lua_pushinteger(L, first + 1);
+  lua_replace(L, 4);
+  lua_insert(L, 5);
+  return 3;
+}
+
+
+static int f_job_cancel(lua_State *L) {
+  cancel_job(check_job(L, 1));
+  return 0;
+}
+
+
+static int f_job_gc(lua_State *L) {
+  HighlightJob *job = luaL_checkudata(L, 1, API_TYPE_HIGHLIGHT_JOB);
+  if (!job->lines) { return 0; }
+  cancel_job(job);
+  for (size_t r = 0; r < job->n_results; r++) {
+    SDL_free(job->results[r]);
+  }
+  SDL_free(job->results);
+  SDL_free(job->reports);
+  SDL_free(job->error);
+  SDL_free(job->text);
+  buffer_lines_release(job->lines);
+  memset(job, 0, sizeof(HighlightJob));
+  return 0;
+}
+
+
+static int highlighted_callback(lua_State *L, SDL_Event *e) {
+  lua_pushstring(L, "highlighted");
+  lua_pushinteger(L, (intptr_t) e->user.data1);
+  return 2;
+}
+
+
+static int lexer_gc(lua_State *L) {
+  stop_worker();
+  return 0;
+}
+
+
+static const luaL_Reg lexer_lib[] = {
+  { "new",       f_lexer_new       },
+  { "__gc",      f_lexer_gc        },
+  { "tokenize",  f_lexer_tokenize  },
+  { "highlight", f_lexer_highlight },
+  { NULL, NULL }
+};
+
+
+static const luaL_Reg job_lib[] = {
+  { "__gc",   f_job_gc     },
+  { "extend", f_job_extend },
+  { "poll",   f_job_poll   },
+  { "cancel", f_job_cancel },
+  { NULL, NULL }
+};
+
+
+int luaopen_lexer(lua_State *L) {
+  if (!register_custom_event("highlighted", highlighted_callback)) {
+    return luaL_error(L, "Unable to register custom highlighted event: %s", SDL_GetError());
+  }
+  luaL_newmetatable(L, API_TYPE_HIGHLIGHT_JOB);
+  luaL_setfuncs(L, job_lib, 0);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+  luaL_newmetatable(L, API_TYPE_LEXER);
+  luaL_setfuncs(L, lexer_lib, 0);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  /* the worker is stopped when the module is collected, as Lua is closed */
+  lua_newtable(L);
+  lua_pushcfunction(L, lexer_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_setmetatable(L, -2);
+  return 1;
+}
@@ -1,4 +1,5 @@
 #include "api.h"
+#include "custom_events.h"
 
 #include <string.h>
 #include <stdbool.h>
@@ -18,8 +19,13 @@
   #include <unistd.h>
   #include <signal.h>
   #include <fcntl.h>
+  #include <spawn.h>
+  #include <poll.h>
   #include <sys/types.h>
   #include <sys/wait.h>
+  #ifdef __linux__
+    #include <sys/syscall.h>
+  #endif
 #endif
 
 #include "../arena_allocator.h"
@@ -28,6 +34,12 @@
 #define PROCESS_TERM_TRIES 3
 #define PROCESS_TERM_DELAY 50
 #define PROCESS_KILL_LIST_NAME "__process_kill_list__"
+// The output buffered for a stream, it isn't read anymore until some of it was,
+// unless a read waits for more
+#define PROCESS_BUFFER_MAX (4 * 1024 * 1024)
+#define PROCESS_READ_SIZE 65536
+// How often the processes that closed their outputs are checked for their exit, without pidfd
+#define PROCESS_EXIT_CHECK_DELAY 50
 
 #if _WIN32
 
@@ -63,6 +75,26 @@ typedef char **process_env_t;
 #define UNUSED
 #endif
 
+#ifndef _WIN32
+// The output of a stream, read by the reactor thread.
+typedef struct {
+  char *data;
+  size_t start, length, capacity, wanted;
+  int fd, error;
+  bool eof, closed;
+} process_buffer_t;
+
+// The streams of a process, owned by the reactor: they're only freed by its thread once
+// the process was released, so that they can be used while it polls.
+typedef struct process_io_s {
+  process_buffer_t buffers[2]; // stdout and stderr
+  pid_t pid;
+  int pidfd;
+  bool exited, released;
+  struct process_io_s *next;
+} process_io_t;
+#endif
+
 typedef struct {
   bool running, detached;
   int returncode, deadline;
@@ -72,6 +104,8 @@ typedef struct {
     OVERLAPPED overlapped[2];
     bool reading[2];
     char buffer[2][READ_BUF_SIZE];
+  #else
+    process_io_t *io;
   #endif
   process_stream_t child_pipes[3][2];
 } process_t;
@@ -293,6 +327,289 @@ static int kill_list_worker(void *ud) {
 }
 
 
+#ifndef _WIN32
+// A thread polls the outputs of all the processes and reads them into native buffers,
+// then wakes the main loop with a "process" event, at most once until it's received.
+// The exit of the processes is also notified, through pidfd when it's available.
+static struct {
+  SDL_Mutex *mutex;
+  SDL_Thread *thread;
+  // a pipe is used to wake the thread when the streams change, or in case of exit
+  int wake[2];
+  bool stop, notified;
+  process_io_t *head;
+} reactor;
+
+
+static void reactor_wake(void) {
+  char c = 0;
+  write(reactor.wake[1], &c, 1);
+}
+
+
+static size_t buffer_limit(process_buffer_t *buffer) {
+  return buffer->wanted > PROCESS_BUFFER_MAX ? buffer->wanted : PROCESS_BUFFER_MAX;
+}
+
+
+// Sets the length a read waits for, so that the reactor reads past the limit if needed.
+static void buffer_want(process_buffer_t *buffer, size_t wanted) {
+  size_t limit = buffer_limit(buffer);
+  buffer->wanted = wanted;
+  if (buffer->length >= limit && buffer->length < buffer_limit(buffer))
+    reactor_wake();
+}
+
+
+// Pushes the first `size` bytes of the buffer and drops the first `consumed` ones.
+static void buffer_push(lua_State *L, process_buffer_t *buffer, size_t size, size_t consumed) {
+  lua_pushlstring(L, buffer->data + buffer->start, size);
+  if (buffer->length >= buffer_limit(buffer) && buffer->length - consumed < buffer_limit(buffer))
+    reactor_wake();
+  buffer->start = buffer->length == consumed ? 0 : buffer->start + consumed;
+  buffer->length -= consumed;
+}
+
+
+static void process_io_free(process_io_t *io) {
+  for (int i = 0; i < 2; ++i) {
+    if (io->buffers[i].fd >= 0)
+      close(io->buffers[i].fd);
+    SDL_free(io->buffers[i].data);
+  }
+  if (io->pidfd >= 0)
+    close(io->pidfd);
+  SDL_free(io);
+}
+
+
+// Reads what's available from a stream, returns whether there's something new to notify.
+static bool reactor_read(process_buffer_t *buffer) {
+  if (buffer->start > 0 && buffer->start + buffer->length + PROCESS_READ_SIZE > buffer->capacity) {
+    memmove(buffer->data, buffer->data + buffer->start, buffer->length);
+    buffer->start = 0;
+  }
+  if (buffer->length + PROCESS_READ_SIZE > buffer->capacity) {
+    size_t capacity = buffer->capacity ? buffer->capacity * 2 : PROCESS_READ_SIZE;
+    while (capacity < buffer->length + PROCESS_READ_SIZE) capacity *= 2;
+    char *data = SDL_realloc(buffer->data, capacity);
+    if (!data) {
+      buffer->error = ENOMEM;
+      buffer->eof = true;
+      close(buffer->fd);
+      buffer->fd = -1;
+      return true;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+  }
+  ssize_t length = read(buffer->fd, buffer->data + buffer->start + buffer->length, PROCESS_READ_SIZE);
+  if (length > 0) {
+    buffer->length += length;
+    return true;
+  }
+  if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return false;
+  buffer->error = length < 0 ? errno : 0;
+  buffer->eof = true;
+  close(buffer->fd);
+  buffer->fd = -1;
+  return true;
+}
+
+
+static bool reactor_check_exit(process_io_t *io) {
+  siginfo_t info;
+  memset(&info, 0, sizeof(info));
+  // the process may be reaped already
+  if (waitid(P_PID, io->pid, &info, WEXITED | WNOHANG | WNOWAIT) == -1 ? errno != ECHILD : info.si_pid == 0)
+    return false;
+  io->exited = true;
+  return true;
+}
+
+
+static int reactor_thread(void *data) {
+  struct pollfd *fds = NULL;
+  process_io_t **owners = NULL;
+  int capacity = 0;
+  SDL_LockMutex(reactor.mutex);
+  while (!reactor.stop) {
+    // drop the released processes, and gather the streams to poll
+    int n = 1;
+    bool check_exits = false;
+    for (process_io_t **p = &reactor.head; *p;) {
+      process_io_t *io = *p;
+      if (io->released) {
+        *p = io->next;
+        process_io_free(io);
+        continue;
+      }
+      for (int i = 0; i < 2; ++i) {
+        process_buffer_t *buffer = &io->buffers[i];
+        if (buffer->closed && buffer->fd >= 0) {
+          close(buffer->fd);
+          buffer->fd = -1;
+        }
+      }
+      n += 3;
+      if (!io->exited && io->pidfd < 0 && io->buffers[0].fd < 0 && io->buffers[1].fd < 0)
+        check_exits = true;
+      p = &io->next;
+    }
+    if (n > capacity) {
+      capacity = n * 2;
+      fds = SDL_realloc(fds, capacity * sizeof(struct pollfd));
+      owners = SDL_realloc(owners, capacity * sizeof(process_io_t *));
+      if (!fds || !owners)
+        break;
+    }
+    n = 1;
+    fds[0] = (struct pollfd) { .fd = reactor.wake[0], .events = POLLIN };
+    for (process_io_t *io = reactor.head; io; io = io->next) {
+      for (int i = 0; i < 2; ++i) {
+        if (io->buffers[i].fd >= 0 && io->buffers[i].length < buffer_limit(&io->buffers[i])) {
+          owners[n] = io;
+          fds[n++] = (struct pollfd) { .fd = io->buffers[i].fd, .events = POLLIN };
+        }
+      }
+      if (io->pidfd >= 0 && !io->exited) {
+        owners[n] = io;
+        fds[n++] = (struct pollfd) { .fd = io->pidfd, .events = POLLIN };
+      }
+    }
+    SDL_UnlockMutex(reactor.mutex);
+
+    poll(fds, n, check_exits ? PROCESS_EXIT_CHECK_DELAY : -1);
+    if (fds[0].revents) {
+      char drain[64];
+      read(reactor.wake[0], drain, sizeof(drain));
+    }
+
+    SDL_LockMutex(reactor.mutex);
+    bool notify = false;
+    for (int i = 1; i < n; ++i) {
+      process_io_t *io = owners[i];
+      if (!fds[i].revents || io->released)
+        continue;
+      if (fds[i].fd == io->pidfd) {
+        io->exited = true;
+        notify = true;
+      } else {
+        process_buffer_t *buffer = &io->buffers[fds[i].fd == io->buffers[0].fd ? 0 : 1];
+        if (!buffer->closed)
+          notify = reactor_read(buffer) || notify;
+      }
+    }
+    if (check_exits) {
+      for (process_io_t *io = reactor.head; io; io = io->next) {
+        if (!io->exited && !io->released && io->pidfd < 0 && io->buffers[0].fd < 0 && io->buffers[1].fd < 0)
+          notify = reactor_check_exit(io) || notify;
+      }
+    }
+    if (notify && !reactor.notified) {
+      CustomEvent event;
+      SDL_zero(event);
+      reactor.notified = push_custom_event("process", &event);
+    }
+  }
+  SDL_UnlockMutex(reactor.mutex);
+  SDL_free(fds);
+  SDL_free(owners);
+  return 0;
+}
+
+
+static int process_event_callback(lua_State *L, SDL_Event *e) {
+  SDL_LockMutex(reactor.mutex);
+  reactor.notified = false;
+  SDL_UnlockMutex(reactor.mutex);
+  lua_pushstring(L, "process");
+  return 1;
+}
+
+
+static bool reactor_start(void) {
+  memset(&reactor, 0, sizeof(reactor));
+  if (pipe(reactor.wake) == -1)
+    return false;
+  fcntl(reactor.wake[0], F_SETFD, FD_CLOEXEC);
+  fcntl(reactor.wake[1], F_SETFD, FD_CLOEXEC);
+  fcntl(reactor.wake[0], F_SETFL, O_NONBLOCK);
+  fcntl(reactor.wake[1], F_SETFL, O_NONBLOCK);
+  if (!register_custom_event("process", process_event_callback) || !(reactor.mutex = SDL_CreateMutex())
+    || !(reactor.thread = SDL_CreateThread(reactor_thread, "process_reactor", NULL))) {
+    if (reactor.mutex)
+      SDL_DestroyMutex(reactor.mutex);
+    close(reactor.wake[0]);
+    close(reactor.wake[1]);
+    memset(&reactor, 0, sizeof(reactor));
+    return false;
+  }
+  return true;
+}
+
+
+// The processes that weren't released yet keep their streams, and free them themselves.
+static void reactor_stop(void) {
+  if (!reactor.thread)
+    return;
+  SDL_LockMutex(reactor.mutex);
+  reactor.stop = true;
+  reactor_wake();
+  SDL_UnlockMutex(reactor.mutex);
+  SDL_WaitThread(reactor.thread, NULL);
+  for (process_io_t *io = reactor.head, *next; io; io = next) {
+    next = io->next;
+    if (io->released)
+      process_io_free(io);
+  }
+  SDL_DestroyMutex(reactor.mutex);
+  close(reactor.wake[0]);
+  close(reactor.wake[1]);
+  memset(&reactor, 0, sizeof(reactor));
+}
+
+
+// Hands the outputs of a started process to the reactor.
+static void reactor_add(process_t *self) {
+  if (!reactor.thread || !(self->io = SDL_calloc(1, sizeof(process_io_t))))
+    return;
+  for (int i = 0; i < 2; ++i) {
+    self->io->buffers[i].fd = self->child_pipes[STDOUT_FD + i][0];
+    self->child_pipes[STDOUT_FD + i][0] = HANDLE_INVALID;
+  }
+  self->io->pid = self->pid;
+  self->io->pidfd = -1;
+  #if defined(__linux__) && defined(SYS_pidfd_open)
+    self->io->pidfd = syscall(SYS_pidfd_open, self->pid, 0);
+    if (self->io->pidfd >= 0)
+      fcntl(self->io->pidfd, F_SETFD, FD_CLOEXEC);
+  #endif
+  SDL_LockMutex(reactor.mutex);
+  self->io->next = reactor.head;
+  reactor.head = self->io;
+  reactor_wake();
+  SDL_UnlockMutex(reactor.mutex);
+}
+
+
+static void reactor_release(process_t *self) {
+  if (!self->io)
+    return;
+  if (!reactor.thread) {
+    process_io_free(self->io);
+  } else {
+    SDL_LockMutex(reactor.mutex);
+    self->io->released = true;
+    reactor_wake();
+    SDL_UnlockMutex(reactor.mutex);
+  }
+  self->io = NULL;
+}
+#endif
+
+
 static int push_error_string(lua_State *L, process_error_t err) {
 #ifdef _WIN32
   char *msg = NULL;
@@ -354,6 +671,91 @@ static bool signal_process(process_t* proc, signal_e sig) {
   return true;
 }
 
+#ifndef _WIN32
+extern char **environ;
+
+// Adds the variables of `env`, "KEY=value" strings ending with an empty one, to a copy of
+// the environment, where they replace the variables with the same keys.
+static char **merge_environment(lxl_arena *A, const char *env) {
+  size_t n_env = 0, n_environ = 0;
+  for (const char *var = env; *var; var += strlen(var) + 1) n_env++;
+  while (environ[n_environ]) n_environ++;
+  char **envp = lxl_arena_zero(A, (n_env + n_environ + 1) * sizeof(char *)), **end = envp;
+  for (const char *var = env; *var; var += strlen(var) + 1) {
+    if (strchr(var, '='))
+      *end++ = (char *) var;
+  }
+  for (size_t i = 0; i < n_environ; i++) {
+    const char *eq = strchr(environ[i], '=');
+    size_t key_len = eq ? (size_t) (eq - environ[i]) + 1 : strlen(environ[i]);
+    bool replaced = false;
+    for (char **var = envp; var < envp + n_env && *var && !replaced; var++)
+      replaced = strncmp(*var, environ[i], key_len) == 0;
+    if (!replaced)
+      *end++ = environ[i];
+  }
+  return envp;
+}
+
+// Starts the process with posix_spawn, which unlike fork doesn't copy the page tables of the
+// editor, so that the time it takes doesn't grow with its memory.
+// Returns -1 when the options can't be applied without fork, otherwise the error of posix_spawnp.
+static int spawn_process(lxl_arena *A, process_t *self, const char **cmd, const char *env, const char *cwd, bool detach, int new_fds[3]) {
+  short flags = 0;
+  if (!detach)
+    flags |= POSIX_SPAWN_SETPGROUP;
+  else {
+  #ifdef POSIX_SPAWN_SETSID
+    flags |= POSIX_SPAWN_SETSID;
+  #else
+    return -1;
+  #endif
+  }
+  #ifndef LITE_HAS_SPAWN_CHDIR
+    if (cwd)
+      return -1;
+  #endif
+  // posix_spawnp searches the PATH of the editor, execvp after setenv the one given
+  if (env && !strchr(cmd[0], '/')) {
+    for (const char *var = env; *var; var += strlen(var) + 1) {
+      if (strncmp(var, "PATH=", 5) == 0)
+        return -1;
+    }
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  int err = posix_spawn_file_actions_init(&actions);
+  if (err)
+    return err;
+  if ((err = posix_spawnattr_init(&attr))) {
+    posix_spawn_file_actions_destroy(&actions);
+    return err;
+  }
+  // the pipes are close-on-exec, only their copies are left open
+  for (int stream = 0; stream < 3 && !err; ++stream) {
+    if (new_fds[stream] == REDIRECT_DISCARD)
+      err = posix_spawn_file_actions_addclose(&actions, stream);
+    else if (new_fds[stream] != REDIRECT_PARENT)
+      err = posix_spawn_file_actions_adddup2(&actions, self->child_pipes[new_fds[stream]][new_fds[stream] == STDIN_FD ? 0 : 1], stream);
+  }
+  #ifdef LITE_HAS_SPAWN_CHDIR
+    if (!err && cwd)
+      err = posix_spawn_file_actions_addchdir_np(&actions, cwd);
+  #endif
+  if (!err && !(err = posix_spawnattr_setflags(&attr, flags))) {
+    pid_t pid;
+    err = posix_spawnp(&pid, cmd[0], &actions, &attr, (char *const *) cmd, env ? merge_environment(A, env) : environ);
+    if (!err)
+      self->pid = (long)pid;
+  }
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+  return err;
+}
+#endif
+
+
 static int process_start(lua_State* L) {
   int retval = 1;
   process_t *self = NULL;
@@ -504,12 +906,21 @@ static int process_start(lua_State* L) {
   #else
     int control_pipe[2] = { 0 };
     for (int i = 0; i < 3; ++i) { // Make only the parents fd's non-blocking. Children should block.
-      if (pipe(self->child_pipes[i]) || fcntl(self->child_pipes[i][i == STDIN_FD ? 1 : 0], F_SETFL, O_NONBLOCK) == -1) {
+      if (pipe(self->child_pipes[i]) || fcntl(self->child_pipes[i][i == STDIN_FD ? 1 : 0], F_SETFL, O_NONBLOCK) == -1
+        || fcntl(self->child_pipes[i][0], F_SETFD, FD_CLOEXEC) == -1 || fcntl(self->child_pipes[i][1], F_SETFD, FD_CLOEXEC) == -1) {
         push_error(L, "cannot create pipe", errno);
         retval = -1;
         goto cleanup;
       }
     }
+    int spawn_error = spawn_process(A, self, cmd, env, cwd, detach, new_fds);
+    if (spawn_error >= 0) {
+      if (spawn_error) {
+        lua_pushfstring(L, "Error creating child process: %s", strerror(spawn_error));
+        retval = -1;
+      }
+      goto cleanup;
+    }
     // create a pipe to get the exit code of exec()
     if (pipe(control_pipe) == -1) {
       lua_pushfstring(L, "Error creating control pipe: %s", strerror(errno));
@@ -596,6 +1007,9 @@ static int process_start(lua_State* L) {
     return lua_error(L);
 
   self->running = true;
+  #ifndef _WIN32
+    reactor_add(self);
+  #endif
   return retval;
 }
 
@@ -626,6 +1040,19 @@ static int g_read(lua_State* L, int stream, lua_Integer read_size) {
     }
     lua_pushlstring(L, self->buffer[writable_stream_idx], length);
   #else
+    if (self->io) {
+      process_buffer_t *buffer = &self->io->buffers[stream - 1];
+      SDL_LockMutex(reactor.mutex);
+      size_t size = read_size < 0 ? 0 : (size_t)read_size < buffer->length ? (size_t)read_size : buffer->length;
+      buffer_push(L, buffer, size, size);
+      int error = buffer->eof && !buffer->length ? buffer->error : 0;
+      SDL_UnlockMutex(reactor.mutex);
+      if (error) {
+        signal_process(self, SIGNAL_TERM);
+        return 0;
+      }
+      return 1;
+    }
     luaL_Buffer b;
     luaL_buffinit(L, &b);
     do {
@@ -676,9 +1103,95 @@ static int f_write(lua_State* L) {
   return 1;
 }
 
+#ifndef _WIN32
+static const char *find_delimiter(const char *data, size_t length, const char *delimiter, size_t delimiter_len) {
+  const char *end = data + length;
+  for (const char *p = data; end - p >= (ptrdiff_t)delimiter_len && (p = memchr(p, delimiter[0], end - p - delimiter_len + 1)); p++) {
+    if (memcmp(p, delimiter, delimiter_len) == 0)
+      return p;
+  }
+  return NULL;
+}
+
+// Returns the buffer of an output, with the mutex of the reactor locked.
+static process_buffer_t *lock_buffer(lua_State *L, process_t *self, int stream) {
+  if (stream != STDOUT_FD && stream != STDERR_FD)
+    luaL_error(L, "error: redirect to handles, FILE* and paths are not supported");
+  if (!self->io)
+    luaL_error(L, "error: the output of the process isn't buffered");
+  SDL_LockMutex(reactor.mutex);
+  return &self->io->buffers[stream - 1];
+}
+#endif
+
+// Reads until a delimiter, which is consumed but not returned, or until the end of
+// the stream. Returns nil while the delimiter wasn't read, and whether the stream ended.
+static int f_read_until(lua_State* L) {
+  process_t* self = (process_t*) luaL_checkudata(L, 1, API_TYPE_PROCESS);
+  int stream = luaL_checknumber(L, 2);
+  size_t delimiter_len = 0;
+  const char *delimiter = luaL_checklstring(L, 3, &delimiter_len);
+  luaL_argcheck(L, delimiter_len > 0, 3, "empty delimiter");
+  #if _WIN32
+    (void) self; (void) stream;
+    return luaL_error(L, "error: the output of the process isn't buffered");
+  #else
+    process_buffer_t *buffer = lock_buffer(L, self, stream);
+    const char *data = buffer->data + buffer->start;
+    const char *found = find_delimiter(data, buffer->length, delimiter, delimiter_len);
+    if (found) {
+      buffer_want(buffer, 0);
+      buffer_push(L, buffer, found - data, found - data + delimiter_len);
+    } else if (buffer->eof && buffer->length) {
+      buffer_push(L, buffer, buffer->length, buffer->length);
+    } else {
+      buffer_want(buffer, buffer->eof ? 0 : buffer->length + 1);
+      lua_pushnil(L);
+    }
+    lua_pushboolean(L, buffer->eof && !buffer->length);
+    SDL_UnlockMutex(reactor.mutex);
+    return 2;
+  #endif
+}
+
+// Reads `n` bytes, or what's left at the end of the stream. Returns nil while they
+// weren't read, and whether the stream ended.
+static int f_read_exact(lua_State* L) {
+  process_t* self = (process_t*) luaL_checkudata(L, 1, API_TYPE_PROCESS);
+  int stream = luaL_checknumber(L, 2);
+  lua_Integer n = luaL_checkinteger(L, 3);
+  luaL_argcheck(L, n >= 0, 3, "negative size");
+  #if _WIN32
+    (void) self; (void) stream;
+    return luaL_error(L, "error: the output of the process isn't buffered");
+  #else
+    process_buffer_t *buffer = lock_buffer(L, self, stream);
+    if (buffer->length >= (size_t)n) {
+      buffer_want(buffer, 0);
+      buffer_push(L, buffer, n, n);
+    } else if (buffer->eof && buffer->length) {
+      buffer_push(L, buffer, buffer->length, buffer->length);
+    } else {
+      buffer_want(buffer, buffer->eof ? 0 : n);
+      lua_pushnil(L);
+    }
+    lua_pushboolean(L, buffer->eof && !buffer->length);
+    SDL_UnlockMutex(reactor.mutex);
+    return 2;
+  #endif
+}
+
 static int f_close_stream(lua_State* L) {
   process_t* self = (process_t*) luaL_checkudata(L, 1, API_TYPE_PROCESS);
   int stream = luaL_checknumber(L, 2);
+  #ifndef _WIN32
+    if (self->io && (stream == STDOUT_FD || stream == STDERR_FD)) {
+      SDL_LockMutex(reactor.mutex);
+      self->io->buffers[stream - 1].closed = true;
+      reactor_wake();
+      SDL_UnlockMutex(reactor.mutex);
+    }
+  #endif
   close_fd(&self->child_pipes[stream][stream == STDIN_FD ? 1 : 0]);
   lua_pushboolean(L, 1);
   return 1;
@@ -771,6 +1284,9 @@ static int f_gc(lua_State* L) {
   close_fd(&self->child_pipes[STDIN_FD ][1]);
   close_fd(&self->child_pipes[STDOUT_FD][0]);
   close_fd(&self->child_pipes[STDERR_FD][0]);
+  #ifndef _WIN32
+    reactor_release(self);
+  #endif
   return 0;
 }
 
@@ -788,6 +1304,9 @@ static int process_gc(lua_State *L) {
     kill_list_wait_all(list);
     kill_list_free(list);
   }
+  #ifndef _WIN32
+    reactor_stop();
+  #endif
   return 0;
 }
 
@@ -799,6 +1318,8 @@ static const struct luaL_Reg process_metatable[] = {
   {"read", f_read},
   {"read_stdout", f_read_stdout},
   {"read_stderr", f_read_stderr},
+  {"read_until", f_read_until},
+  {"read_exact", f_read_exact},
   {"write", f_write},
   {"close_stream", f_close_stream},
   {"wait", f_wait},
@@ -835,6 +1356,13 @@ int luaopen_process(lua_State *L) {
   lua_setfield(L, -2, "__gc");
   lua_setmetatable(L, -2);
 
+  #ifndef _WIN32
+    lua_pushboolean(L, reactor_start());
+  #else
+    lua_pushboolean(L, false);
+  #endif
+  lua_setfield(L, -2, "IO_EVENTS");
+
   API_CONSTANT_DEFINE(L, -1, "WAIT_INFINITE", WAIT_INFINITE);
   API_CONSTANT_DEFINE(L, -1, "WAIT_DEADLINE", WAIT_DEADLINE);
 
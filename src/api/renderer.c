@@ -192,6 +192,7 @@ static int f_font_set_tab_size(lua_State *L) {
   RenFont* fonts[FONT_FALLBACK_MAX]; font_retrieve(L, fonts, 1);
   int n = luaL_checknumber(L, 2);
   ren_font_group_set_tab_size(fonts, n);
+  rencache_invalidate_command_lists();
   return 0;
 }
 
@@ -250,6 +251,7 @@ static int f_font_set_size(lua_State *L) {
   }
 #endif
   ren_font_group_set_size(fonts, size, scale);
+  rencache_invalidate_command_lists();
   return 0;
 }
 
@@ -306,6 +308,52 @@ static int f_show_debug(lua_State *L) {
 }
 
 
+static int f_set_render_threads(lua_State *L) {
+  rencache_set_render_threads(luaL_checkinteger(L, 1));
+  return 0;
+}
+
+
+static int f_set_cell_size(lua_State *L) {
+  rencache_set_cell_size(luaL_checkinteger(L, 1));
+  return 0;
+}
+
+
+static int f_get_frame_stats(lua_State *L) {
+  RenCacheStats stats;
+  rencache_get_stats(&stats);
+  lua_newtable(L);
+  lua_pushinteger(L, stats.commands);
+  lua_setfield(L, -2, "commands");
+  lua_pushinteger(L, stats.command_bytes);
+  lua_setfield(L, -2, "command_bytes");
+  lua_pushinteger(L, stats.rects);
+  lua_setfield(L, -2, "rects");
+  lua_pushinteger(L, stats.changed_pixels);
+  lua_setfield(L, -2, "changed_pixels");
+  lua_pushinteger(L, stats.redrawn_pixels);
+  lua_setfield(L, -2, "redrawn_pixels");
+  lua_pushnumber(L, stats.frame_time);
+  lua_setfield(L, -2, "frame_time");
+  lua_pushnumber(L, stats.hash_time);
+  lua_setfield(L, -2, "hash_time");
+  lua_pushnumber(L, stats.merge_time);
+  lua_setfield(L, -2, "merge_time");
+  lua_pushnumber(L, stats.draw_time);
+  lua_setfield(L, -2, "draw_time");
+  lua_pushnumber(L, stats.update_time);
+  lua_setfield(L, -2, "update_time");
+  lua_createtable(L, RENCACHE_HISTOGRAM_BUCKETS, 0);
+  for (int i = 0; i < RENCACHE_HISTOGRAM_BUCKETS; i++) {
+    lua_pushinteger(L, stats.histogram[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "histogram");
+  return 1;
+}
+
+
 static int f_get_size(lua_State *L) {
   int w = 0, h = 0;
   RenWindow *window = ren_get_target_window();
@@ -394,14 +442,77 @@ static int f_draw_text(lua_State *L) {
   return 1;
 }
 
+static int f_begin_record(lua_State *L) {
+  lua_pushinteger(L, rencache_record_begin(ren_get_target_window()));
+  return 1;
+}
+
+
+static int f_end_record(lua_State *L) {
+  size_t start = luaL_checkinteger(L, 1);
+  RenCommandList *list;
+  if (lua_isnoneornil(L, 2)) {
+    list = lua_newuserdatauv(L, sizeof(RenCommandList), 1);
+    *list = (RenCommandList) { 0 };
+    luaL_setmetatable(L, API_TYPE_COMMANDLIST);
+  } else {
+    list = luaL_checkudata(L, 2, API_TYPE_COMMANDLIST);
+    lua_pushvalue(L, 2);
+  }
+  if (!rencache_record_end(ren_get_target_window(), start, list)) {
+    lua_pushnil(L);
+    return 1;
+  }
+  // the list keeps the fonts referenced in this frame alive
+  lua_rawgeti(L, LUA_REGISTRYINDEX, RENDERER_FONT_REF);
+  lua_setiuservalue(L, -2, 1);
+  return 1;
+}
+
+
+static int f_replay(lua_State *L) {
+  RenCommandList *list = luaL_checkudata(L, 1, API_TYPE_COMMANDLIST);
+  if (!rencache_replay(ren_get_target_window(), list)) {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+  // reference the fonts of the list in the reference table of this frame
+  lua_rawgeti(L, LUA_REGISTRYINDEX, RENDERER_FONT_REF);
+  lua_getiuservalue(L, 1, 1);
+  if (lua_istable(L, -1) && lua_istable(L, -2)) {
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+      lua_pushvalue(L, -2);
+      lua_insert(L, -2);
+      lua_rawset(L, -5);
+    }
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+static int f_commandlist_gc(lua_State *L) {
+  RenCommandList *list = luaL_checkudata(L, 1, API_TYPE_COMMANDLIST);
+  rencache_free_command_list(list);
+  return 0;
+}
+
+
 static const luaL_Reg lib[] = {
   { "show_debug",         f_show_debug         },
+  { "set_render_threads", f_set_render_threads },
+  { "set_cell_size",      f_set_cell_size      },
+  { "get_frame_stats",    f_get_frame_stats    },
   { "get_size",           f_get_size           },
   { "begin_frame",        f_begin_frame        },
   { "end_frame",          f_end_frame          },
   { "set_clip_rect",      f_set_clip_rect      },
   { "draw_rect",          f_draw_rect          },
   { "draw_text",          f_draw_text          },
+  { "begin_record",       f_begin_record       },
+  { "end_record",         f_end_record         },
+  { "replay",             f_replay             },
   { NULL,                 NULL                 }
 };
 
@@ -430,5 +541,10 @@ int luaopen_renderer(lua_State *L) {
   lua_pushvalue(L, -1);
   lua_setfield(L, -2, "__index");
   lua_setfield(L, -2, "font");
+
+  luaL_newmetatable(L, API_TYPE_COMMANDLIST);
+  lua_pushcfunction(L, f_commandlist_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
   return 1;
 }
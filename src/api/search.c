@@ -0,0 +1,1058 @@
+#include "alloc.h"
+#include "api.h"
+#include "custom_events.h"
+
+#define PCRE2_CODE_UNIT_WIDTH 8
+
+#include <SDL3/SDL.h>
+#include <pcre2.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define SEARCH_USE_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+  #include <arm_neon.h>
+  #define SEARCH_USE_NEON
+#endif
+
+/* Searches the lines of files for a text or a regex, like the Lua matchers of
+** the projectsearch plugin: each line matching is reported once, with the
+** byte column of its first match and the text around it.
+**
+** A search job has a pool of threads taking the files added with job:add()
+** in turn. Files are read in chunks of whole lines, so that a file changing
+** while it's read can't fault, and texts are found from their first and last
+** bytes 16 at a time before being compared. Regexes are matched line by line,
+** with match data for each thread. A "searched" event with the id of the job
+** is posted when it has new results, collected with job:poll().
+**
+** A job can be given an index of the trigrams of the files, kept on disk
+** between sessions. A file indexed with its current modification time and
+** size is only read if it has all the trigrams of the text, or of the longest
+** literal that every match of the regex has. Other files are indexed while
+** they're searched, so files changed since the last search are updated. The
+** trigrams of a file are stored in a filter setting two of its bits for
+** each, which only gives false positives.
+**
+** A thread that runs out of memory doesn't exit: the files it can't search
+** are counted as searched and the error is returned by job:poll(). */
+
+#define MAX_SEARCH_THREADS 8
+#define READ_SIZE (1 << 20)
+#define CONTEXT_BEFORE 80 /* bytes of the line shown before a match */
+#define CONTEXT_LEN 257
+
+#define INDEX_MAGIC "lxtrigr1"
+#define INDEX_BYTE_ORDER 0x01020304
+#define FILTER_BITS_PER_TRIGRAM 4 /* about 15% false positives for each */
+#define MIN_FILTER_LEN 8
+#define MAX_FILTER_LEN (1 << 17)
+/* more gives a filter matching anything */
+#define MAX_FILE_TRIGRAMS (MAX_FILTER_LEN * 8 / FILTER_BITS_PER_TRIGRAM)
+#define MAX_NAME_LEN 65535
+
+typedef struct SearchResult {
+  struct SearchResult *next;
+  size_t file, line, col, len;
+  char text[];
+} SearchResult;
+
+typedef struct {
+  char *filename;
+  Sint64 modified, size;
+  Uint32 filter_len; /* 0 when it matches anything */
+  bool visited; /* since the index was saved */
+  Uint8 *filter;
+} IndexedFile;
+
+typedef struct {
+  SDL_Mutex *lock;
+  SDL_AtomicInt refs; /* the Lua object and the jobs using it */
+  char *path;
+  /* guarded by the lock */
+  IndexedFile *files;
+  size_t n_files, files_capacity;
+  size_t *slots; /* the files by name, as their index + 1 */
+  size_t n_slots;
+  bool changed;
+} SearchIndex;
+
+typedef struct {
+  SDL_Mutex *lock;
+  SDL_Condition *wake;
+  SDL_Thread *threads[MAX_SEARCH_THREADS];
+  int n_threads;
+  lua_Integer id;
+  /* the pattern, only read once the job is created */
+  pcre2_code *re;
+  char *text;
+  size_t text_len;
+  bool no_case;
+  SearchIndex *index;
+  Uint32 *query; /* trigrams that the files matching have */
+  size_t n_query;
+  SDL_AtomicInt cancelled;
+  /* guarded by the lock */
+  char **files;
+  size_t n_files, files_capacity;
+  size_t next_file, n_searched;
+  bool finished; /* no more files will be added */
+  bool notified;
+  SearchResult *first, *last;
+  const char *error; /* set when a thread ran out of memory */
+} SearchJob;
+
+typedef struct {
+  SearchJob *job;
+  pcre2_match_data *match_data;
+  char *buffer;
+  size_t capacity;
+  size_t file;
+  SearchResult *first, *last; /* of the file being searched */
+  bool failed; /* out of memory while searching the file */
+  /* the trigrams of the file being indexed */
+  bool indexing;
+  bool unfiltered; /* not all its trigrams could be kept */
+  Sint64 modified, size;
+  Uint8 *seen;
+  Uint32 *trigrams;
+  size_t n_trigrams, trigrams_capacity, n_bytes;
+  Uint32 trigram;
+} Searcher;
+
+
+static size_t count_newlines(const char *s, const char *end) {
+  size_t count = 0;
+#if defined(SEARCH_USE_SSE2)
+  __m128i nl = _mm_set1_epi8('\n'), zero = _mm_setzero_si128();
+  while (end - s >= 16) {
+    /* each byte of acc counts up to 255 blocks */
+    __m128i acc = _mm_setzero_si128();
+    for (int i = 0; i < 255 && end - s >= 16; i++, s += 16) {
+      acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) s), nl));
+    }
+    __m128i sums = _mm_sad_epu8(acc, zero);
+    count += _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+  }
+#elif defined(SEARCH_USE_NEON)
+  uint8x16_t nl = vdupq_n_u8('\n');
+  while (end - s >= 16) {
+    uint8x16_t acc = vdupq_n_u8(0);
+    for (int i = 0; i < 255 && end - s >= 16; i++, s += 16) {
+      acc = vsubq_u8(acc, vceqq_u8(vld1q_u8((const uint8_t*) s), nl));
+    }
+    uint64x2_t sums = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(acc)));
+    count += vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1);
+  }
+#endif
+  for (; s < end; s++) { count += *s == '\n'; }
+  return count;
+}
+
+
+/* Setting 0x20 lowers ASCII letters, and only maps the other case to them,
+** so a text is found without case by folding the bytes under its letters. */
+static inline char fold_of(char c) {
+  return ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') ? 0x20 : 0;
+}
+
+
+static bool equals(const char *s, const char *text, size_t len, bool no_case) {
+  if (!no_case) { return memcmp(s, text, len) == 0; }
+  for (size_t i = 0; i < len; i++) {
+    if ((s[i] | fold_of(text[i])) != text[i]) { return false; }
+  }
+  return true;
+}
+
+
+/* Finds the text of the job in [s, end), text which is lowered without
+** case. Blocks are first checked for the first and last bytes of the text at
+** the right distance. */
+static const char* find_text(SearchJob *job, const char *s, const char *end) {
+  const char *text = job->text;
+  size_t len = job->text_len;
+  if ((size_t) (end - s) < len) { return NULL; }
+  const char *last = end - len + 1; /* past the last possible start */
+  char first_c = text[0], last_c = text[len - 1];
+  char first_fold = job->no_case ? fold_of(first_c) : 0;
+  char last_fold = job->no_case ? fold_of(last_c) : 0;
+#if defined(SEARCH_USE_SSE2)
+  __m128i vfirst = _mm_set1_epi8(first_c), vlast = _mm_set1_epi8(last_c);
+  __m128i vfirst_fold = _mm_set1_epi8(first_fold), vlast_fold = _mm_set1_epi8(last_fold);
+  for (; last - s >= 16; s += 16) {
+    __m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i*) s), vfirst_fold);
+    __m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i*) (s + len - 1)), vlast_fold);
+    int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, vfirst), _mm_cmpeq_epi8(b, vlast)));
+    for (int i = 0; mask; i++, mask >>= 1) {
+      if ((mask & 1) && equals(s + i, text, len, job->no_case)) { return s + i; }
+    }
+  }
+#elif defined(SEARCH_USE_NEON)
+  uint8x16_t vfirst = vdupq_n_u8(first_c), vlast = vdupq_n_u8(last_c);
+  uint8x16_t vfirst_fold = vdupq_n_u8(first_fold), vlast_fold = vdupq_n_u8(last_fold);
+  for (; last - s >= 16; s += 16) {
+    uint8x16_t a = vorrq_u8(vld1q_u8((const uint8_t*) s), vfirst_fold);
+    uint8x16_t b = vorrq_u8(vld1q_u8((const uint8_t*) (s + len - 1)), vlast_fold);
+    uint64x2_t eq = vreinterpretq_u64_u8(vandq_u8(vceqq_u8(a, vfirst), vceqq_u8(b, vlast)));
+    if (!(vgetq_lane_u64(eq, 0) | vgetq_lane_u64(eq, 1))) { continue; }
+    for (int i = 0; i < 16; i++) {
+      if ((s[i] | first_fold) == first_c && equals(s + i, text, len, job->no_case)) { return s + i; }
+    }
+  }
+#endif
+  for (; s < last; s++) {
+    if ((*s | first_fold) == first_c && equals(s, text, len, job->no_case)) { return s; }
+  }
+  return NULL;
+}
+
+
+static void add_result(Searcher *searcher, size_t line, const char *start, const char *end, size_t col) {
+  /* the same text as the plugin shows: up to 257 bytes from 80 before the
+  ** match, with "..." where it was cut */
+  size_t from = col > CONTEXT_BEFORE ? col - CONTEXT_BEFORE - 1 : 0;
+  size_t line_len = end - start;
+  size_t len = line_len - from < CONTEXT_LEN ? line_len - from : CONTEXT_LEN;
+  bool cut_before = from > 0, cut_after = from + CONTEXT_LEN < line_len;
+  SearchResult *result = SDL_malloc(sizeof(SearchResult) + len + 6);
+  if (!result) {
+    searcher->failed = true;
+    return;
+  }
+  char *text = result->text;
+  if (cut_before) { memcpy(text, "...", 3); text += 3; }
+  memcpy(text, start + from, len);
+  text += len;
+  if (cut_after) { memcpy(text, "...", 3); text += 3; }
+  result->len = text - result->text;
+  result->next = NULL;
+  result->file = searcher->file;
+  result->line = line;
+  result->col = col;
+  if (searcher->last) {
+    searcher->last->next = result;
+  } else {
+    searcher->first = result;
+  }
+  searcher->last = result;
+}
+
+
+/* Searches the lines in [s, end), the first one being `*line`, which is
+** updated to the line at `end`. */
+static void search_lines(Searcher *searcher, const char *s, const char *end, size_t *line) {
+  SearchJob *job = searcher->job;
+  if (job->re) {
+    while (s < end) {
+      const char *eol = memchr(s, '\n', end - s);
+      if (!eol) { eol = end; }
+      /* errors, like invalid UTF-8 in binary files, are no match */
+      if (pcre2_match(job->re, (PCRE2_SPTR) s, eol - s, 0, 0, searcher->match_data, NULL) >= 0) {
+        PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(searcher->match_data);
+        if (ovector[0] <= ovector[1]) { add_result(searcher, *line, s, eol, ovector[0] + 1); }
+      }
+      s = eol + 1;
+      (*line)++;
+    }
+    /* the last line doesn't end in the range */
+    if (s > end) { (*line)--; }
+    return;
+  }
+  const char *counted = s; /* where *line is known */
+  while (s < end) {
+    const char *match = find_text(job, s, end);
+    if (!match) { break; }
+    *line += count_newlines(counted, match);
+    const char *start = match;
+    while (start > s && start[-1] != '\n') { start--; }
+    const char *eol = memchr(match, '\n', end - match);
+    if (!eol) { eol = end; }
+    add_result(searcher, *line, start, eol, match - start + 1);
+    if (eol == end) { return; }
+    s = counted = eol + 1;
+    (*line)++;
+  }
+  *line += count_newlines(counted, end);
+}
+
+
+static inline Uint32 next_trigram(Uint32 trigram, char c) {
+  return ((trigram << 8) | (Uint8) (c | fold_of(c))) & 0xFFFFFF;
+}
+
+
+/* The two bits of a trigram, from halves of its hash scaled to the filter. */
+static void filter_bits(Uint32 trigram, Uint32 filter_len, Uint32 *a, Uint32 *b) {
+  Uint64 h = trigram * 0x9E3779B97F4A7C15ull;
+  h ^= h >> 29;
+  Uint64 n_bits = (Uint64) filter_len * 8;
+  *a = (Uint32) (((h & 0xFFFFFFFF) * n_bits) >> 32);
+  *b = (Uint32) (((h >> 32) * n_bits) >> 32);
+}
+
+
+static bool filter_matches(IndexedFile *file, Uint32 *query, size_t n_query) {
+  if (file->filter_len == 0) { return true; }
+  for (size_t i = 0; i < n_query; i++) {
+    Uint32 a, b;
+    filter_bits(query[i], file->filter_len, &a, &b);
+    if (!(file->filter[a >> 3] & (1 << (a & 7))) || !(file->filter[b >> 3] & (1 << (b & 7)))) { return false; }
+  }
+  return true;
+}
+
+
+static Uint32 hash_name(const char *s) {
+  Uint32 h = 2166136261u;
+  for (; *s; s++) { h = (h ^ (Uint8) *s) * 16777619u; }
+  return h;
+}
+
+
+/* Returns the slot of the file with this name, or the empty slot where it
+** goes. The index must have slots. */
+static size_t* find_slot(SearchIndex *index, const char *filename) {
+  size_t mask = index->n_slots - 1;
+  for (size_t i = hash_name(filename) & mask;; i = (i + 1) & mask) {
+    size_t slot = index->slots[i];
+    if (!slot || strcmp(index->files[slot - 1].filename, filename) == 0) { return &index->slots[i]; }
+  }
+}
+
+
+/* Returns false, keeping the slots, if they can't be allocated. */
+static bool rehash(SearchIndex *index, size_t n_slots) {
+  size_t *slots = SDL_calloc(n_slots, sizeof(size_t));
+  if (!slots) { return false; }
+  SDL_free(index->slots);
+  index->slots = slots;
+  index->n_slots = n_slots;
+  for (size_t i = 0; i < index->n_files; i++) { *find_slot(index, index->files[i].filename) = i + 1; }
+  return true;
+}
+
+
+/* Takes the name and the filter of the file, replacing the file of that name
+** if there's one. Returns false, leaving them to the caller, when out of
+** memory. */
+static bool put_file(SearchIndex *index, IndexedFile *file) {
+  if ((index->n_files + 1) * 2 > index->n_slots && !rehash(index, index->n_slots ? index->n_slots * 2 : 1024)) {
+    return false;
+  }
+  size_t *slot = find_slot(index, file->filename);
+  if (*slot) {
+    IndexedFile *old = &index->files[*slot - 1];
+    SDL_free(old->filename);
+    SDL_free(old->filter);
+    *old = *file;
+  } else {
+    if (!try_grow((void**) &index->files, &index->files_capacity, index->n_files + 1, sizeof(IndexedFile))) {
+      return false;
+    }
+    index->files[index->n_files++] = *file;
+    *slot = index->n_files;
+  }
+  index->changed = true;
+  return true;
+}
+
+
+static void clear_index(SearchIndex *index) {
+  for (size_t i = 0; i < index->n_files; i++) {
+    SDL_free(index->files[i].filename);
+    SDL_free(index->files[i].filter);
+  }
+  SDL_free(index->files);
+  SDL_free(index->slots);
+  index->files = NULL;
+  index->slots = NULL;
+  index->n_files = index->files_capacity = index->n_slots = 0;
+}
+
+
+static void release_index(SearchIndex *index) {
+  if (SDL_AddAtomicInt(&index->refs, -1) > 1) { return; }
+  clear_index(index);
+  SDL_DestroyMutex(index->lock);
+  SDL_free(index->path);
+  SDL_free(index);
+}
+
+
+/* The index is stored as its magic and byte order, the number of files, and
+** for each their name, modification time, size and filter. */
+static bool read_index(SearchIndex *index, SDL_IOStream *io) {
+  char magic[8];
+  Uint32 order, n_files;
+  if (SDL_ReadIO(io, magic, 8) != 8 || memcmp(magic, INDEX_MAGIC, 8) != 0
+    || SDL_ReadIO(io, &order, 4) != 4 || order != INDEX_BYTE_ORDER
+    || SDL_ReadIO(io, &n_files, 4) != 4) { return false; }
+  for (Uint32 i = 0; i < n_files; i++) {
+    IndexedFile file = { 0 };
+    Uint32 name_len;
+    if (SDL_ReadIO(io, &name_len, 4) != 4 || name_len == 0 || name_len > MAX_NAME_LEN) { return false; }
+    file.filename = check_alloc(SDL_malloc(name_len + 1));
+    file.filename[name_len] = '\0';
+    bool ok = SDL_ReadIO(io, file.filename, name_len) == name_len
+      && SDL_ReadIO(io, &file.modified, 8) == 8
+      && SDL_ReadIO(io, &file.size, 8) == 8
+      && SDL_ReadIO(io, &file.filter_len, 4) == 4
+      && (file.filter_len == 0 || (file.filter_len >= MIN_FILTER_LEN && file.filter_len <= MAX_FILTER_LEN));
+    if (ok && file.filter_len) {
+      file.filter = check_alloc(SDL_malloc(file.filter_len));
+      ok = SDL_ReadIO(io, file.filter, file.filter_len) == file.filter_len;
+    }
+    if (!ok || !put_file(index, &file)) {
+      SDL_free(file.filename);
+      SDL_free(file.filter);
+      return false;
+    }
+  }
+  return true;
+}
+
+
+static bool write_index(SearchIndex *index, SDL_IOStream *io) {
+  Uint32 order = INDEX_BYTE_ORDER, n_files = index->n_files;
+  if (SDL_WriteIO(io, INDEX_MAGIC, 8) != 8 || SDL_WriteIO(io, &order, 4) != 4
+    || SDL_WriteIO(io, &n_files, 4) != 4) { return false; }
+  for (size_t i = 0; i < index->n_files; i++) {
+    IndexedFile *file = &index->files[i];
+    Uint32 name_len = strlen(file->filename);
+    if (SDL_WriteIO(io, &name_len, 4) != 4
+      || SDL_WriteIO(io, file->filename, name_len) != name_len
+      || SDL_WriteIO(io, &file->modified, 8) != 8
+      || SDL_WriteIO(io, &file->size, 8) != 8
+      || SDL_WriteIO(io, &file->filter_len, 4) != 4
+      || (file->filter_len && SDL_WriteIO(io, file->filter, file->filter_len) != file->filter_len)) { return false; }
+  }
+  return true;
+}
+
+
+/* Returns whether the file may match, from its filter if it's indexed and
+** unchanged. Otherwise the searcher indexes it. */
+static bool check_index(Searcher *searcher, const char *filename) {
+  SearchJob *job = searcher->job;
+  SearchIndex *index = job->index;
+  SDL_PathInfo info;
+  if (!SDL_GetPathInfo(filename, &info)) { return false; }
+  bool may_match = true;
+  SDL_LockMutex(index->lock);
+  size_t *slot = index->n_slots ? find_slot(index, filename) : NULL;
+  IndexedFile *file = slot && *slot ? &index->files[*slot - 1] : NULL;
+  searcher->indexing = !file || file->modified != info.modify_time || file->size != (Sint64) info.size;
+  if (!searcher->indexing) {
+    file->visited = true;
+    may_match = filter_matches(file, job->query, job->n_query);
+  }
+  SDL_UnlockMutex(index->lock);
+  searcher->modified = info.modify_time;
+  searcher->size = info.size;
+  return may_match;
+}
+
+
+static void add_trigrams(Searcher *searcher, const char *s, size_t len) {
+  Uint32 trigram = searcher->trigram;
+  for (size_t i = 0; i < len; i++) {
+    trigram = next_trigram(trigram, s[i]);
+    if (++searcher->n_bytes < 3 || searcher->seen[trigram >> 3] & (1 << (trigram & 7))) { continue; }
+    if (searcher->n_trigrams == MAX_FILE_TRIGRAMS || searcher->unfiltered) { break; }
+    if (!try_grow((void**) &searcher->trigrams, &searcher->trigrams_capacity, searcher->n_trigrams + 1, sizeof(Uint32))) {
+      /* indexed with a filter matching anything */
+      searcher->unfiltered = true;
+      break;
+    }
+    searcher->seen[trigram >> 3] |= 1 << (trigram & 7);
+    searcher->trigrams[searcher->n_trigrams++] = trigram;
+  }
+  searcher->trigram = trigram;
+}
+
+
+/* Stores the trigrams of the file read, if it was read whole, and clears
+** them for the next one. */
+static void index_file(Searcher *searcher, const char *filename, bool complete) {
+  SearchIndex *index = searcher->job->index;
+  if (complete && !SDL_GetAtomicInt(&searcher->job->cancelled)) {
+    IndexedFile file = { .modified = searcher->modified, .size = searcher->size, .visited = true };
+    file.filename = SDL_strdup(filename);
+    if (searcher->n_trigrams < MAX_FILE_TRIGRAMS && !searcher->unfiltered) {
+      size_t filter_len = (searcher->n_trigrams * FILTER_BITS_PER_TRIGRAM + 7) / 8;
+      file.filter_len = SDL_clamp(filter_len, MIN_FILTER_LEN, MAX_FILTER_LEN);
+      file.filter = SDL_calloc(1, file.filter_len);
+      if (!file.filter) { file.filter_len = 0; }
+      for (size_t i = 0; file.filter && i < searcher->n_trigrams; i++) {
+        Uint32 a, b;
+        filter_bits(searcher->trigrams[i], file.filter_len, &a, &b);
+        file.filter[a >> 3] |= 1 << (a & 7);
+        file.filter[b >> 3] |= 1 << (b & 7);
+      }
+    }
+    SDL_LockMutex(index->lock);
+    /* a file that can't be indexed is just read again next time */
+    bool put = file.filename && put_file(index, &file);
+    SDL_UnlockMutex(index->lock);
+    if (!put) {
+      SDL_free(file.filename);
+      SDL_free(file.filter);
+    }
+  }
+  for (size_t i = 0; i < searcher->n_trigrams; i++) {
+    searcher->seen[searcher->trigrams[i] >> 3] &= ~(1 << (searcher->trigrams[i] & 7));
+  }
+  searcher->n_trigrams = searcher->n_bytes = 0;
+  searcher->trigram = 0;
+  searcher->indexing = searcher->unfiltered = false;
+}
+
+
+/* Returns whether the file was read until its end. */
+static bool search_file(Searcher *searcher, const char *filename) {
+  SDL_IOStream *io = SDL_IOFromFile(filename, "rb");
+  if (!io) { return false; }
+  SearchJob *job = searcher->job;
+  size_t kept = 0, line = 1;
+  while (!SDL_GetAtomicInt(&job->cancelled)) {
+    /* a line longer than the buffer */
+    if (kept == searcher->capacity
+        && !try_grow((void**) &searcher->buffer, &searcher->capacity, kept + READ_SIZE, 1)) {
+      searcher->failed = true;
+      break;
+    }
+    size_t n = SDL_ReadIO(io, searcher->buffer + kept, searcher->capacity - kept);
+    if (searcher->indexing) { add_trigrams(searcher, searcher->buffer + kept, n); }
+    size_t len = kept + n;
+    if (len == 0) { break; }
+    /* only whole lines are searched until the end of the file */
+    size_t end = len;
+    if (n > 0) {
+      while (end > kept && searcher->buffer[end - 1] != '\n') { end--; }
+      if (end == kept) {
+        kept = len;
+        continue;
+      }
+    }
+    search_lines(searcher, searcher->buffer, searcher->buffer + end, &line);
+    kept = len - end;
+    memmove(searcher->buffer, searcher->buffer + end, kept);
+    if (n == 0) { break; }
+  }
+  bool complete = !searcher->failed && SDL_GetIOStatus(io) == SDL_IO_STATUS_EOF;
+  SDL_CloseIO(io);
+  return complete;
+}
+
+
+static void notify(SearchJob *job) {
+  if (job->notified || SDL_GetAtomicInt(&job->cancelled)) { return; }
+  CustomEvent event;
+  SDL_zero(event);
+  event.data1 = (void*) (intptr_t) job->id;
+  job->notified = push_custom_event("searched", &event);
+}
+
+
+static int search_thread(void *data) {
+  SearchJob *job = data;
+  Searcher searcher = { .job = job };
+  if (job->re) { searcher.match_data = pcre2_match_data_create_from_pattern(job->re, NULL); }
+  /* a bit for each trigram */
+  if (job->index) { searcher.seen = SDL_calloc(1, 1 << 21); }
+  /* without them, the files taken are only counted */
+  bool ready = (!job->re || searcher.match_data) && (!job->index || searcher.seen)
+    && try_grow((void**) &searcher.buffer, &searcher.capacity, READ_SIZE, 1);
+  SDL_LockMutex(job->lock);
+  for (;;) {
+    while (!SDL_GetAtomicInt(&job->cancelled) && job->next_file == job->n_files && !job->finished) {
+      SDL_WaitCondition(job->wake, job->lock);
+    }
+    if (SDL_GetAtomicInt(&job->cancelled) || job->next_file == job->n_files) { break; }
+    searcher.file = job->next_file++;
+    const char *filename = job->files[searcher.file];
+    SDL_UnlockMutex(job->lock);
+    searcher.first = searcher.last = NULL;
+    searcher.failed = !ready;
+    if (ready && (!job->index || check_index(&searcher, filename))) {
+      bool complete = search_file(&searcher, filename);
+      if (searcher.indexing) { index_file(&searcher, filename, complete); }
+    }
+    SDL_LockMutex(job->lock);
+    if (searcher.failed) { job->error = "not enough memory, some files weren't searched"; }
+    if (searcher.first) {
+      if (job->last) {
+        job->last->next = searcher.first;
+      } else {
+        job->first = searcher.first;
+      }
+      job->last = searcher.last;
+    }
+    job->n_searched++;
+    notify(job);
+  }
+  SDL_UnlockMutex(job->lock);
+  pcre2_match_data_free(searcher.match_data);
+  SDL_free(searcher.buffer);
+  SDL_free(searcher.seen);
+  SDL_free(searcher.trigrams);
+  return 0;
+}
+
+
+static SearchJob* check_job(lua_State *L, int idx) {
+  SearchJob *job = luaL_checkudata(L, idx, API_TYPE_SEARCH);
+  luaL_argcheck(L, job->lock != NULL, idx, "job was freed");
+  return job;
+}
+
+
+static void stop_threads(SearchJob *job) {
+  SDL_SetAtomicInt(&job->cancelled, 1);
+  SDL_LockMutex(job->lock);
+  SDL_BroadcastCondition(job->wake);
+  SDL_UnlockMutex(job->lock);
+  for (int i = 0; i < job->n_threads; i++) { SDL_WaitThread(job->threads[i], NULL); }
+  job->n_threads = 0;
+}
+
+
+static void free_results(SearchResult *result) {
+  while (result) {
+    SearchResult *next = result->next;
+    SDL_free(result);
+    result = next;
+  }
+}
+
+
+static void free_job(SearchJob *job) {
+  stop_threads(job);
+  for (size_t i = 0; i < job->n_files; i++) { SDL_free(job->files[i]); }
+  SDL_free(job->files);
+  SDL_free(job->text);
+  SDL_free(job->query);
+  if (job->index) { release_index(job->index); }
+  free_results(job->first);
+  SDL_DestroyCondition(job->wake);
+  SDL_DestroyMutex(job->lock);
+  memset(job, 0, sizeof(SearchJob));
+}
+
+
+static int f_search_gc(lua_State *L) {
+  SearchJob *job = luaL_checkudata(L, 1, API_TYPE_SEARCH);
+  if (job->lock) { free_job(job); }
+  return 0;
+}
+
+
+/* Length of the argument of the escape `\c` that `p` follows, like the digits
+** of \x41 or the braces of \p{L}. */
+static size_t escape_argument(const char *p, size_t len, char c) {
+  size_t j = 0;
+  if (c == 'Q') {
+    /* quoted text runs to \E */
+    while (j < len && !(p[j] == '\\' && j + 1 < len && p[j + 1] == 'E')) { j++; }
+    return j < len ? j + 2 : len;
+  }
+  char close = 0;
+  if (len > 0 && SDL_strchr("xoNpPgku", c)) {
+    if (p[0] == '{') { close = '}'; }
+    else if (p[0] == '<' && (c == 'g' || c == 'k')) { close = '>'; }
+    else if (p[0] == '\'' && (c == 'g' || c == 'k')) { close = '\''; }
+  }
+  if (close) {
+    while (j < len && p[j] != close) { j++; }
+    return j < len ? j + 1 : len;
+  }
+  switch (c) {
+    case 'x': while (j < len && j < 2 && SDL_isxdigit((Uint8) p[j])) { j++; } break;
+    case '0': while (j < len && j < 2 && p[j] >= '0' && p[j] <= '7') { j++; } break;
+    case 'c': j = len > 0; break;
+    case 'p': case 'P': j = len > 0; break;
+    case 'g': if (j < len && (p[j] == '-' || p[j] == '+')) { j++; } /* fallthrough */
+    default:
+      /* back references and octal codes */
+      if (c == 'g' || SDL_isdigit((Uint8) c)) {
+        while (j < len && SDL_isdigit((Uint8) p[j])) { j++; }
+      }
+  }
+  return j;
+}
+
+
+/* Finds the longest run of bytes that every match of a regex has, to narrow
+** the files searched with an index. Anything else ends a run, quantified
+** characters are dropped and alternations give up. Without case, PCRE2 also
+** matches non-ASCII characters to 'k' and 's', so these aren't kept either. */
+static size_t required_literal(const char *p, size_t len, bool no_case, char *out) {
+  if (memchr(p, '|', len)) { return 0; }
+  char *run = check_alloc(SDL_malloc(len + 1));
+  size_t best = 0, n = 0, last = 0; /* where the last character of the run starts */
+  for (size_t i = 0; i <= len;) {
+    char c = i < len ? p[i] : 0;
+    bool literal = i < len;
+    size_t skip = 1;
+    if (i == len) {
+    } else if (c == '\\') {
+      /* only escaped punctuation is itself, anything else ends the run */
+      c = i + 1 < len ? p[i + 1] : 0;
+      literal = c && !(c & 0x80) && SDL_ispunct((Uint8) c);
+      skip = c ? 2 + (literal ? 0 : escape_argument(p + i + 2, len - i - 2, c)) : 1;
+    } else if (c == '[') {
+      /* a class, which may start with ']' and have [:name:] in it */
+      size_t j = i + 1;
+      if (j < len && p[j] == '^') { j++; }
+      if (j < len && p[j] == ']') { j++; }
+      while (j < len && p[j] != ']') {
+        if (p[j] == '\\') { j++; }
+        else if (p[j] == '[' && j + 1 < len && p[j + 1] == ':') {
+          const char *close = SDL_strstr(p + j + 2, ":]");
+          if (close && close < p + len) { j = close - p + 1; }
+        }
+        j++;
+      }
+      literal = false;
+      skip = j - i + 1;
+    } else if (c == '(') {
+      /* groups may change options or look around */
+      if (i + 1 < len && p[i + 1] == '?' && (i + 2 >= len || p[i + 2] != ':')) { n = best = 0; break; }
+      size_t j = i, depth = 0;
+      for (; j < len; j++) {
+        if (p[j] == '\\') { j++; }
+        else if (p[j] == '(') { depth++; }
+        else if (p[j] == ')' && --depth == 0) { break; }
+      }
+      literal = false;
+      skip = j - i + 1;
+    } else if (c == '?' || c == '*' || c == '{') {
+      n = last;
+      literal = false;
+      if (c == '{') {
+        size_t j = i + 1;
+        while (j < len && (SDL_isdigit((Uint8) p[j]) || p[j] == ',' || p[j] == ' ')) { j++; }
+        if (j < len && p[j] == '}') { skip = j - i + 1; }
+      }
+    } else if (c == '+' || c == '.' || c == '^' || c == '$' || c == ')') {
+      literal = false;
+    }
+    if (literal && no_case && ((c & 0x80) || (c | 0x20) == 'k' || (c | 0x20) == 's')) { literal = false; }
+    if (literal) {
+      /* UTF-8 continuation bytes are part of the last character */
+      if ((c & 0xC0) != 0x80) { last = n; }
+      run[n++] = c;
+    } else {
+      if (n > best) { memcpy(out, run, n); best = n; }
+      n = last = 0;
+    }
+    i += skip;
+  }
+  SDL_free(run);
+  return best;
+}
+
+
+static void set_query(SearchJob *job, const char *s, size_t len) {
+  if (len < 3) { return; }
+  job->query = check_alloc(SDL_malloc(sizeof(Uint32) * (len - 2)));
+  Uint32 trigram = next_trigram(next_trigram(0, s[0]), s[1]);
+  for (size_t i = 2; i < len; i++) {
+    trigram = next_trigram(trigram, s[i]);
+    size_t j = 0;
+    while (j < job->n_query && job->query[j] != trigram) { j++; }
+    if (j == job->n_query) { job->query[job->n_query++] = trigram; }
+  }
+}
+
+
+static int f_search_new(lua_State *L) {
+  size_t text_len = 0;
+  const char *text = NULL;
+  pcre2_code *re = NULL;
+  if (lua_type(L, 1) == LUA_TTABLE) {
+    /* compiled regexes are tables with the pattern at 1 */
+    int top = lua_gettop(L);
+    luaL_getmetatable(L, "regex");
+    bool is_regex = lua_getmetatable(L, 1) && lua_rawequal(L, -1, -2);
+    lua_settop(L, top);
+    luaL_argcheck(L, is_regex, 1, "regex expected");
+    lua_rawgeti(L, 1, 1);
+    re = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    luaL_argcheck(L, re != NULL, 1, "invalid regex");
+  } else {
+    text = luaL_checklstring(L, 1, &text_len);
+    luaL_argcheck(L, text_len > 0, 1, "empty text");
+  }
+  bool no_case = lua_toboolean(L, 2);
+  lua_Integer id = luaL_checkinteger(L, 3);
+  SearchIndex **index = lua_isnoneornil(L, 4) ? NULL : luaL_checkudata(L, 4, API_TYPE_SEARCH_INDEX);
+  size_t source_len = 0;
+  const char *source = re ? luaL_optlstring(L, 5, NULL, &source_len) : NULL;
+
+  SearchJob *job = lua_newuserdatauv(L, sizeof(SearchJob), 1);
+  memset(job, 0, sizeof(SearchJob));
+  luaL_setmetatable(L, API_TYPE_SEARCH);
+  /* the regex is kept alive with the job */
+  lua_pushvalue(L, 1);
+  lua_setiuservalue(L, -2, 1);
+  job->id = id;
+  job->re = re;
+  job->no_case = no_case;
+  if (text) {
+    job->text = check_alloc(SDL_malloc(text_len));
+    job->text_len = text_len;
+    for (size_t i = 0; i < text_len; i++) {
+      job->text[i] = no_case ? text[i] | fold_of(text[i]) : text[i];
+    }
+    /* lines don't contain their newline */
+    if (memchr(text, '\n', text_len)) { job->finished = true; }
+  }
+  if (index) {
+    job->index = *index;
+    SDL_AddAtomicInt(&job->index->refs, 1);
+    if (text) {
+      set_query(job, text, text_len);
+    } else if (source) {
+      uint32_t options = 0;
+      pcre2_pattern_info(re, PCRE2_INFO_ARGOPTIONS, &options);
+      char *literal = check_alloc(SDL_malloc(source_len + 1));
+      set_query(job, literal, required_literal(source, source_len, options & PCRE2_CASELESS, literal));
+      SDL_free(literal);
+    }
+  }
+  job->lock = SDL_CreateMutex();
+  job->wake = SDL_CreateCondition();
+  if (job->lock && job->wake) {
+    int n_threads = SDL_clamp(SDL_GetNumLogicalCPUCores(), 1, MAX_SEARCH_THREADS);
+    for (int i = 0; i < n_threads; i++) {
+      SDL_Thread *thread = SDL_CreateThread(search_thread, "search", job);
+      if (!thread) { break; }
+      job->threads[job->n_threads++] = thread;
+    }
+  }
+  if (job->n_threads == 0) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "unable to start the search threads: %s", SDL_GetError());
+    free_job(job);
+    return 2;
+  }
+  return 1;
+}
+
+
+static int f_search_add(lua_State *L) {
+  SearchJob *job = check_job(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  size_t n = luaL_len(L, 2);
+  SDL_LockMutex(job->lock);
+  bool finished = job->finished;
+  SDL_UnlockMutex(job->lock);
+  if (finished || n == 0) { return 0; }
+  char **files = check_alloc(SDL_malloc(sizeof(char*) * n));
+  for (size_t i = 0; i < n; i++) {
+    lua_rawgeti(L, 2, i + 1);
+    const char *filename = lua_tostring(L, -1);
+    files[i] = check_alloc(SDL_strdup(filename ? filename : ""));
+    lua_pop(L, 1);
+  }
+  SDL_LockMutex(job->lock);
+  grow((void**) &job->files, &job->files_capacity, job->n_files + n, sizeof(char*));
+  memcpy(job->files + job->n_files, files, sizeof(char*) * n);
+  job->n_files += n;
+  SDL_BroadcastCondition(job->wake);
+  SDL_UnlockMutex(job->lock);
+  SDL_free(files);
+  return 0;
+}
+
+
+static int f_search_finish(lua_State *L) {
+  SearchJob *job = check_job(L, 1);
+  SDL_LockMutex(job->lock);
+  job->finished = true;
+  SDL_BroadcastCondition(job->wake);
+  /* there may be nothing left to search */
+  if (job->n_searched == job->n_files) { notify(job); }
+  SDL_UnlockMutex(job->lock);
+  return 0;
+}
+
+
+static int f_search_poll(lua_State *L) {
+  SearchJob *job = check_job(L, 1);
+  SDL_LockMutex(job->lock);
+  SearchResult *result = job->first;
+  job->first = job->last = NULL;
+  job->notified = false;
+  size_t n_searched = job->n_searched;
+  bool done = job->finished && n_searched == job->n_files;
+  const char *error = job->error;
+  SDL_UnlockMutex(job->lock);
+
+  lua_newtable(L);
+  for (int i = 1; result; i++) {
+    lua_createtable(L, 0, 4);
+    /* files are only freed with the job */
+    lua_pushstring(L, job->files[result->file]);
+    lua_setfield(L, -2, "file");
+    lua_pushlstring(L, result->text, result->len);
+    lua_setfield(L, -2, "text");
+    lua_pushinteger(L, result->line);
+    lua_setfield(L, -2, "line");
+    lua_pushinteger(L, result->col);
+    lua_setfield(L, -2, "col");
+    lua_rawseti(L, -2, i);
+    SearchResult *next = result->next;
+    SDL_free(result);
+    result = next;
+  }
+  lua_pushinteger(L, n_searched);
+  lua_pushboolean(L, done);
+  if (error) { lua_pushstring(L, error); } else { lua_pushnil(L); }
+  return 4;
+}
+
+
+static int f_search_cancel(lua_State *L) {
+  stop_threads(check_job(L, 1));
+  return 0;
+}
+
+
+static int f_search_load_index(lua_State *L) {
+  const char *path = luaL_checkstring(L, 1);
+  SearchIndex **index = lua_newuserdatauv(L, sizeof(SearchIndex*), 0);
+  *index = NULL;
+  luaL_setmetatable(L, API_TYPE_SEARCH_INDEX);
+  *index = check_alloc(SDL_calloc(1, sizeof(SearchIndex)));
+  SDL_SetAtomicInt(&(*index)->refs, 1);
+  (*index)->path = check_alloc(SDL_strdup(path));
+  (*index)->lock = SDL_CreateMutex();
+  if (!(*index)->lock) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "unable to create the index: %s", SDL_GetError());
+    return 2;
+  }
+  /* a missing or unreadable index is rebuilt as files are searched */
+  SDL_IOStream *io = SDL_IOFromFile(path, "rb");
+  if (io) {
+    if (!read_index(*index, io)) { clear_index(*index); }
+    (*index)->changed = false;
+    SDL_CloseIO(io);
+  }
+  return 1;
+}
+
+
+static SearchIndex* check_index_arg(lua_State *L, int idx) {
+  SearchIndex **index = luaL_checkudata(L, idx, API_TYPE_SEARCH_INDEX);
+  luaL_argcheck(L, *index && (*index)->lock, idx, "invalid index");
+  return *index;
+}
+
+
+static int f_index_save(lua_State *L) {
+  SearchIndex *index = check_index_arg(L, 1);
+  bool prune = lua_toboolean(L, 2);
+  SDL_LockMutex(index->lock);
+  if (prune) {
+    size_t n = 0;
+    for (size_t i = 0; i < index->n_files; i++) {
+      if (index->files[i].visited) {
+        index->files[n++] = index->files[i];
+      } else {
+        SDL_free(index->files[i].filename);
+        SDL_free(index->files[i].filter);
+      }
+    }
+    if (n < index->n_files) {
+      index->n_files = n;
+      index->changed = true;
+      /* the slots are stale, the index is rebuilt as files are searched */
+      if (!rehash(index, index->n_slots)) { clear_index(index); }
+    }
+  }
+  for (size_t i = 0; i < index->n_files; i++) { index->files[i].visited = false; }
+  bool saved = !index->changed;
+  if (!saved) {
+    /* written aside first, so that a failure leaves the old index whole */
+    char *tmp = check_alloc(SDL_malloc(strlen(index->path) + 5));
+    sprintf(tmp, "%s.tmp", index->path);
+    SDL_IOStream *io = SDL_IOFromFile(tmp, "wb");
+    if (io) {
+      saved = write_index(index, io);
+      saved = SDL_CloseIO(io) && saved;
+      saved = saved && SDL_RenamePath(tmp, index->path);
+      if (!saved) { SDL_RemovePath(tmp); }
+    }
+    SDL_free(tmp);
+    index->changed = !saved;
+  }
+  SDL_UnlockMutex(index->lock);
+  if (!saved) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "unable to save the index to %s: %s", index->path, SDL_GetError());
+    return 2;
+  }
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+
+static int f_index_gc(lua_State *L) {
+  SearchIndex **index = luaL_checkudata(L, 1, API_TYPE_SEARCH_INDEX);
+  if (*index) { release_index(*index); }
+  *index = NULL;
+  return 0;
+}
+
+
+static int searched_callback(lua_State *L, SDL_Event *e) {
+  lua_pushstring(L, "searched");
+  lua_pushinteger(L, (intptr_t) e->user.data1);
+  return 2;
+}
+
+
+static const luaL_Reg search_lib[] = {
+  { "new",        f_search_new        },
+  { "load_index", f_search_load_index },
+  { "__gc",       f_search_gc         },
+  { "add",        f_search_add        },
+  { "finish",     f_search_finish     },
+  { "poll",       f_search_poll       },
+  { "cancel",     f_search_cancel     },
+  { NULL, NULL }
+};
+
+
+static const luaL_Reg index_lib[] = {
+  { "__gc", f_index_gc   },
+  { "save", f_index_save },
+  { NULL, NULL }
+};
+
+
+int luaopen_search(lua_State *L) {
+  if (!register_custom_event("searched", searched_callback)) {
+    return luaL_error(L, "Unable to register custom searched event: %s", SDL_GetError());
+  }
+  luaL_newmetatable(L, API_TYPE_SEARCH_INDEX);
+  luaL_setfuncs(L, index_lib, 0);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+  luaL_newmetatable(L, API_TYPE_SEARCH);
+  luaL_setfuncs(L, search_lib, 0);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  return 1;
+}
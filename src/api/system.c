@@ -14,6 +14,13 @@
 #include "../renwindow.h"
 #include "arena_allocator.h"
 #include "custom_events.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define FUZZY_USE_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+  #include <arm_neon.h>
+  #define FUZZY_USE_NEON
+#endif
 #ifdef _WIN32
   #include <direct.h>
   #include <windows.h>
@@ -924,20 +931,20 @@ static int f_exec(lua_State *L) {
   return 0;
 }
 
-static int f_fuzzy_match(lua_State *L) {
-  size_t strLen, ptnLen;
-  const char *str = luaL_checklstring(L, 1, &strLen);
-  const char *ptn = luaL_checklstring(L, 2, &ptnLen);
+// Returns false if the pattern doesn't match, otherwise sets `result` to the
+// score of the match.
+static bool fuzzy_score(const char *str, size_t strLen, const char *ptn, size_t ptnLen, bool files, int *result) {
   // If true match things *backwards*. This allows for better matching on filenames than the above
   // function. For example, in the lite project, opening "renderer" has lib/font_render/build.sh
   // as the first result, rather than src/renderer.c. Clearly that's wrong.
-  bool files = lua_gettop(L) > 2 && lua_isboolean(L,3) && lua_toboolean(L, 3);
   int score = 0, run = 0, increment = files ? -1 : 1;
   const char* strTarget = files ? str + strLen - 1 : str;
   const char* ptnTarget = files ? ptn + ptnLen - 1 : ptn;
   while (strTarget >= str && ptnTarget >= ptn && *strTarget && *ptnTarget) {
     while (strTarget >= str && *strTarget == ' ') { strTarget += increment; }
     while (ptnTarget >= ptn && *ptnTarget == ' ') { ptnTarget += increment; }
+    // don't read past the strings after skipping spaces
+    if (strTarget < str || ptnTarget < ptn || !*strTarget) { break; }
     if (tolower(*strTarget) == tolower(*ptnTarget)) {
       score += run * 10 - (*strTarget != *ptnTarget);
       run++;
@@ -948,8 +955,153 @@ static int f_fuzzy_match(lua_State *L) {
     }
     strTarget += increment;
   }
-  if (ptnTarget >= ptn && *ptnTarget) { return 0; }
-  lua_pushinteger(L, score - (int)strLen * 10);
+  if (ptnTarget >= ptn && *ptnTarget) { return false; }
+  *result = score - (int)strLen * 10;
+  return true;
+}
+
+static int f_fuzzy_match(lua_State *L) {
+  size_t strLen, ptnLen;
+  const char *str = luaL_checklstring(L, 1, &strLen);
+  const char *ptn = luaL_checklstring(L, 2, &ptnLen);
+  bool files = lua_gettop(L) > 2 && lua_isboolean(L,3) && lua_toboolean(L, 3);
+  int score;
+  if (!fuzzy_score(str, strLen, ptn, ptnLen, files, &score)) { return 0; }
+  lua_pushinteger(L, score);
+  return 1;
+}
+
+// Finds the first character of `str` that is `c` once lowered, `c` being a
+// lowered character.
+static const char* fuzzy_find_char(const char *str, const char *end, char c) {
+  // setting 0x20 lowers ASCII letters, and only maps the other case to them
+  char fold = (c >= 'a' && c <= 'z') ? 0x20 : 0;
+#if defined(FUZZY_USE_SSE2)
+  __m128i vfold = _mm_set1_epi8(fold), vc = _mm_set1_epi8(c);
+  for (; end - str >= 16; str += 16) {
+    __m128i v = _mm_or_si128(_mm_loadu_si128((const __m128i*) str), vfold);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, vc))) { break; }
+  }
+#elif defined(FUZZY_USE_NEON)
+  uint8x16_t vfold = vdupq_n_u8(fold), vc = vdupq_n_u8(c);
+  for (; end - str >= 16; str += 16) {
+    uint64x2_t eq = vreinterpretq_u64_u8(vceqq_u8(vorrq_u8(vld1q_u8((const uint8_t*) str), vfold), vc));
+    if (vgetq_lane_u64(eq, 0) | vgetq_lane_u64(eq, 1)) { break; }
+  }
+#endif
+  for (; str < end; str++) {
+    if ((*str | fold) == c) { return str; }
+  }
+  return NULL;
+}
+
+typedef struct {
+  int score;
+  size_t index;
+  const char *text;
+  size_t len;
+} FuzzyMatch;
+
+// Best matches first, by score and then by text.
+static int fuzzy_match_compare(const FuzzyMatch *a, const FuzzyMatch *b) {
+  if (a->score != b->score) { return a->score > b->score ? -1 : 1; }
+  int cmp = memcmp(a->text, b->text, a->len < b->len ? a->len : b->len);
+  if (cmp != 0) { return cmp; }
+  if (a->len != b->len) { return a->len < b->len ? -1 : 1; }
+  return a->index < b->index ? -1 : (a->index > b->index);
+}
+
+static int fuzzy_match_qsort_compare(const void *a, const void *b) {
+  return fuzzy_match_compare(a, b);
+}
+
+// Keeps the `limit` best matches in a heap with the worst one on top.
+static void fuzzy_heap_push(FuzzyMatch *heap, size_t *count, size_t limit, FuzzyMatch match) {
+  size_t i;
+  if (*count < limit) {
+    i = (*count)++;
+    while (i > 0 && fuzzy_match_compare(&heap[(i - 1) / 2], &match) < 0) {
+      heap[i] = heap[(i - 1) / 2];
+      i = (i - 1) / 2;
+    }
+  } else {
+    if (fuzzy_match_compare(&match, &heap[0]) >= 0) { return; }
+    i = 0;
+    for (;;) {
+      size_t child = i * 2 + 1;
+      if (child >= *count) { break; }
+      if (child + 1 < *count && fuzzy_match_compare(&heap[child + 1], &heap[child]) > 0) { child++; }
+      if (fuzzy_match_compare(&heap[child], &match) <= 0) { break; }
+      heap[i] = heap[child];
+      i = child;
+    }
+  }
+  heap[i] = match;
+}
+
+static int f_fuzzy_match_list(lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  size_t ptnLen;
+  const char *ptn = luaL_checklstring(L, 2, &ptnLen);
+  bool files = lua_toboolean(L, 3);
+  lua_Integer limit = luaL_optinteger(L, 4, 0);
+  lua_Integer n = luaL_len(L, 1);
+  lua_settop(L, 4);
+
+  // items that aren't strings are converted first, and kept alive in a table
+  lua_newtable(L);
+  for (lua_Integer i = 1; i <= n; i++) {
+    if (lua_rawgeti(L, 1, i) != LUA_TSTRING) {
+      luaL_tolstring(L, -1, NULL);
+      lua_rawseti(L, 5, i);
+    }
+    lua_pop(L, 1);
+  }
+
+  // the lowered characters of the pattern, which must all be found in order
+  // before scoring an item
+  char *needle = SDL_malloc(ptnLen + 1);
+  if (!needle) { return luaL_error(L, "out of memory"); }
+  size_t needleLen = 0;
+  bool prefilter = memchr(ptn, '\0', ptnLen) == NULL;
+  for (size_t i = 0; i < ptnLen; i++) {
+    if (ptn[i] != ' ') { needle[needleLen++] = tolower(ptn[i]); }
+  }
+
+  size_t capacity = limit > 0 && limit < n ? limit : (n > 0 ? n : 1), count = 0;
+  FuzzyMatch *matches = SDL_malloc(sizeof(FuzzyMatch) * capacity);
+  if (!matches) {
+    SDL_free(needle);
+    return luaL_error(L, "out of memory");
+  }
+  for (lua_Integer i = 1; i <= n; i++) {
+    FuzzyMatch match = { .index = i };
+    int table = lua_rawgeti(L, 1, i) == LUA_TSTRING ? 1 : 5;
+    if (table == 5) { lua_rawgeti(L, 5, i); }
+    match.text = lua_tolstring(L, -1, &match.len);
+    lua_pop(L, table == 5 ? 2 : 1);
+    if (prefilter) {
+      const char *s = match.text, *end = match.text + match.len;
+      size_t k = 0;
+      for (; k < needleLen && (s = fuzzy_find_char(s, end, needle[k])); k++) { s++; }
+      if (k < needleLen) { continue; }
+    }
+    if (!fuzzy_score(match.text, match.len, ptn, ptnLen, files, &match.score)) { continue; }
+    if (capacity < (size_t) n) {
+      fuzzy_heap_push(matches, &count, capacity, match);
+    } else {
+      matches[count++] = match;
+    }
+  }
+  SDL_free(needle);
+  qsort(matches, count, sizeof(FuzzyMatch), fuzzy_match_qsort_compare);
+
+  lua_createtable(L, count, 0);
+  for (size_t i = 0; i < count; i++) {
+    lua_pushinteger(L, matches[i].index);
+    lua_rawseti(L, -2, i + 1);
+  }
+  SDL_free(matches);
   return 1;
 }
 
@@ -1519,6 +1671,7 @@ static const luaL_Reg lib[] = {
   { "sleep",                 f_sleep                 },
   { "exec",                  f_exec                  },
   { "fuzzy_match",           f_fuzzy_match           },
+  { "fuzzy_match_list",      f_fuzzy_match_list      },
   { "set_window_opacity",    f_set_window_opacity    },
   { "load_native_plugin",    f_load_native_plugin    },
   { "path_compare",          f_path_compare          },
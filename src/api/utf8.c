@@ -1131,6 +1131,51 @@ static int find_aux (lua_State *L, int find) {
 static int Lutf8_find (lua_State *L) { return find_aux(L, 1); }
 static int Lutf8_match (lua_State *L) { return find_aux(L, 0); }
 
+/* same as find_aux, for the native lexer: finds the pattern [p, ep) in the
+ * subject [s, es) starting at `init`, and returns the start of the match or
+ * NULL. The end of the match is stored in `end`, and where each capture
+ * starts in `captures`, which must hold LUA_MAXCAPTURES entries. */
+const char *utf8_pattern_find (lua_State *L, const char *s, const char *es,
+                               const char *init, const char *p, const char *ep,
+                               int anchor, const char **end,
+                               const char **captures, int *ncaptures) {
+  MatchState ms;
+  int i;
+  if (init > es) return NULL;
+  *ncaptures = 0;
+  if (!anchor && nospecials(p, ep)) {
+    const char *s2 = lmemfind(init, es-init, p, ep-p);
+    if (s2) {
+      const char *e2 = s2 + (ep - p);
+      if (iscont(e2)) e2 = utf8_next(e2, es);
+      *end = e2;
+    }
+    return s2;
+  }
+  ms.L = L;
+  ms.matchdepth = MAXCCALLS;
+  ms.src_init = s;
+  ms.src_end = es;
+  ms.p_end = ep;
+  do {
+    const char *res;
+    ms.level = 0;
+    if ((res=match(&ms, init, p)) != NULL) {
+      *end = res;
+      *ncaptures = ms.level;
+      for (i = 0; i < ms.level; i++) {
+        if (ms.capture[i].len == CAP_UNFINISHED)
+          luaL_error(L, "unfinished capture");
+        captures[i] = ms.capture[i].init;
+      }
+      return init;
+    }
+    if (init == es) break;
+    init = utf8_next(init, es);
+  } while (init <= es && !anchor);
+  return NULL;
+}
+
 static int gmatch_aux (lua_State *L) {
   MatchState ms;
   const char *es, *s = check_utf8(L, lua_upvalueindex(1), &es);
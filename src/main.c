@@ -224,6 +224,7 @@ init_lua:
   // so we can free the custom events.
   free_custom_events();
 
+  rencache_set_render_threads(1);
   ren_free();
 
   return EXIT_SUCCESS;
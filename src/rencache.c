@@ -26,12 +26,38 @@
 ** of hash values, take the cells that have changed since the previous frame,
 ** merge them into dirty rectangles and redraw only those regions */
 
-#define CELLS_X 80
-#define CELLS_Y 50
-#define CELL_SIZE 96
+/* while hashing we also build an index of the drawing commands per row of
+** cells, so that each dirty rectangle only replays the commands that may touch
+** it instead of walking the whole command buffer again */
+
+/* a sequence of commands can also be recorded into a command list, and pushed
+** again verbatim in the next frame if the code that issued them knows its
+** output didn't change. Lists are only valid for the frame right after the one
+** they were recorded or replayed in, and are dropped whenever the screen size
+** or a font they may use changes */
+
+/* optionally, large redraws are split into horizontal bands that are replayed
+** in parallel by a pool of worker threads. Each worker draws to its own alias of
+** the window surface (same pixels, separate clip rect), and the bands never
+** overlap, so workers never touch the same pixels */
+
+/* the cell size is given in pixels and converted to points for the grid, the
+** grid itself is sized to the window at the start of each frame */
+#define CELL_SIZE_DEFAULT 96
+#define CELL_SIZE_MIN 16
+#define CELL_SIZE_MAX 512
 #define CMD_BUF_RESIZE_RATE 1.2
 #define CMD_BUF_INIT_SIZE (1024 * 512)
 #define COMMAND_BARE_SIZE offsetof(Command, command)
+#define RENDER_THREADS_MAX 16
+/* redraws smaller than this (in points) are not worth waking the workers up */
+#define PARALLEL_MIN_AREA (CELL_SIZE_DEFAULT * CELL_SIZE_DEFAULT * 8)
+/* changed cells are merged into a rect only while the unchanged cells it drags
+** along stay below this many cells, or below 1/MERGE_WASTE_RATIO of its area */
+#define MERGE_WASTE_CELLS 2
+#define MERGE_WASTE_RATIO 4
+/* number of frames accounted in the frame time histogram */
+#define FRAME_HISTORY 256
 
 enum CommandType { SET_CLIP, DRAW_TEXT, DRAW_RECT };
 
@@ -63,33 +89,129 @@ typedef struct {
   RenColor color;
 } DrawRectCommand;
 
-static unsigned cells_buf1[CELLS_X * CELLS_Y];
-static unsigned cells_buf2[CELLS_X * CELLS_Y];
-static unsigned *cells_prev = cells_buf1;
-static unsigned *cells = cells_buf2;
-static RenRect rect_buf[CELLS_X * CELLS_Y / 2];
+typedef struct {
+  Command *cmd;
+  RenRect bounds; /* area the command may draw to, already clipped */
+  RenRect clip;   /* clip rect in effect when the command was issued */
+} CommandRef;
+
+static int cell_size_pixels = CELL_SIZE_DEFAULT;
+static int cell_size = CELL_SIZE_DEFAULT;
+static int cells_x, cells_y;
+static uint64_t *cells_buf;
+static uint64_t *cells_prev;
+static uint64_t *cells;
+static RenRect *rect_buf;
+static int *rect_cells; /* number of changed cells in each rect_buf entry */
+static RenCacheStats frame_stats;
+static unsigned frame_count;
+static unsigned command_list_generation;
+static Uint64 frame_start;
+static uint8_t frame_history[FRAME_HISTORY]; /* histogram bucket of each frame */
+static int frame_history_count, frame_history_pos;
 static bool resize_issue;
+static bool cell_grid_warned; /* until the cell grid is allocated again */
 static RenRect screen_rect;
 static RenRect last_clip_rect;
 static bool show_debug;
+static CommandRef *command_refs;
+static size_t command_refs_size;
+static int *row_refs;
+static size_t row_refs_size;
+static int *row_refs_start; /* cells_y + 1 entries */
+static int *row_refs_fill;  /* cells_y entries */
+
+typedef struct {
+  SDL_Thread *thread;
+  RenSurface surface; /* shares the pixels of the window surface */
+  RenRect band;
+  unsigned frame;     /* last frame drawn by this worker */
+} RenderWorker;
+
+static struct {
+  SDL_Mutex *mutex;
+  SDL_Condition *start, *done;
+  RenderWorker workers[RENDER_THREADS_MAX - 1];
+  int count;
+  int pending;
+  unsigned frame;
+  bool quit;
+  int rect_count;
+} pool;
 
 static inline int rencache_min(int a, int b) { return a < b ? a : b; }
 static inline int rencache_max(int a, int b) { return a > b ? a : b; }
 
 
-/* 32bit fnv-1a hash */
-#define HASH_INITIAL 2166136261
+/* 64bit multiply-rotate hash (xxh64 rounds). Commands are hashed 32 bytes at a
+** time over four independent lanes, and they are always padded to
+** alignof(max_align_t), so the byte tail loop practically never runs */
+#define HASH_INITIAL 0x27D4EB2F165667C5ULL
+#define HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME3 0x165667B19E3779F9ULL
+#define HASH_PRIME4 0x85EBCA77C2B2AE63ULL
+
+static inline uint64_t hash_rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hash_read(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t v) {
+  return hash_rotl(acc + v * HASH_PRIME2, 31) * HASH_PRIME1;
+}
+
+static inline uint64_t hash_merge(uint64_t h, uint64_t acc) {
+  return (h ^ hash_round(0, acc)) * HASH_PRIME1 + HASH_PRIME4;
+}
 
-static void hash(unsigned *h, const void *data, int size) {
+static uint64_t hash(const void *data, size_t size) {
   const unsigned char *p = data;
-  while (size--) {
-    *h = (*h ^ *p++) * 16777619;
+  uint64_t h;
+  size_t len = size;
+  if (size >= 32) {
+    uint64_t v1 = HASH_PRIME1 + HASH_PRIME2, v2 = HASH_PRIME2, v3 = 0, v4 = 0 - HASH_PRIME1;
+    do {
+      v1 = hash_round(v1, hash_read(p));
+      v2 = hash_round(v2, hash_read(p + 8));
+      v3 = hash_round(v3, hash_read(p + 16));
+      v4 = hash_round(v4, hash_read(p + 24));
+      p += 32;
+      size -= 32;
+    } while (size >= 32);
+    h = hash_rotl(v1, 1) + hash_rotl(v2, 7) + hash_rotl(v3, 12) + hash_rotl(v4, 18);
+    h = hash_merge(hash_merge(hash_merge(hash_merge(h, v1), v2), v3), v4);
+  } else {
+    h = HASH_INITIAL;
+  }
+  h += len;
+  for (; size >= 8; p += 8, size -= 8) {
+    h = hash_rotl(h ^ hash_round(0, hash_read(p)), 27) * HASH_PRIME1 + HASH_PRIME4;
+  }
+  for (; size > 0; p++, size--) {
+    h = hash_rotl(h ^ (*p * HASH_INITIAL), 11) * HASH_PRIME1;
   }
+  h ^= h >> 33;
+  h *= HASH_PRIME2;
+  h ^= h >> 29;
+  h *= HASH_PRIME3;
+  h ^= h >> 32;
+  return h;
+}
+
+/* folds a command hash into a cell; the order of the commands matters */
+static inline uint64_t hash_combine(uint64_t cell, uint64_t h) {
+  return hash_rotl(cell ^ h, 27) * HASH_PRIME1 + HASH_PRIME4;
 }
 
 
 static inline int cell_idx(int x, int y) {
-  return x + y * CELLS_X;
+  return x + y * cells_x;
 }
 
 
@@ -130,6 +252,18 @@ static bool expand_command_buffer(RenWindow *window_renderer) {
   return true;
 }
 
+static bool reserve_commands(RenWindow *window_renderer, size_t n) {
+  while (n > window_renderer->command_buf_size) {
+    if (!expand_command_buffer(window_renderer)) {
+      fprintf(stderr, "Warning: (" __FILE__ "): unable to resize command buffer (%zu)\n",
+              (size_t)(window_renderer->command_buf_size * CMD_BUF_RESIZE_RATE));
+      resize_issue = true;
+      return false;
+    }
+  }
+  return true;
+}
+
 static void* push_command(RenWindow *window_renderer, enum CommandType type, int size) {
   if (!window_renderer || resize_issue) {
     // Don't push new commands as we had problems resizing the command buffer.
@@ -141,13 +275,8 @@ static void* push_command(RenWindow *window_renderer, enum CommandType type, int
   size += COMMAND_BARE_SIZE;
   size = (size + alignment) & ~alignment;
   int n = window_renderer->command_buf_idx + size;
-  while (n > window_renderer->command_buf_size) {
-    if (!expand_command_buffer(window_renderer)) {
-      fprintf(stderr, "Warning: (" __FILE__ "): unable to resize command buffer (%zu)\n",
-              (size_t)(window_renderer->command_buf_size * CMD_BUF_RESIZE_RATE));
-      resize_issue = true;
-      return NULL;
-    }
+  if (!reserve_commands(window_renderer, n)) {
+    return NULL;
   }
   Command *cmd = (Command*) (window_renderer->command_buf + window_renderer->command_buf_idx);
   window_renderer->command_buf_idx = n;
@@ -216,134 +345,637 @@ double rencache_draw_text(RenWindow *window_renderer, RenFont **fonts, const cha
 }
 
 
+size_t rencache_record_begin(RenWindow *window_renderer) {
+  return window_renderer ? window_renderer->command_buf_idx : 0;
+}
+
+
+bool rencache_record_end(RenWindow *window_renderer, size_t start, RenCommandList *list) {
+  if (!window_renderer || resize_issue || start > window_renderer->command_buf_idx) {
+    return false;
+  }
+  size_t size = window_renderer->command_buf_idx - start;
+  if (size > list->capacity) {
+    uint8_t *buf = SDL_realloc(list->buf, size);
+    if (!buf) { return false; }
+    list->buf = buf;
+    list->capacity = size;
+  }
+  memcpy(list->buf, window_renderer->command_buf + start, size);
+  list->size = size;
+  list->clip = last_clip_rect;
+  list->frame = frame_count;
+  list->generation = command_list_generation;
+  return true;
+}
+
+
+bool rencache_replay(RenWindow *window_renderer, RenCommandList *list) {
+  if (!window_renderer || resize_issue || list->frame + 1 != frame_count
+      || list->generation != command_list_generation) {
+    return false;
+  }
+  if (!reserve_commands(window_renderer, window_renderer->command_buf_idx + list->size)) {
+    return false;
+  }
+  memcpy(window_renderer->command_buf + window_renderer->command_buf_idx, list->buf, list->size);
+  window_renderer->command_buf_idx += list->size;
+  last_clip_rect = list->clip;
+  list->frame = frame_count;
+  return true;
+}
+
+
+void rencache_free_command_list(RenCommandList *list) {
+  SDL_free(list->buf);
+  *list = (RenCommandList) { 0 };
+}
+
+
+void rencache_invalidate_command_lists(void) {
+  command_list_generation++;
+}
+
+
 void rencache_invalidate(void) {
-  memset(cells_prev, 0xff, sizeof(cells_buf1));
+  if (cells_prev) {
+    memset(cells_prev, 0xff, sizeof(uint64_t) * cells_x * cells_y);
+  }
+}
+
+
+void rencache_set_cell_size(int size) {
+  cell_size_pixels = rencache_max(CELL_SIZE_MIN, rencache_min(CELL_SIZE_MAX, size));
+}
+
+
+static void free_cell_grid(void) {
+  SDL_free(cells_buf);
+  SDL_free(rect_buf);
+  SDL_free(rect_cells);
+  SDL_free(row_refs_start);
+  cells_buf = cells = cells_prev = NULL;
+  rect_buf = NULL;
+  rect_cells = NULL;
+  row_refs_start = row_refs_fill = NULL;
+  cells_x = cells_y = 0;
+}
+
+
+/* (re)allocates the grid so that it covers the whole screen */
+static bool resize_cell_grid(int width, int height, int size) {
+  int nx = width / size + 1;
+  int ny = height / size + 1;
+  cell_size = size;
+  if (cells_buf && nx == cells_x && ny == cells_y) {
+    rencache_invalidate();
+    return true;
+  }
+  free_cell_grid();
+  size_t count = (size_t) nx * ny;
+  cells_buf = SDL_malloc(sizeof(uint64_t) * count * 2);
+  rect_buf = SDL_malloc(sizeof(RenRect) * count);
+  rect_cells = SDL_malloc(sizeof(int) * count);
+  row_refs_start = SDL_malloc(sizeof(int) * (ny * 2 + 1));
+  if (!cells_buf || !rect_buf || !rect_cells || !row_refs_start) {
+    free_cell_grid();
+    return false;
+  }
+  cells_x = nx;
+  cells_y = ny;
+  cells = cells_buf;
+  cells_prev = cells_buf + count;
+  row_refs_fill = row_refs_start + ny + 1;
+  for (size_t i = 0; i < count; i++) {
+    cells[i] = HASH_INITIAL;
+  }
+  rencache_invalidate();
+  return true;
 }
 
 
 void rencache_begin_frame(RenWindow *window_renderer) {
-  /* reset all cells if the screen width/height has changed */
+  /* reset all cells if the screen width/height or the cell size has changed */
   int w, h;
+  frame_start = SDL_GetPerformanceCounter();
+  frame_count++;
   resize_issue = false;
   ren_get_size(window_renderer, &w, &h);
-  if (screen_rect.width != w || h != screen_rect.height) {
+  RenSurface rs = renwin_get_surface(window_renderer);
+  int size = rencache_max(CELL_SIZE_MIN, cell_size_pixels / rs.scale);
+  if (screen_rect.width != w || h != screen_rect.height || size != cell_size || !cells_buf) {
+    if (screen_rect.width != w || h != screen_rect.height) {
+      rencache_invalidate_command_lists();
+    }
     screen_rect.width = w;
     screen_rect.height = h;
-    rencache_invalidate();
+    if (resize_cell_grid(w, h, size)) {
+      cell_grid_warned = false;
+    } else if (!cell_grid_warned) {
+      /* retried every frame, so only reported once */
+      fprintf(stderr, "Warning: (" __FILE__ "): unable to allocate the cell grid, redrawing the whole window\n");
+      cell_grid_warned = true;
+    }
   }
   last_clip_rect = screen_rect;
 }
 
 
-static void update_overlapping_cells(RenRect r, unsigned h) {
-  int x1 = r.x / CELL_SIZE;
-  int y1 = r.y / CELL_SIZE;
-  int x2 = (r.x + r.width) / CELL_SIZE;
-  int y2 = (r.y + r.height) / CELL_SIZE;
+static void update_overlapping_cells(RenRect r, uint64_t h) {
+  int x1 = r.x / cell_size;
+  int y1 = r.y / cell_size;
+  int x2 = (r.x + r.width) / cell_size;
+  int y2 = (r.y + r.height) / cell_size;
 
   for (int y = y1; y <= y2; y++) {
     for (int x = x1; x <= x2; x++) {
       int idx = cell_idx(x, y);
-      hash(&cells[idx], &h, sizeof(h));
+      cells[idx] = hash_combine(cells[idx], h);
     }
   }
 }
 
 
-static void push_rect(RenRect r, int *count) {
-  /* try to merge with existing rectangle */
-  for (int i = *count - 1; i >= 0; i--) {
-    RenRect *rp = &rect_buf[i];
-    if (rects_overlap(*rp, r)) {
-      *rp = merge_rects(*rp, r);
+static bool reserve_buffer(void **buf, size_t *size, size_t count, size_t elem_size) {
+  if (count <= *size) { return true; }
+  size_t new_size = *size ? *size : 256;
+  while (new_size < count) { new_size *= 2; }
+  void *new_buf = SDL_realloc(*buf, new_size * elem_size);
+  if (!new_buf) { return false; }
+  *buf = new_buf;
+  *size = new_size;
+  return true;
+}
+
+
+static inline int cell_row_first(RenRect r) {
+  return rencache_max(0, r.y / cell_size);
+}
+
+
+static inline int cell_row_last(RenRect r) {
+  return rencache_min(cells_y - 1, (r.y + r.height) / cell_size);
+}
+
+
+static RenRect command_bounds(Command *cmd, RenRect visible, RenRect clip) {
+  if (cmd->type != DRAW_TEXT) { return visible; }
+  /* glyphs can overhang the measured text rect (italic, underline, ...),
+  ** so pad it to avoid losing those pixels when a nearby region is redrawn */
+  RenRect r = cmd->command[0];
+  int pad = r.height / 2;
+  r = (RenRect) { r.x - pad, r.y - pad, r.width + pad * 2, r.height + pad * 2 };
+  return intersect_rects(r, clip);
+}
+
+
+/* Build the per-row index from the command references collected by the
+** hashing pass. Each row lists the references that overlap it, in draw order. */
+static bool build_row_index(size_t ref_count) {
+  memset(row_refs_start, 0, sizeof(int) * (cells_y + 1));
+  for (size_t i = 0; i < ref_count; i++) {
+    RenRect b = command_refs[i].bounds;
+    for (int y = cell_row_first(b); y <= cell_row_last(b); y++) {
+      row_refs_start[y + 1]++;
+    }
+  }
+  for (int y = 0; y < cells_y; y++) {
+    row_refs_start[y + 1] += row_refs_start[y];
+  }
+  if (!reserve_buffer((void **) &row_refs, &row_refs_size, row_refs_start[cells_y], sizeof(int))) {
+    return false;
+  }
+  memcpy(row_refs_fill, row_refs_start, sizeof(int) * cells_y);
+  for (size_t i = 0; i < ref_count; i++) {
+    RenRect b = command_refs[i].bounds;
+    for (int y = cell_row_first(b); y <= cell_row_last(b); y++) {
+      row_refs[row_refs_fill[y]++] = i;
+    }
+  }
+  return true;
+}
+
+
+static void draw_command(RenSurface *rs, Command *cmd) {
+  DrawRectCommand *rcmd = (DrawRectCommand*)&cmd->command;
+  DrawTextCommand *tcmd = (DrawTextCommand*)&cmd->command;
+  switch (cmd->type) {
+    case DRAW_RECT:
+      ren_draw_rect(rs, rcmd->rect, rcmd->color);
+      break;
+    case DRAW_TEXT:
+      ren_draw_text(rs, tcmd->fonts, tcmd->text, tcmd->len, tcmd->text_x, tcmd->rect.y, tcmd->color, tcmd->tab, tcmd->tab_size);
+      break;
+    default:
+      break;
+  }
+}
+
+
+/* Replays, in their original order, only the commands indexed in the rows
+** covered by the region. References spanning multiple rows appear in more than
+** one list, so the lists are merged and duplicates are skipped. */
+static void draw_region_indexed(RenSurface *rs, RenRect region) {
+  int y1 = cell_row_first(region);
+  int y2 = rencache_min(cells_y - 1, (region.y + region.height - 1) / cell_size);
+  /* cursors are indexed by row, offset so that only rows y1..y2 are stored */
+  int *cursor = SDL_stack_alloc(int, y2 - y1 + 1) - y1;
+  for (int y = y1; y <= y2; y++) {
+    cursor[y] = row_refs_start[y];
+  }
+  RenRect current_clip = region;
+  ren_set_surface_clip_rect(rs, current_clip);
+
+  for (;;) {
+    int next = -1;
+    for (int y = y1; y <= y2; y++) {
+      if (cursor[y] < row_refs_start[y + 1] && (next < 0 || row_refs[cursor[y]] < next)) {
+        next = row_refs[cursor[y]];
+      }
+    }
+    if (next < 0) { break; }
+    for (int y = y1; y <= y2; y++) {
+      if (cursor[y] < row_refs_start[y + 1] && row_refs[cursor[y]] == next) {
+        cursor[y]++;
+      }
+    }
+
+    CommandRef *ref = &command_refs[next];
+    if (!rects_overlap(ref->bounds, region)) { continue; }
+    RenRect clip = intersect_rects(ref->clip, region);
+    if (memcmp(&clip, &current_clip, sizeof(RenRect)) != 0) {
+      ren_set_surface_clip_rect(rs, clip);
+      current_clip = clip;
+    }
+    draw_command(rs, ref->cmd);
+  }
+  SDL_stack_free(cursor + y1);
+}
+
+
+static void draw_region(RenWindow *window_renderer, RenSurface *rs, RenRect region) {
+  ren_set_surface_clip_rect(rs, region);
+  Command *cmd = NULL;
+  while (next_command(window_renderer, &cmd)) {
+    if (cmd->type == SET_CLIP) {
+      SetClipCommand *ccmd = (SetClipCommand*)&cmd->command;
+      ren_set_surface_clip_rect(rs, intersect_rects(ccmd->rect, region));
+    } else {
+      draw_command(rs, cmd);
+    }
+  }
+}
+
+
+static void draw_band(RenSurface *rs, RenRect band, int rect_count) {
+  for (int i = 0; i < rect_count; i++) {
+    RenRect r = intersect_rects(rect_buf[i], band);
+    if (r.width > 0 && r.height > 0) {
+      draw_region_indexed(rs, r);
+    }
+  }
+}
+
+
+static int render_worker(void *data) {
+  RenderWorker *worker = data;
+  SDL_LockMutex(pool.mutex);
+  for (;;) {
+    while (!pool.quit && pool.frame == worker->frame) {
+      SDL_WaitCondition(pool.start, pool.mutex);
+    }
+    if (pool.quit) { break; }
+    worker->frame = pool.frame;
+    SDL_UnlockMutex(pool.mutex);
+    draw_band(&worker->surface, worker->band, pool.rect_count);
+    SDL_LockMutex(pool.mutex);
+    if (--pool.pending == 0) {
+      SDL_SignalCondition(pool.done);
+    }
+  }
+  SDL_UnlockMutex(pool.mutex);
+  return 0;
+}
+
+
+static void stop_render_workers(void) {
+  if (pool.count == 0) { return; }
+  SDL_LockMutex(pool.mutex);
+  pool.quit = true;
+  SDL_BroadcastCondition(pool.start);
+  SDL_UnlockMutex(pool.mutex);
+  for (int i = 0; i < pool.count; i++) {
+    SDL_WaitThread(pool.workers[i].thread, NULL);
+    SDL_DestroySurface(pool.workers[i].surface.surface);
+    pool.workers[i] = (RenderWorker) { 0 };
+  }
+  pool.count = 0;
+  pool.quit = false;
+}
+
+
+void rencache_set_render_threads(int count) {
+  count = rencache_max(1, rencache_min(RENDER_THREADS_MAX, count)) - 1;
+  if (count == pool.count) { return; }
+  stop_render_workers();
+  if (count == 0) { return; }
+  if (!pool.mutex) {
+    pool.mutex = SDL_CreateMutex();
+    pool.start = SDL_CreateCondition();
+    pool.done = SDL_CreateCondition();
+    if (!pool.mutex || !pool.start || !pool.done) {
+      fprintf(stderr, "Warning: (" __FILE__ "): unable to create render threads: %s\n", SDL_GetError());
       return;
     }
   }
-  /* couldn't merge with previous rectangle: push */
-  rect_buf[(*count)++] = r;
+  for (int i = 0; i < count; i++) {
+    RenderWorker *worker = &pool.workers[pool.count];
+    worker->frame = pool.frame;
+    worker->thread = SDL_CreateThread(render_worker, "render_worker", worker);
+    if (!worker->thread) {
+      fprintf(stderr, "Warning: (" __FILE__ "): unable to create render thread: %s\n", SDL_GetError());
+      break;
+    }
+    pool.count++;
+  }
+}
+
+
+/* the workers need their own SDL_Surface to have their own clip rect */
+static bool update_worker_surface(RenderWorker *worker, RenSurface *rs) {
+  SDL_Surface *s = rs->surface, *ws = worker->surface.surface;
+  if (!ws || ws->pixels != s->pixels || ws->w != s->w || ws->h != s->h || ws->format != s->format) {
+    SDL_DestroySurface(ws);
+    ws = SDL_CreateSurfaceFrom(s->w, s->h, s->format, s->pixels, s->pitch);
+    worker->surface.surface = ws;
+  }
+  worker->surface.scale = rs->scale;
+  return ws != NULL;
+}
+
+
+/* Splits the redrawn area in horizontal bands, one per thread, and draws them
+** in parallel. The calling thread draws the first band. */
+static void draw_parallel(RenSurface *rs, int rect_count) {
+  int y1 = screen_rect.height, y2 = 0;
+  for (int i = 0; i < rect_count; i++) {
+    y1 = rencache_min(y1, rect_buf[i].y);
+    y2 = rencache_max(y2, rect_buf[i].y + rect_buf[i].height);
+  }
+  int workers = 0;
+  for (; workers < pool.count; workers++) {
+    if (!update_worker_surface(&pool.workers[workers], rs)) { break; }
+  }
+  int band_height = (y2 - y1 + workers) / (workers + 1);
+  for (int i = 0; i < workers; i++) {
+    int y = y1 + band_height * (i + 1);
+    pool.workers[i].band = (RenRect) { 0, y, screen_rect.width, rencache_min(band_height, y2 - y) };
+  }
+
+  ren_set_parallel_drawing(true);
+  SDL_LockMutex(pool.mutex);
+  pool.rect_count = rect_count;
+  pool.pending = workers;
+  pool.frame++;
+  SDL_BroadcastCondition(pool.start);
+  SDL_UnlockMutex(pool.mutex);
+
+  draw_band(rs, (RenRect) { 0, y1, screen_rect.width, band_height }, rect_count);
+
+  SDL_LockMutex(pool.mutex);
+  while (pool.pending > 0) {
+    SDL_WaitCondition(pool.done, pool.mutex);
+  }
+  SDL_UnlockMutex(pool.mutex);
+  ren_set_parallel_drawing(false);
+}
+
+
+/* Dirty rects are built greedily, one row of cells at a time: changed cells are
+** joined into spans along the row, then each span either extends the rect
+** ending right above it that wastes the fewest unchanged cells, or starts a new
+** rect. Unchanged cells are redrawn for nothing, but every extra rect costs
+** another replay of the commands touching it, so small waste is accepted. */
+static inline bool merge_worth_it(int area, int changed) {
+  int waste = area - changed;
+  return waste <= MERGE_WASTE_CELLS || waste * MERGE_WASTE_RATIO <= area;
+}
+
+
+static bool overlaps_other_rect(RenRect r, int self, int count) {
+  for (int i = 0; i < count; i++) {
+    RenRect o = rect_buf[i];
+    if (i != self && o.x < r.x + r.width && r.x < o.x + o.width
+        && o.y < r.y + r.height && r.y < o.y + o.height) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+static void push_span(int x1, int x2, int y, int changed, int *count) {
+  RenRect span = { x1, y, x2 - x1, 1 };
+  int best = -1, best_waste = 0;
+  RenRect best_rect;
+  for (int i = *count - 1; i >= 0; i--) {
+    RenRect r = rect_buf[i];
+    if (r.y + r.height != y) { continue; }
+    RenRect m = merge_rects(r, span);
+    int area = m.width * m.height;
+    int waste = area - rect_cells[i] - changed;
+    if (!merge_worth_it(area, rect_cells[i] + changed) || (best >= 0 && waste >= best_waste)) {
+      continue;
+    }
+    /* keep rects disjoint, or the overlapping part would be drawn twice */
+    if (overlaps_other_rect(m, i, *count)) { continue; }
+    best = i;
+    best_waste = waste;
+    best_rect = m;
+  }
+  if (best >= 0) {
+    rect_buf[best] = best_rect;
+    rect_cells[best] += changed;
+    return;
+  }
+  rect_buf[*count] = span;
+  rect_cells[*count] = changed;
+  (*count)++;
+}
+
+
+void rencache_get_stats(RenCacheStats *stats) {
+  *stats = frame_stats;
+}
+
+
+static double elapsed_time(Uint64 from, Uint64 to) {
+  static double frequency;
+  if (frequency == 0) {
+    frequency = SDL_GetPerformanceFrequency();
+  }
+  return (to - from) / frequency;
+}
+
+
+static void record_frame_time(double frame_time) {
+  int bucket = 0;
+  for (double limit = 0.00025; bucket < RENCACHE_HISTOGRAM_BUCKETS - 1 && frame_time >= limit; limit *= 2) {
+    bucket++;
+  }
+  if (frame_history_count == FRAME_HISTORY) {
+    frame_stats.histogram[frame_history[frame_history_pos]]--;
+  } else {
+    frame_history_count++;
+  }
+  frame_history[frame_history_pos] = bucket;
+  frame_history_pos = (frame_history_pos + 1) % FRAME_HISTORY;
+  frame_stats.histogram[bucket]++;
+  frame_stats.frame_time = frame_time;
+}
+
+
+/* without a cell grid there is nothing to compare against */
+static void redraw_all(RenWindow *window_renderer) {
+  RenSurface rs = renwin_get_surface(window_renderer);
+  frame_stats.rects = 1;
+  frame_stats.changed_pixels = frame_stats.redrawn_pixels =
+    (int64_t) screen_rect.width * screen_rect.height * rs.scale * rs.scale;
+  Uint64 draw_start = SDL_GetPerformanceCounter();
+  draw_region(window_renderer, &rs, screen_rect);
+  Uint64 update_start = SDL_GetPerformanceCounter();
+  ren_update_rects(window_renderer, &screen_rect, 1);
+  Uint64 end = SDL_GetPerformanceCounter();
+  frame_stats.hash_time = frame_stats.merge_time = 0;
+  frame_stats.draw_time = elapsed_time(draw_start, update_start);
+  frame_stats.update_time = elapsed_time(update_start, end);
+  record_frame_time(elapsed_time(frame_start, end));
 }
 
 
 void rencache_end_frame(RenWindow *window_renderer) {
-  /* update cells from commands */
+  Uint64 hash_start = SDL_GetPerformanceCounter();
   Command *cmd = NULL;
+  frame_stats.commands = 0;
+  frame_stats.command_bytes = window_renderer->command_buf_idx;
+  if (!cells_buf) {
+    while (next_command(window_renderer, &cmd)) { frame_stats.commands++; }
+    redraw_all(window_renderer);
+    window_renderer->command_buf_idx = 0;
+    return;
+  }
+
+  /* update cells from commands */
   RenRect cr = screen_rect;
+  size_t ref_count = 0;
+  bool indexed = true;
   while (next_command(window_renderer, &cmd)) {
+    frame_stats.commands++;
     /* cmd->command[0] should always be the Command rect */
     if (cmd->type == SET_CLIP) { cr = cmd->command[0]; }
     RenRect r = intersect_rects(cmd->command[0], cr);
     if (r.width == 0 || r.height == 0) { continue; }
-    unsigned h = HASH_INITIAL;
-    hash(&h, cmd, cmd->size);
-    update_overlapping_cells(r, h);
+    update_overlapping_cells(r, hash(cmd, cmd->size));
+    if (cmd->type == SET_CLIP || !indexed) { continue; }
+    /* if the index cannot grow we fall back to replaying every command */
+    if (!reserve_buffer((void **) &command_refs, &command_refs_size, ref_count + 1, sizeof(CommandRef))) {
+      indexed = false;
+      continue;
+    }
+    command_refs[ref_count++] = (CommandRef) { cmd, command_bounds(cmd, r, cr), cr };
   }
 
   /* push rects for all cells changed from last frame, reset cells */
+  Uint64 merge_start = SDL_GetPerformanceCounter();
   int rect_count = 0;
-  int max_x = screen_rect.width / CELL_SIZE + 1;
-  int max_y = screen_rect.height / CELL_SIZE + 1;
-  for (int y = 0; y < max_y; y++) {
-    for (int x = 0; x < max_x; x++) {
+  int64_t changed_area = 0;
+  for (int y = 0; y < cells_y; y++) {
+    int span_x = -1, span_end = 0, span_changed = 0;
+    int cell_h = rencache_min(cell_size, screen_rect.height - y * cell_size);
+    for (int x = 0; x < cells_x; x++) {
       /* compare previous and current cell for change */
       int idx = cell_idx(x, y);
       if (cells[idx] != cells_prev[idx]) {
-        push_rect((RenRect) { x, y, 1, 1 }, &rect_count);
+        if (span_x >= 0 && !merge_worth_it(x + 1 - span_x, span_changed + 1)) {
+          push_span(span_x, span_end, y, span_changed, &rect_count);
+          span_x = -1;
+        }
+        if (span_x < 0) {
+          span_x = x;
+          span_changed = 0;
+        }
+        span_end = x + 1;
+        span_changed++;
+        changed_area += (int64_t) rencache_min(cell_size, screen_rect.width - x * cell_size) * cell_h;
       }
       cells_prev[idx] = HASH_INITIAL;
     }
+    if (span_x >= 0) {
+      push_span(span_x, span_end, y, span_changed, &rect_count);
+    }
   }
 
   /* expand rects from cells to pixels */
   for (int i = 0; i < rect_count; i++) {
     RenRect *r = &rect_buf[i];
-    r->x *= CELL_SIZE;
-    r->y *= CELL_SIZE;
-    r->width *= CELL_SIZE;
-    r->height *= CELL_SIZE;
+    r->x *= cell_size;
+    r->y *= cell_size;
+    r->width *= cell_size;
+    r->height *= cell_size;
     *r = intersect_rects(*r, screen_rect);
   }
 
-  RenSurface rs = renwin_get_surface(window_renderer);
-  /* redraw updated regions */
+  int64_t dirty_area = 0;
   for (int i = 0; i < rect_count; i++) {
-    /* draw */
-    RenRect r = rect_buf[i];
-    ren_set_clip_rect(window_renderer, r);
+    dirty_area += rect_buf[i].width * rect_buf[i].height;
+  }
 
-    cmd = NULL;
-    while (next_command(window_renderer, &cmd)) {
-      SetClipCommand *ccmd = (SetClipCommand*)&cmd->command;
-      DrawRectCommand *rcmd = (DrawRectCommand*)&cmd->command;
-      DrawTextCommand *tcmd = (DrawTextCommand*)&cmd->command;
-      switch (cmd->type) {
-        case SET_CLIP:
-          ren_set_clip_rect(window_renderer, intersect_rects(ccmd->rect, r));
-          break;
-        case DRAW_RECT:
-          ren_draw_rect(&rs, rcmd->rect, rcmd->color);
-          break;
-        case DRAW_TEXT:
-          ren_font_group_set_tab_size(tcmd->fonts, tcmd->tab_size);
-          ren_draw_text(&rs, tcmd->fonts, tcmd->text, tcmd->len, tcmd->text_x, tcmd->rect.y, tcmd->color, tcmd->tab);
-          break;
+  Uint64 draw_start = SDL_GetPerformanceCounter();
+  if (rect_count > 0 && indexed) {
+    indexed = build_row_index(ref_count);
+  }
+
+  RenSurface rs = renwin_get_surface(window_renderer);
+  frame_stats.rects = rect_count;
+  frame_stats.changed_pixels = changed_area * rs.scale * rs.scale;
+  frame_stats.redrawn_pixels = dirty_area * rs.scale * rs.scale;
+
+  /* redraw updated regions */
+  if (indexed && pool.count > 0 && dirty_area >= PARALLEL_MIN_AREA) {
+    draw_parallel(&rs, rect_count);
+  } else {
+    for (int i = 0; i < rect_count; i++) {
+      if (indexed) {
+        draw_region_indexed(&rs, rect_buf[i]);
+      } else {
+        draw_region(window_renderer, &rs, rect_buf[i]);
       }
     }
+  }
 
-    if (show_debug) {
+  if (show_debug) {
+    for (int i = 0; i < rect_count; i++) {
       RenColor color = { rand(), rand(), rand(), 50 };
-      ren_draw_rect(&rs, r, color);
+      ren_set_surface_clip_rect(&rs, rect_buf[i]);
+      ren_draw_rect(&rs, rect_buf[i], color);
     }
   }
 
   /* update dirty rects */
+  Uint64 update_start = SDL_GetPerformanceCounter();
   if (rect_count > 0) {
     ren_update_rects(window_renderer, rect_buf, rect_count);
   }
+  Uint64 end = SDL_GetPerformanceCounter();
+  frame_stats.hash_time = elapsed_time(hash_start, merge_start);
+  frame_stats.merge_time = elapsed_time(merge_start, draw_start);
+  frame_stats.draw_time = elapsed_time(draw_start, update_start);
+  frame_stats.update_time = elapsed_time(update_start, end);
+  record_frame_time(elapsed_time(frame_start, end));
 
   /* swap cell buffer and reset */
-  unsigned *tmp = cells;
+  uint64_t *tmp = cells;
   cells = cells_prev;
   cells_prev = tmp;
   window_renderer->command_buf_idx = 0;
 }
-
@@ -5,10 +5,46 @@
 #include <lua.h>
 #include "renderer.h"
 
+#define RENCACHE_HISTOGRAM_BUCKETS 11
+
+typedef struct {
+  int commands;           /* commands pushed during the last frame */
+  size_t command_bytes;   /* size of those commands */
+  int rects;              /* dirty rects redrawn in the last frame */
+  int64_t changed_pixels; /* pixels covered by the cells that changed */
+  int64_t redrawn_pixels; /* pixels covered by the dirty rects */
+  /* time spent in the last frame, in seconds */
+  double frame_time;      /* from rencache_begin_frame to the end of rencache_end_frame */
+  double hash_time;       /* hashing the commands into cells */
+  double merge_time;      /* building the dirty rects */
+  double draw_time;       /* replaying the commands in the dirty rects */
+  double update_time;     /* presenting the dirty rects */
+  /* frame times of the recent frames, bucket i counts the frames that took
+  ** less than 0.25ms * 2^i, the last one counts all the slower frames */
+  int histogram[RENCACHE_HISTOGRAM_BUCKETS];
+} RenCacheStats;
+
+typedef struct {
+  uint8_t *buf;
+  size_t size;
+  size_t capacity;
+  RenRect clip;        /* clip rect in effect after the commands */
+  unsigned frame;      /* last frame the commands were pushed in */
+  unsigned generation;
+} RenCommandList;
+
 void  rencache_show_debug(bool enable);
+void  rencache_set_render_threads(int count);
+void  rencache_set_cell_size(int size);
 void  rencache_set_clip_rect(RenWindow *window_renderer, RenRect rect);
 void  rencache_draw_rect(RenWindow *window_renderer, RenRect rect, RenColor color);
 double rencache_draw_text(RenWindow *window_renderer, RenFont **font, const char *text, size_t len, double x, int y, RenColor color, RenTab tab);
+void  rencache_get_stats(RenCacheStats *stats);
+size_t rencache_record_begin(RenWindow *window_renderer);
+bool  rencache_record_end(RenWindow *window_renderer, size_t start, RenCommandList *list);
+bool  rencache_replay(RenWindow *window_renderer, RenCommandList *list);
+void  rencache_free_command_list(RenCommandList *list);
+void  rencache_invalidate_command_lists(void);
 void  rencache_invalidate(void);
 void  rencache_begin_frame(RenWindow *window_renderer);
 void  rencache_end_frame(RenWindow *window_renderer);
@@ -10,6 +10,14 @@
 #include FT_OUTLINE_H
 #include FT_SYSTEM_H
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define RENDERER_USE_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+  #include <arm_neon.h>
+  #define RENDERER_USE_NEON
+#endif
+
 #include "renderer.h"
 #include "renwindow.h"
 
@@ -23,6 +31,17 @@ static size_t window_count = 0;
 // draw_rect_surface is used as a 1x1 surface to simplify ren_draw_rect with blending
 static SDL_Surface *draw_rect_surface = NULL;
 static FT_Library library = NULL;
+// guards the glyph caches and draw_rect_surface while rencache draws from multiple threads
+static SDL_Mutex *draw_mutex = NULL;
+static bool draw_mutex_enabled = false;
+
+static inline void draw_lock(void) {
+  if (draw_mutex_enabled) SDL_LockMutex(draw_mutex);
+}
+
+static inline void draw_unlock(void) {
+  if (draw_mutex_enabled) SDL_UnlockMutex(draw_mutex);
+}
 
 #define check_alloc(P) _check_alloc(P, __FILE__, __LINE__)
 static void* _check_alloc(void *ptr, const char *const file, size_t ln) {
@@ -369,7 +388,7 @@ static inline int is_whitespace(unsigned int codepoint) {
   return (codepoint >= 0x9 && codepoint <= 0xD) || (codepoint >= 0x2000 && codepoint <= 0x200A);
 }
 
-static RenFont *font_group_get_glyph(RenFont **fonts, unsigned int codepoint, int subpixel_idx, SDL_Surface **surface, GlyphMetric **metric) {
+static RenFont *font_group_get_glyph(RenFont **fonts, unsigned int codepoint, int subpixel_idx, SDL_Surface **surface, GlyphMetric **metric, unsigned int *glyph) {
   if (subpixel_idx < 0) subpixel_idx += SUBPIXEL_BITMAPS_CACHED;
   RenFont *font = NULL;
   unsigned int glyph_id = 0;
@@ -383,13 +402,18 @@ static RenFont *font_group_get_glyph(RenFont **fonts, unsigned int codepoint, in
   GlyphMetric *m = font_load_glyph_metric(font, glyph_id, subpixel_idx);
   // try the box drawing character (0x25A1) if the requested codepoint is not a whitespace, and we cannot load the .notdef glyph
   if ((!m || !m->flags) && codepoint != 0x25A1 && !is_whitespace(codepoint))
-    return font_group_get_glyph(fonts, 0x25A1, subpixel_idx, surface, metric);
+    return font_group_get_glyph(fonts, 0x25A1, subpixel_idx, surface, metric, glyph);
   if (metric && m) *metric = m;
+  if (glyph) *glyph = glyph_id;
   if (surface && m) *surface = font_load_glyph_bitmap(font, glyph_id, subpixel_idx);
   return font;
 }
 
+static void glyph_run_cache_clear(void);
+
 static void font_clear_glyph_cache(RenFont* font) {
+  // glyph runs reference the font and its metrics
+  glyph_run_cache_clear();
   for (int glyph_format_idx = 0; glyph_format_idx < EGlyphFormatSize; glyph_format_idx++) {
     for (int atlas_idx = 0; atlas_idx < font->glyphs.natlas[glyph_format_idx]; atlas_idx++) {
       GlyphAtlas *atlas = &font->glyphs.atlas[glyph_format_idx][atlas_idx];
@@ -554,14 +578,14 @@ int ren_font_group_get_height(RenFont **fonts) {
 }
 
 // some fonts provide xadvance for whitespaces (e.g. Unifont), which we need to ignore
-float font_get_xadvance(RenFont *font, unsigned int codepoint, GlyphMetric *metric, double curr_x, RenTab tab) {
+float font_get_xadvance(RenFont *font, unsigned int codepoint, GlyphMetric *metric, double curr_x, RenTab tab, int tab_chars) {
   if (!is_whitespace(codepoint) && metric && metric->xadvance) {
     return metric->xadvance;
   }
   if (codepoint != '\t') {
     return font->space_advance;
   }
-  float tab_size = font->space_advance * font->tab_size;
+  float tab_size = font->space_advance * tab_chars;
   if (isnan(tab.offset)) {
     return tab_size;
   }
@@ -574,24 +598,171 @@ float font_get_xadvance(RenFont *font, unsigned int codepoint, GlyphMetric *metr
   return adv;
 }
 
-double ren_font_group_get_width(RenFont **fonts, const char *text, size_t len, RenTab tab, int *x_offset) {
-  double width = 0;
-  const char* end = text + len;
+/******************* Glyph runs **********************/
+
+// maximum length of all the strings kept by the run cache, each byte costs about 25 bytes of memory
+#define GLYPH_RUN_CACHE_SIZE (1 << 18)
+// number of buckets of the run cache hash table, must be a power of 2
+#define GLYPH_RUN_CACHE_BUCKETS 4096
+// strings longer than this are measured / drawn without being cached
+#define GLYPH_RUN_MAX_LEN 1024
+
+// a glyph resolved from a codepoint of a run
+typedef struct {
+  RenFont *font;
+  unsigned int glyph_id;
+  float xadvance;
+  bool whitespace, has_metric;
+} RunGlyph;
+
+// a decoded string, with its glyphs already looked up in the font group,
+// shared by ren_font_group_get_width and ren_draw_text.
+// The subpixel bitmaps are picked when drawing, so runs don't depend on the position.
+typedef struct GlyphRun {
+  struct GlyphRun *bucket_next, *lru_prev, *lru_next;
+  uint64_t hash;
+  RenFont *fonts[FONT_FALLBACK_MAX];
+  RenTab tab;
+  int tab_size;
+  double width;
+  size_t len, nglyphs;
+  char *text;
+  RunGlyph glyphs[];
+} GlyphRun;
+
+static struct {
+  GlyphRun *buckets[GLYPH_RUN_CACHE_BUCKETS];
+  GlyphRun *lru_first, *lru_last; // most and least recently used
+  size_t size;
+} glyph_runs;
+
+static uint64_t glyph_run_hash(RenFont **fonts, const char *text, size_t len, RenTab tab, int tab_size) {
+  // 64bit fnv-1a
+  uint64_t h = 14695981039346656037ULL;
+  const unsigned char *p = (const unsigned char *) text;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ p[i]) * 1099511628211ULL;
+  const uint64_t extra[] = { (uintptr_t) fonts[0], (uintptr_t) fonts[1], (uint64_t) tab_size };
+  p = (const unsigned char *) extra;
+  for (size_t i = 0; i < sizeof(extra); i++)
+    h = (h ^ p[i]) * 1099511628211ULL;
+  return h;
+}
+
+static bool glyph_run_matches(GlyphRun *run, uint64_t hash, RenFont **fonts, const char *text, size_t len, RenTab tab, int tab_size) {
+  return run->hash == hash && run->len == len && run->tab_size == tab_size
+    && memcmp(&run->tab, &tab, sizeof(RenTab)) == 0
+    && memcmp(run->fonts, fonts, sizeof(run->fonts)) == 0
+    && memcmp(run->text, text, len) == 0;
+}
+
+static void glyph_run_unlink(GlyphRun *run) {
+  if (run->lru_prev) run->lru_prev->lru_next = run->lru_next;
+  else glyph_runs.lru_first = run->lru_next;
+  if (run->lru_next) run->lru_next->lru_prev = run->lru_prev;
+  else glyph_runs.lru_last = run->lru_prev;
+  run->lru_prev = run->lru_next = NULL;
+}
+
+static void glyph_run_push_front(GlyphRun *run) {
+  run->lru_next = glyph_runs.lru_first;
+  if (glyph_runs.lru_first) glyph_runs.lru_first->lru_prev = run;
+  glyph_runs.lru_first = run;
+  if (!glyph_runs.lru_last) glyph_runs.lru_last = run;
+}
+
+static void glyph_run_evict(GlyphRun *run) {
+  GlyphRun **slot = &glyph_runs.buckets[run->hash & (GLYPH_RUN_CACHE_BUCKETS - 1)];
+  while (*slot != run) slot = &(*slot)->bucket_next;
+  *slot = run->bucket_next;
+  glyph_run_unlink(run);
+  glyph_runs.size -= run->len;
+  SDL_free(run);
+}
+
+static void glyph_run_cache_trim(void) {
+  // runs may be in use by other threads while drawing in parallel, so they're only evicted afterwards
+  if (draw_mutex_enabled) return;
+  while (glyph_runs.size > GLYPH_RUN_CACHE_SIZE && glyph_runs.lru_last)
+    glyph_run_evict(glyph_runs.lru_last);
+}
 
-  bool set_x_offset = x_offset == NULL;
+static void glyph_run_cache_clear(void) {
+  while (glyph_runs.lru_first) {
+    GlyphRun *run = glyph_runs.lru_first;
+    glyph_runs.lru_first = run->lru_next;
+    SDL_free(run);
+  }
+  memset(&glyph_runs, 0, sizeof(glyph_runs));
+}
+
+static GlyphRun *glyph_run_build(RenFont **fonts, const char *text, size_t len, RenTab tab, int tab_size, uint64_t hash) {
+  // a string never has more codepoints than bytes
+  GlyphRun *run = check_alloc(SDL_malloc(sizeof(GlyphRun) + sizeof(RunGlyph) * len + len));
+  memset(run, 0, sizeof(GlyphRun));
+  run->hash = hash;
+  memcpy(run->fonts, fonts, sizeof(run->fonts));
+  run->tab = tab;
+  run->tab_size = tab_size;
+  run->len = len;
+  run->text = (char *) &run->glyphs[len];
+  memcpy(run->text, text, len);
+
+  const char *end = text + len;
   while (text < end) {
-    unsigned int codepoint;
+    unsigned int codepoint, glyph_id = 0;
     text = utf8_to_codepoint(text, end, &codepoint);
     GlyphMetric *metric = NULL;
-    font_group_get_glyph(fonts, codepoint, 0, NULL, &metric);
-    width += font_get_xadvance(fonts[0], codepoint, metric, width, tab);
-    if (!set_x_offset && metric) {
-      set_x_offset = true;
-      *x_offset = metric->bitmap_left; // TODO: should this be scaled by the surface scale?
+    RenFont *font = font_group_get_glyph(fonts, codepoint, 0, NULL, &metric, &glyph_id);
+    float xadvance = font_get_xadvance(fonts[0], codepoint, metric, run->width, tab, tab_size);
+    run->glyphs[run->nglyphs++] = (RunGlyph) {
+      .font = font, .glyph_id = glyph_id, .xadvance = xadvance,
+      .whitespace = is_whitespace(codepoint), .has_metric = metric != NULL
+    };
+    run->width += xadvance;
+  }
+  return run;
+}
+
+// Returns the run for the given text, from the cache if possible.
+// If *temporary is set, the run wasn't cached and must be freed by the caller.
+static GlyphRun *glyph_run_get(RenFont **fonts, const char *text, size_t len, RenTab tab, int tab_size, bool *temporary) {
+  uint64_t hash = glyph_run_hash(fonts, text, len, tab, tab_size);
+  *temporary = len > GLYPH_RUN_MAX_LEN;
+  if (*temporary) return glyph_run_build(fonts, text, len, tab, tab_size, hash);
+
+  GlyphRun **slot = &glyph_runs.buckets[hash & (GLYPH_RUN_CACHE_BUCKETS - 1)];
+  for (GlyphRun *run = *slot; run; run = run->bucket_next) {
+    if (glyph_run_matches(run, hash, fonts, text, len, tab, tab_size)) {
+      glyph_run_unlink(run);
+      glyph_run_push_front(run);
+      return run;
     }
   }
-  if (!set_x_offset)
+  GlyphRun *run = glyph_run_build(fonts, text, len, tab, tab_size, hash);
+  run->bucket_next = *slot;
+  *slot = run;
+  glyph_run_push_front(run);
+  glyph_runs.size += run->len;
+  glyph_run_cache_trim();
+  return run;
+}
+
+double ren_font_group_get_width(RenFont **fonts, const char *text, size_t len, RenTab tab, int *x_offset) {
+  bool temporary;
+  GlyphRun *run = glyph_run_get(fonts, text, len, tab, fonts[0]->tab_size, &temporary);
+  double width = run->width;
+  if (x_offset) {
     *x_offset = 0;
+    for (size_t i = 0; i < run->nglyphs; i++) {
+      if (run->glyphs[i].has_metric) {
+        // TODO: should this be scaled by the surface scale?
+        *x_offset = font_load_glyph_metric(run->glyphs[i].font, run->glyphs[i].glyph_id, 0)->bitmap_left;
+        break;
+      }
+    }
+  }
+  if (temporary) SDL_free(run);
 #ifdef LITE_USE_SDL_RENDERER
   return width / fonts[0]->scale;
 #else
@@ -616,16 +787,121 @@ void ren_font_dump(RenFont *font) {
 }
 #endif
 
-double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t len, float x, int y, RenColor color, RenTab tab) {
+/******************* Glyph blending **********************/
+
+// blending state for 32bpp surfaces that store each color channel in a whole byte,
+// which lets us blend every byte independently and process multiple pixels at once
+typedef struct {
+  bool enabled;
+  uint32_t color;       // text color, laid out like a surface pixel
+  uint32_t gray_spread; // multiplier to spread a grayscale coverage into each color byte
+  int shift_r, shift_g, shift_b;
+  uint8_t alpha;
+} GlyphBlender;
+
+static GlyphBlender glyph_blender_init(const SDL_PixelFormatDetails *format, RenColor color) {
+  GlyphBlender b = { .enabled = false };
+  if (format->bytes_per_pixel != 4
+      || format->Rmask != (0xffu << format->Rshift) || format->Rshift % 8
+      || format->Gmask != (0xffu << format->Gshift) || format->Gshift % 8
+      || format->Bmask != (0xffu << format->Bshift) || format->Bshift % 8)
+    return b;
+  b.enabled = true;
+  b.shift_r = format->Rshift; b.shift_g = format->Gshift; b.shift_b = format->Bshift;
+  b.color = (uint32_t) color.r << b.shift_r | (uint32_t) color.g << b.shift_g | (uint32_t) color.b << b.shift_b;
+  b.gray_spread = 1u << b.shift_r | 1u << b.shift_g | 1u << b.shift_b;
+  b.alpha = color.a;
+  return b;
+}
+
+// rounded division by 255, exact for x <= 65025
+static inline uint32_t div255(uint32_t x) {
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+// coverage of a glyph pixel, laid out like a surface pixel (0 in the bytes that aren't colors)
+static inline uint32_t glyph_coverage(const GlyphBlender *b, const uint8_t *src, bool subpixel) {
+  if (subpixel)
+    return (uint32_t) src[0] << b->shift_r | (uint32_t) src[1] << b->shift_g | (uint32_t) src[2] << b->shift_b;
+  return src[0] * b->gray_spread;
+}
+
+static inline uint32_t blend_glyph_pixel(const GlyphBlender *b, uint32_t dst, uint32_t coverage) {
+  uint32_t out = 0;
+  for (int i = 0; i < 32; i += 8) {
+    uint32_t w = div255(((coverage >> i) & 0xff) * b->alpha);
+    uint32_t c = (b->color >> i) & 0xff, d = (dst >> i) & 0xff;
+    out |= div255(c * w + d * (255 - w)) << i;
+  }
+  return out;
+}
+
+#if defined(RENDERER_USE_SSE2)
+static inline __m128i div255_epi16(__m128i x) {
+  x = _mm_add_epi16(x, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+static inline __m128i blend_glyph_epi16(__m128i coverage, __m128i dst, __m128i color, __m128i alpha) {
+  __m128i w = div255_epi16(_mm_mullo_epi16(coverage, alpha));
+  __m128i iw = _mm_sub_epi16(_mm_set1_epi16(255), w);
+  return div255_epi16(_mm_add_epi16(_mm_mullo_epi16(color, w), _mm_mullo_epi16(dst, iw)));
+}
+#elif defined(RENDERER_USE_NEON)
+static inline uint8x8_t blend_glyph_u8(uint8x8_t coverage, uint8x8_t dst, uint8x8_t color, uint8x8_t alpha) {
+  uint16x8_t x = vmull_u8(coverage, alpha);
+  uint8x8_t w = vraddhn_u16(x, vrshrq_n_u16(x, 8));
+  x = vmlal_u8(vmull_u8(color, w), dst, vsub_u8(vdup_n_u8(255), w));
+  return vraddhn_u16(x, vrshrq_n_u16(x, 8));
+}
+#endif
+
+// blends a row of glyph pixels into the surface, 4 pixels at a time when SIMD is available
+static void blend_glyph_row(const GlyphBlender *b, uint32_t *dst, const uint8_t *src, int count, bool subpixel) {
+  const int step = subpixel ? 3 : 1;
+  int x = 0;
+#if defined(RENDERER_USE_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i color = _mm_unpacklo_epi8(_mm_set1_epi32(b->color), zero);
+  const __m128i alpha = _mm_set1_epi16(b->alpha);
+  for (; x + 4 <= count; x += 4, src += step * 4, dst += 4) {
+    __m128i coverage = _mm_set_epi32(
+      glyph_coverage(b, src + step * 3, subpixel), glyph_coverage(b, src + step * 2, subpixel),
+      glyph_coverage(b, src + step, subpixel), glyph_coverage(b, src, subpixel)
+    );
+    __m128i d = _mm_loadu_si128((__m128i *) dst);
+    __m128i lo = blend_glyph_epi16(_mm_unpacklo_epi8(coverage, zero), _mm_unpacklo_epi8(d, zero), color, alpha);
+    __m128i hi = blend_glyph_epi16(_mm_unpackhi_epi8(coverage, zero), _mm_unpackhi_epi8(d, zero), color, alpha);
+    _mm_storeu_si128((__m128i *) dst, _mm_packus_epi16(lo, hi));
+  }
+#elif defined(RENDERER_USE_NEON)
+  const uint8x8_t color = vreinterpret_u8_u32(vdup_n_u32(b->color));
+  const uint8x8_t alpha = vdup_n_u8(b->alpha);
+  for (; x + 4 <= count; x += 4, src += step * 4, dst += 4) {
+    uint32_t coverage_px[4] = {
+      glyph_coverage(b, src, subpixel), glyph_coverage(b, src + step, subpixel),
+      glyph_coverage(b, src + step * 2, subpixel), glyph_coverage(b, src + step * 3, subpixel)
+    };
+    uint8x16_t coverage = vreinterpretq_u8_u32(vld1q_u32(coverage_px));
+    uint8x16_t d = vreinterpretq_u8_u32(vld1q_u32(dst));
+    uint8x8_t lo = blend_glyph_u8(vget_low_u8(coverage), vget_low_u8(d), color, alpha);
+    uint8x8_t hi = blend_glyph_u8(vget_high_u8(coverage), vget_high_u8(d), color, alpha);
+    vst1q_u32(dst, vreinterpretq_u32_u8(vcombine_u8(lo, hi)));
+  }
+#endif
+  for (; x < count; x++, src += step, dst++)
+    *dst = blend_glyph_pixel(b, *dst, glyph_coverage(b, src, subpixel));
+}
+
+double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t len, float x, int y, RenColor color, RenTab tab, int tab_size) {
   SDL_Surface *surface = rs->surface;
   SDL_Rect clip;
   SDL_GetSurfaceClipRect(surface, &clip);
 
   const int surface_scale = rs->scale;
   double pen_x = x * surface_scale;
-  double original_pen_x = pen_x;
   y *= surface_scale;
-  const char* end = text + len;
   uint8_t* destination_pixels = surface->pixels;
   int clip_end_x = clip.x + clip.w, clip_end_y = clip.y + clip.h;
 
@@ -633,20 +909,35 @@ double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t l
   double last_pen_x = x;
   bool underline = fonts[0]->style & FONT_STYLE_UNDERLINE;
   bool strikethrough = fonts[0]->style & FONT_STYLE_STRIKETHROUGH;
-
-  while (text < end) {
-    unsigned int codepoint, r, g, b;
-    text = utf8_to_codepoint(text, end,  &codepoint);
-    SDL_Surface *font_surface = NULL; GlyphMetric *metric = NULL;
-    RenFont* font = font_group_get_glyph(fonts, codepoint, (int)(fmod(pen_x, 1.0) * SUBPIXEL_BITMAPS_CACHED), &font_surface, &metric);
+  const SDL_PixelFormatDetails* surface_format = SDL_GetPixelFormatDetails(surface->format);
+  const GlyphBlender blender = glyph_blender_init(surface_format, color);
+
+  bool temporary_run;
+  draw_lock();
+  GlyphRun *run = glyph_run_get(fonts, text, len, tab, tab_size, &temporary_run);
+  draw_unlock();
+
+  for (size_t glyph_idx = 0; glyph_idx < run->nglyphs; glyph_idx++) {
+    unsigned int r, g, b;
+    const RunGlyph *glyph = &run->glyphs[glyph_idx];
+    const bool last_glyph = glyph_idx == run->nglyphs - 1;
+    RenFont* font = glyph->font;
+    if (!glyph->has_metric)
+      break;
+    int subpixel_idx = FONT_IS_SUBPIXEL(font) ? (int)(fmod(pen_x, 1.0) * SUBPIXEL_BITMAPS_CACHED) : 0;
+    if (subpixel_idx < 0) subpixel_idx += SUBPIXEL_BITMAPS_CACHED;
+    draw_lock();
+    GlyphMetric *metric = font_load_glyph_metric(font, glyph->glyph_id, subpixel_idx);
+    SDL_Surface *font_surface = metric ? font_load_glyph_bitmap(font, glyph->glyph_id, subpixel_idx) : NULL;
+    draw_unlock();
     if (!metric)
       break;
     int start_x = floor(pen_x) + metric->bitmap_left;
     int end_x = metric->x1 + start_x; // x0 is assumed to be 0
     int glyph_end = metric->x1, glyph_start = 0;
-    if (!font_surface && !is_whitespace(codepoint))
+    if (!font_surface && !glyph->whitespace)
       ren_draw_rect(rs, (RenRect){ start_x + 1, y, font->space_advance - 1, ren_font_group_get_height(fonts) }, color);
-    if (!is_whitespace(codepoint) && font_surface && color.a > 0 && end_x >= clip.x && start_x < clip_end_x) {
+    if (!glyph->whitespace && font_surface && color.a > 0 && end_x >= clip.x && start_x < clip_end_x) {
       uint8_t* source_pixels = font_surface->pixels;
       for (int line = metric->y0; line < metric->y1; ++line) {
         int target_y = line - metric->y0 + y - metric->bitmap_top + (fonts[0]->baseline * surface_scale);
@@ -661,12 +952,15 @@ double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t l
           start_x += offset;
           glyph_start += offset;
         }
-        
-        const SDL_PixelFormatDetails* surface_format = SDL_GetPixelFormatDetails(surface->format);
+
         const SDL_PixelFormatDetails* font_surface_format = SDL_GetPixelFormatDetails(font_surface->format);
 
         uint32_t* destination_pixel = (uint32_t*)&(destination_pixels[surface->pitch * target_y + start_x * surface_format->bytes_per_pixel]);
         uint8_t* source_pixel = &source_pixels[line * font_surface->pitch + glyph_start * font_surface_format->bytes_per_pixel];
+        if (blender.enabled) {
+          blend_glyph_row(&blender, destination_pixel, source_pixel, glyph_end - glyph_start, metric->format == EGlyphFormatSubpixel);
+          continue;
+        }
         for (int x = glyph_start; x < glyph_end; ++x) {
           uint32_t destination_color = *destination_pixel;
           // the standard way of doing this would be SDL_GetRGBA, but that introduces a performance regression. needs to be investigated
@@ -697,11 +991,11 @@ double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t l
       }
     }
 
-    float adv = font_get_xadvance(fonts[0], codepoint, metric, pen_x - original_pen_x, tab);
+    float adv = glyph->xadvance;
 
     if(!last) last = font;
-    else if(font != last || text == end) {
-      double local_pen_x = text == end ? pen_x + adv : pen_x;
+    else if(font != last || last_glyph) {
+      double local_pen_x = last_glyph ? pen_x + adv : pen_x;
       if (underline)
         ren_draw_rect(rs, (RenRect){last_pen_x, y / surface_scale + last->height - 1, (local_pen_x - last_pen_x) / surface_scale, last->underline_thickness * surface_scale}, color);
       if (strikethrough)
@@ -712,6 +1006,7 @@ double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t l
 
     pen_x += adv;
   }
+  if (temporary_run) SDL_free(run);
   return pen_x / surface_scale;
 }
 
@@ -745,12 +1040,24 @@ void ren_draw_rect(RenSurface *rs, RenRect rect, RenColor color) {
     SDL_GetSurfaceClipRect(surface, &clip);
     if (!SDL_GetRectIntersection(&clip, &dest_rect, &dest_rect)) return;
 
+    draw_lock();
     uint32_t *pixel = (uint32_t *)draw_rect_surface->pixels;
     *pixel = SDL_MapSurfaceRGBA(draw_rect_surface, color.r, color.g, color.b, color.a);
     SDL_BlitSurfaceScaled(draw_rect_surface, NULL, surface, &dest_rect, SDL_SCALEMODE_LINEAR);
+    draw_unlock();
   }
 }
 
+void ren_set_surface_clip_rect(RenSurface *rs, RenRect rect) {
+  const int scale = rs->scale;
+  SDL_SetSurfaceClipRect(rs->surface, &(SDL_Rect){ .x = rect.x * scale, .y = rect.y * scale, .w = rect.width * scale, .h = rect.height * scale });
+}
+
+void ren_set_parallel_drawing(bool enabled) {
+  draw_mutex_enabled = enabled && draw_mutex;
+  glyph_run_cache_trim();
+}
+
 /*************** Window Management ****************/
 static void ren_add_window(RenWindow *window_renderer) {
   window_count += 1;
@@ -802,10 +1109,15 @@ int ren_init(void) {
   if ((err = FT_Init_FreeType(&library)) != 0)
     return SDL_SetError("%s", get_ft_error(err));
 
+  // without the mutex we can still draw, just not from multiple threads
+  draw_mutex = SDL_CreateMutex();
+
   return 0;
 }
 
 void ren_free(void) {
+  draw_mutex_enabled = false;
+  SDL_DestroyMutex(draw_mutex);
   SDL_DestroySurface(draw_rect_surface);
   FT_Done_FreeType(library);
 }
@@ -38,9 +38,13 @@ void update_font_scale(RenWindow *window_renderer, RenFont **fonts);
 #endif
 void ren_font_group_set_tab_size(RenFont **font, int n);
 double ren_font_group_get_width(RenFont **font, const char *text, size_t len, RenTab tab, int *x_offset);
-double ren_draw_text(RenSurface *rs, RenFont **font, const char *text, size_t len, float x, int y, RenColor color, RenTab tab);
+double ren_draw_text(RenSurface *rs, RenFont **font, const char *text, size_t len, float x, int y, RenColor color, RenTab tab, int tab_size);
 
 void ren_draw_rect(RenSurface *rs, RenRect rect, RenColor color);
+void ren_set_surface_clip_rect(RenSurface *rs, RenRect rect);
+/* Allows ren_draw_text and ren_draw_rect to be called from multiple threads,
+** as long as each thread uses its own RenSurface and draws to distinct pixels. */
+void ren_set_parallel_drawing(bool enabled);
 
 int video_init(void);
 int ren_init(void);